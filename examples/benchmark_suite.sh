@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Sweep of ns3sionna-performance-sionna; each run is appended as a JSON line to RESULTS.
+# Compare the server timing (GPU bound), the IPC round trips (IPC bound) and the wallclock
+# (ns-3 bound) of the runs.
+
+cd ../../../
+
+RESULTS=${1:-benchmark_ns3sionna.json}
+MAX_STAS=${MAX_STAS:-32}
+
+# some info about the machine
+hostname
+lscpu | grep "Model name"
+
+rm -f ${RESULTS}
+
+for MODE_SUB in "1:1" "2:1" "3:4" "3:16"; do
+  MODE=${MODE_SUB%%:*}
+  SUB_MODE=${MODE_SUB##*:}
+  for SPEED in 0.0 1.0 7.0; do
+    MOBILE=$([ "${SPEED}" == "0.0" ] && echo false || echo true)
+    for WIDTH in 20 80; do
+      echo "Test mode ${MODE}/${SUB_MODE}, speed ${SPEED}, width ${WIDTH}MHz"
+      ./ns3 run "ns3sionna-performance-sionna --sim_max_stas=${MAX_STAS} --mobile_scenario=${MOBILE} --mobile_speed=${SPEED} --udp_pkt_interval=20 --caching=true --mode=${MODE} --sub_mode=${SUB_MODE} --channel_width=${WIDTH} --json=${RESULTS}"
+    done
+  done
+done
+
+echo "Results written to ${RESULTS}"
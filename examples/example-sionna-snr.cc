@@ -307,8 +307,12 @@ main(int argc, char* argv[])
     // set center frequency & bandwidth for Sionna
     WifiStandard wifi_standard = WIFI_STANDARD_80211ax; // WIFI6
     sionnaHelper.Configure(freq_0, channelWidth, getFFTSize(wifi_standard, channelWidth), getSubcarrierSpacing(wifi_standard));
+    // the same 2x2 arrays as the UniformPlanarArrays above
+    sionnaHelper.SetAntennaArray(2, 2);
 
     sionnaHelper.Start();
+    // both nodes keep their positions: trace their link before the simulation runs
+    sionnaHelper.Precompute(propagationCache);
 
     Simulator::Run();
     Simulator::Destroy();
@@ -22,10 +22,12 @@
 #include "ns3/ssid.h"
 #include "ns3/wifi-net-device.h"
 
+#include <fstream>
+
 /**
  * Example used for benchmarking ns3sionna with fixed WiFi AP and varying numbers of also fixed or
  * mobile stations. The traffic is Echo/UDP/IP broadcast initiated by the WiFi AP.
- * The WiFi setting is: 802.11ax, 20 MHz channel bandwidth.
+ * The WiFi setting is: 802.11ax, 20 MHz channel bandwidth (configurable).
  * Note: the execution time of the simulation depends heavily on the number of channel
  * recomputations which in turn depends on the speed of the mobile (coherence time) and the traffic
  * pattern.
@@ -39,8 +41,54 @@ using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE("PerformanceSionna");
 
+// append the result of a single run as a JSON line
+void
+WriteJsonResult(const std::string json_fname,
+                const uint32_t numStas,
+                const bool mobile_scenario,
+                const double mobile_speed,
+                const int channel_width,
+                const int mode,
+                const int sub_mode,
+                const double computationTime,
+                Ptr<SionnaPropagationCache> propagationCache,
+                const SionnaHelper& sionnaHelper)
+{
+    const SionnaHelper::IpcStats& ipc = sionnaHelper.GetIpcStats();
+
+    std::ofstream json(json_fname, std::ios::app);
+    NS_ABORT_MSG_IF(!json, "Cannot open " << json_fname);
+    json << "{\"num_stas\": " << numStas << ", \"mobile_scenario\": " << (mobile_scenario ? "true" : "false")
+         << ", \"mobile_speed\": " << mobile_speed << ", \"channel_width\": " << channel_width
+         << ", \"mode\": " << mode << ", \"sub_mode\": " << sub_mode
+         << ", \"wallclock_s\": " << computationTime
+         << ", \"cache\": {\"lookups\": " << propagationCache->GetHits() + propagationCache->GetMisses()
+         << ", \"hits\": " << propagationCache->GetHits() << ", \"misses\": " << propagationCache->GetMisses()
+         << ", \"evictions\": " << propagationCache->GetEvictions()
+         << ", \"prefetches\": " << propagationCache->GetPrefetches()
+         << ", \"culled\": " << propagationCache->GetCulled() << "}"
+         << ", \"ipc\": {\"requests\": " << ipc.m_requests << ", \"bytes_sent\": " << ipc.m_bytes_sent
+         << ", \"bytes_received\": " << ipc.m_bytes_received << ", \"parse_s\": " << ipc.m_parse_time
+         << ", \"rtt_histogram_us\": {";
+    // keyed by the upper bound of the bucket; empty buckets are omitted
+    bool first = true;
+    for (size_t i = 0; i < ipc.m_rtt_histogram.size(); i++)
+    {
+        if (ipc.m_rtt_histogram[i] > 0)
+        {
+            json << (first ? "" : ", ") << "\"" << (1ULL << i) << "\": " << ipc.m_rtt_histogram[i];
+            first = false;
+        }
+    }
+    json << "}}, \"server\": {\"trace_s\": " << ipc.m_server_trace_time
+         << ", \"postprocess_s\": " << ipc.m_server_postprocess_time
+         << ", \"fill_s\": " << ipc.m_server_fill_time
+         << ", \"serialize_s\": " << ipc.m_server_serialize_time << "}}" << std::endl;
+}
+
 double
 RunSimulation(const std::string environment,
+              const std::string zmq_url,
               const uint32_t numStas,
               const bool mobile_scenario,
               const double mobile_speed,
@@ -48,13 +96,21 @@ RunSimulation(const std::string environment,
               const bool caching,
               const int mode,
               const int sub_mode,
+              const int prefetch_ms,
+              const int csi_encoding,
+              const int shm_kb,
+              const int csi_decimation,
+              const std::string trace_prefix,
+              const bool replay,
+              const int channel_width,
+              const std::string time_evo,
+              const std::string json_fname,
               const bool verbose)
 {
-    // Wifi config
-    int wifi_channel_num = 40; // center at 5200
-    int channel_width = 20;
+    // Wifi config; the channel of the given width containing the one at 5200 MHz
+    int wifi_channel_num = channel_width == 20 ? 40 : channel_width == 40 ? 38 : channel_width == 80 ? 42 : 50;
 
-    SionnaHelper sionnaHelper(environment, "tcp://localhost:5555");
+    SionnaHelper sionnaHelper(environment, zmq_url);
 
     // variable number of STAs
     NodeContainer wifiStaNodes;
@@ -69,6 +125,29 @@ RunSimulation(const std::string environment,
     Ptr<SionnaPropagationCache> propagationCache = CreateObject<SionnaPropagationCache>();
     propagationCache->SetSionnaHelper(sionnaHelper);
     propagationCache->SetCaching(caching);
+    sionnaHelper.SetCsiEncoding(static_cast<ns3sionna::CsiEncoding>(csi_encoding));
+    sionnaHelper.SetSharedMemory(static_cast<uint64_t>(shm_kb) * 1024);
+    sionnaHelper.SetCsiDecimation(csi_decimation);
+    sionnaHelper.SetTimeEvolutionModel(time_evo);
+    if (!trace_prefix.empty())
+    {
+        // one trace per number of STAs
+        std::string trace_path = trace_prefix + "-" + std::to_string(numStas) + ".trace";
+        if (replay)
+        {
+            sionnaHelper.SetTraceReplay(trace_path);
+        }
+        else
+        {
+            sionnaHelper.SetTraceRecord(trace_path);
+        }
+    }
+    if (prefetch_ms > 0)
+    {
+        // request CSI of links expiring soon without blocking the simulation
+        sionnaHelper.SetPrefetch(true);
+        propagationCache->SetAttribute("PrefetchHorizon", TimeValue(MilliSeconds(prefetch_ms)));
+    }
 
     // new
     Ptr<MultiModelSpectrumChannel> spectrumChannel = CreateObject<MultiModelSpectrumChannel>();
@@ -224,6 +303,7 @@ RunSimulation(const std::string environment,
     Simulator::Destroy();
 
     propagationCache->PrintStats();
+    sionnaHelper.PrintIpcStats();
 
     sionnaHelper.Destroy();
 
@@ -233,6 +313,12 @@ RunSimulation(const std::string environment,
     std::cout << "Finished simulation with " << numStas << " stations in " << computationTime
               << " sec";
 
+    if (!json_fname.empty())
+    {
+        WriteJsonResult(json_fname, numStas, mobile_scenario, mobile_speed, channel_width, mode, sub_mode,
+                        computationTime, propagationCache, sionnaHelper);
+    }
+
     std::cout << std::endl << std::endl;
     return computationTime;
 }
@@ -250,6 +336,16 @@ main(int argc, char* argv[])
     int sim_max_stas = 4;
     int mode = 1; // todo: 3;
     int sub_mode = 16;
+    int prefetch_ms = 0;
+    int csi_encoding = ns3sionna::CSI_REPEATED_DOUBLE;
+    int shm_kb = 0;
+    int csi_decimation = 1;
+    std::string trace_prefix = "";
+    bool replay = false;
+    int channel_width = 20;
+    std::string time_evo = "position";
+    std::string json_fname = "";
+    std::string zmq_url = "tcp://localhost:5555";
 
     CommandLine cmd(__FILE__);
     cmd.AddValue("mobile_scenario", "Enable node movement", mobile_scenario);
@@ -261,9 +357,22 @@ main(int argc, char* argv[])
     cmd.AddValue("caching", "Enable caching of propagation delay and loss", caching);
     cmd.AddValue("mode", "The Sionna mode", mode);
     cmd.AddValue("sub_mode", "The Sionna submode", sub_mode);
+    cmd.AddValue("prefetch_ms", "Prefetch horizon in ms; 0 disables prefetching", prefetch_ms);
+    cmd.AddValue("csi_encoding", "CFR wire format: 0=double, 1=float32, 2=float16, 3=int16", csi_encoding);
+    cmd.AddValue("shm_kb", "Size of the shared memory for CSI in KiB (server on same host); 0 disables it", shm_kb);
+    cmd.AddValue("csi_decimation", "Compute the CFR only for every n-th subcarrier; 1 computes all", csi_decimation);
+    cmd.AddValue("trace_prefix", "Record the CSI into <prefix>-<#STAs>.trace (not with time_evo doppler); empty disables it", trace_prefix);
+    cmd.AddValue("replay", "Replay the CSI traces of trace_prefix instead of using the Sionna server", replay);
+    cmd.AddValue("channel_width", "WiFi channel width in MHz: 20, 40, 80 or 160", channel_width);
+    cmd.AddValue("time_evo", "CSI time evolution model: position or doppler", time_evo);
+    cmd.AddValue("json", "Append the results of each run as a JSON line to this file; empty disables it", json_fname);
+    cmd.AddValue("zmq_url", "URL of the Sionna server", zmq_url);
     cmd.AddValue("verbose", "Enable logging", verbose);
     cmd.Parse(argc, argv);
 
+    NS_ABORT_MSG_IF(channel_width != 20 && channel_width != 40 && channel_width != 80 && channel_width != 160,
+                    "Unsupported channel width: " << channel_width);
+
     if (verbose)
     {
         LogComponentEnable("UdpEchoClientApplication", LOG_LEVEL_INFO);
@@ -282,7 +391,8 @@ main(int argc, char* argv[])
     std::cout << "Config: mob " << mobile_scenario;
     std::cout << " speed " << mobile_speed << " pktinterval " << udp_pkt_interval;
     std::cout << " caching " << caching << " env " << environment;
-    std::cout << " mode " << mode << " submode " << sub_mode << std::endl;
+    std::cout << " mode " << mode << " submode " << sub_mode << " prefetch " << prefetch_ms << "ms";
+    std::cout << " width " << channel_width << "MHz" << " time_evo " << time_evo << std::endl;
 
     uint32_t numStas = sim_min_stas;
     double computationTime = 0.0;
@@ -290,6 +400,7 @@ main(int argc, char* argv[])
            numStas <= (uint32_t)sim_max_stas) // as long as a single run is below 2h
     {
         computationTime = RunSimulation(environment,
+                                        zmq_url,
                                         numStas,
                                         mobile_scenario,
                                         mobile_speed,
@@ -297,6 +408,15 @@ main(int argc, char* argv[])
                                         caching,
                                         mode,
                                         sub_mode,
+                                        prefetch_ms,
+                                        csi_encoding,
+                                        shm_kb,
+                                        csi_decimation,
+                                        trace_prefix,
+                                        replay,
+                                        channel_width,
+                                        time_evo,
+                                        json_fname,
                                         verbose);
         numStas = numStas * 2;
     }
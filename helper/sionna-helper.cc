@@ -11,18 +11,51 @@
 #include "ns3/mobility-module.h"
 #include "ns3/network-module.h"
 #include "../model/sionna-mobility-model.h"
+#include "../model/sionna-propagation-cache.h"
 #include "sionna-utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 namespace ns3
 {
 
 NS_LOG_COMPONENT_DEFINE("SionnaHelper");
 
+namespace
+{
+
+// replace the "{rank}" placeholder by the system ID of this (MPI) rank
+std::string
+ExpandRank(std::string s)
+{
+    const std::string placeholder = "{rank}";
+    std::string rank = std::to_string(Simulator::GetSystemId());
+    for (size_t pos = s.find(placeholder); pos != std::string::npos; pos = s.find(placeholder, pos + rank.size()))
+    {
+        s.replace(pos, placeholder.size(), rank);
+    }
+    return s;
+}
+
+} // namespace
+
+SionnaHelper::IpcStats::IpcStats()
+    : m_requests(0), m_replies(0), m_bytes_sent(0), m_bytes_received(0), m_parse_time(0),
+      m_rtt_histogram(RTT_HISTOGRAM_BUCKETS, 0), m_server_trace_time(0), m_server_postprocess_time(0),
+      m_server_fill_time(0), m_server_serialize_time(0), m_last_rtt_ns(0), m_last_reply_bytes(0)
+{
+}
+
 SionnaHelper::SionnaHelper(std::string environment, std::string zmq_url): m_zmq_url(zmq_url),
-    m_environment(environment), m_zmq_context(1), m_zmq_socket(m_zmq_context, ZMQ_REQ)
+    m_environment(environment), m_p2mp_radius(0), m_p2mp_max_loss(0), m_prefetch(false), m_pending_replies(0),
+    m_csi_encoding(ns3sionna::CSI_REPEATED_DOUBLE), m_csi_decimation(1), m_shm_size(0), m_shm(nullptr), m_shm_consumed(0),
+    m_trace_replay(false), m_zmq_context(1), m_antenna_rows(1), m_antenna_cols(1)
 {
-    // Connect
-    m_zmq_socket.connect(zmq_url);
+    // socket is connected in Start() once its type is known
     m_mode = MODE_P2MP_LAH;
     m_sub_mode = 1;
     // WiFi 6
@@ -88,12 +121,324 @@ SionnaHelper::SetMode(int mode)
     m_mode = mode;
 }
 
+int
+SionnaHelper::GetMode() const
+{
+    return m_mode;
+}
+
 void
 SionnaHelper::SetSubMode(int sub_mode)
 {
     m_sub_mode = sub_mode;
 }
 
+void
+SionnaHelper::SetP2mpReceiverSelection(double max_distance, double max_loss)
+{
+    NS_ASSERT_MSG(max_distance >= 0 && max_loss >= 0, "P2MP receiver selection must not be negative");
+    m_p2mp_radius = max_distance;
+    m_p2mp_max_loss = max_loss;
+}
+
+void
+SionnaHelper::SetPrefetch(bool prefetch)
+{
+    m_prefetch = prefetch;
+}
+
+bool
+SionnaHelper::IsPrefetch() const
+{
+    return m_prefetch;
+}
+
+void
+SionnaHelper::SetCsiEncoding(ns3sionna::CsiEncoding encoding)
+{
+    m_csi_encoding = encoding;
+}
+
+ns3sionna::CsiEncoding
+SionnaHelper::GetCsiEncoding() const
+{
+    return m_csi_encoding;
+}
+
+FreqHandle
+SionnaHelper::GetFrequencies() const
+{
+    return m_frequencies;
+}
+
+void
+SionnaHelper::SetCsiDecimation(uint32_t decimation)
+{
+    NS_ASSERT_MSG(decimation > 0, "CSI decimation must be positive");
+    m_csi_decimation = decimation;
+}
+
+void
+SionnaHelper::SetCsiSubcarriers(std::vector<uint32_t> subcarriers)
+{
+    NS_ASSERT_MSG(std::is_sorted(subcarriers.begin(), subcarriers.end()) &&
+                  std::adjacent_find(subcarriers.begin(), subcarriers.end()) == subcarriers.end(),
+                  "CSI subcarriers must be ascending");
+    m_csi_subcarriers = std::move(subcarriers);
+}
+
+const std::vector<uint32_t>&
+SionnaHelper::GetCsiSubcarriers() const
+{
+    return m_csi_subcarriers;
+}
+
+void
+SionnaHelper::SetTimeEvolutionModel(std::string model)
+{
+    NS_ABORT_MSG_IF(model != "position" && model != "doppler", "Unknown time evolution model " << model);
+    m_time_evo_model = model;
+}
+
+int
+SionnaHelper::GetFFTSize() const
+{
+    return m_fft_size;
+}
+
+uint32_t
+SionnaHelper::AddBand(int frequency, int fft_size, int ofdm_subcarrier_spacing)
+{
+    NS_ABORT_MSG_IF(frequency <= 0 || fft_size <= 0 || ofdm_subcarrier_spacing <= 0,
+                    "ns3sionna: invalid band " << frequency << " MHz");
+    m_bands.push_back(Band{frequency, fft_size, ofdm_subcarrier_spacing, nullptr});
+    return static_cast<uint32_t>(m_bands.size());
+}
+
+uint32_t
+SionnaHelper::GetNumBands() const
+{
+    return static_cast<uint32_t>(m_bands.size() + 1);
+}
+
+uint32_t
+SionnaHelper::GetBand(double frequency) const
+{
+    uint32_t band = 0;
+    double min_delta = std::abs(frequency - m_frequency * 1e6);
+    for (uint32_t i = 0; i < m_bands.size(); i++)
+    {
+        double delta = std::abs(frequency - m_bands[i].m_frequency * 1e6);
+        if (delta < min_delta)
+        {
+            min_delta = delta;
+            band = i + 1;
+        }
+    }
+    return band;
+}
+
+int
+SionnaHelper::GetBandFrequency(uint32_t band) const
+{
+    NS_ASSERT(band <= m_bands.size());
+    return band == 0 ? m_frequency : m_bands[band - 1].m_frequency;
+}
+
+int
+SionnaHelper::GetBandFFTSize(uint32_t band) const
+{
+    NS_ASSERT(band <= m_bands.size());
+    return band == 0 ? m_fft_size : m_bands[band - 1].m_fft_size;
+}
+
+FreqHandle
+SionnaHelper::GetBandFrequencies(uint32_t band) const
+{
+    NS_ASSERT(band >= 1 && band <= m_bands.size());
+    return m_bands[band - 1].m_frequencies;
+}
+
+void
+SionnaHelper::SetAntennaArray(uint32_t num_rows, uint32_t num_cols)
+{
+    NS_ABORT_MSG_IF(num_rows == 0 || num_cols == 0, "ns3sionna: invalid antenna array " << num_rows << "x" << num_cols);
+    m_antenna_rows = num_rows;
+    m_antenna_cols = num_cols;
+}
+
+uint32_t
+SionnaHelper::GetNumAntennas() const
+{
+    return m_antenna_rows * m_antenna_cols;
+}
+
+void
+SionnaHelper::SetSharedMemory(uint64_t size)
+{
+    m_shm_size = size;
+}
+
+const char*
+SionnaHelper::GetSharedMemory(uint64_t offset, uint32_t size) const
+{
+    NS_ASSERT_MSG(m_shm, "Shared memory is not mapped.");
+    uint64_t pos = offset % m_shm_size;
+    NS_ASSERT_MSG(pos + size <= m_shm_size, "Payload exceeds shared memory.");
+    return m_shm + pos;
+}
+
+uint64_t
+SionnaHelper::GetSharedMemoryConsumed() const
+{
+    return m_shm_consumed;
+}
+
+void
+SionnaHelper::SetSharedMemoryConsumed(uint64_t consumed)
+{
+    m_shm_consumed = std::max(m_shm_consumed, consumed);
+}
+
+void
+SionnaHelper::SetTraceRecord(std::string path)
+{
+    m_trace_path = path;
+    m_trace_replay = false;
+}
+
+void
+SionnaHelper::SetTraceReplay(std::string path)
+{
+    m_trace_path = path;
+    m_trace_replay = true;
+}
+
+bool
+SionnaHelper::IsReplay() const
+{
+    return m_trace_store.IsReplaying();
+}
+
+SionnaTraceStore*
+SionnaHelper::GetTraceStore()
+{
+    return m_trace_store.IsRecording() || m_trace_store.IsReplaying() ? &m_trace_store : nullptr;
+}
+
+void
+SionnaHelper::Precompute(Ptr<SionnaPropagationCache> cache, Time duration, Time step, uint32_t max_links_per_request)
+{
+    NS_ABORT_MSG_IF(!cache || cache->GetSionnaHelper() != this,
+                    "ns3sionna: precomputation requires a SionnaPropagationCache using this helper");
+    NS_ABORT_MSG_IF(Simulator::Now().IsStrictlyPositive(),
+                    "ns3sionna: Precompute() must be called before Simulator::Run()");
+    cache->Precompute(duration, step, max_links_per_request);
+}
+
+void
+SionnaHelper::SendMessage(const ns3sionna::Wrapper& wrapper)
+{
+    // Serialize the message
+    std::string serialized_message;
+    wrapper.SerializeToString(&serialized_message);
+
+    if (m_prefetch)
+    {
+        // empty delimiter frame as sent implicitly by a REQ socket
+        m_zmq_socket.send(zmq::message_t(), zmq::send_flags::sndmore);
+    }
+
+    // Send the message
+    zmq::message_t zmq_message(serialized_message.data(), serialized_message.size());
+    m_zmq_socket.send(zmq_message, zmq::send_flags::none);
+    m_pending_replies++;
+
+    m_send_times.push_back(std::chrono::steady_clock::now());
+    m_ipc_stats.m_requests++;
+    m_ipc_stats.m_bytes_sent += serialized_message.size();
+}
+
+bool
+SionnaHelper::ReceiveMessage(ns3sionna::Wrapper& wrapper, bool blocking)
+{
+    if (m_pending_replies == 0)
+    {
+        return false;
+    }
+
+    zmq::recv_flags flags = blocking ? zmq::recv_flags::none : zmq::recv_flags::dontwait;
+    zmq::message_t zmq_reply;
+    zmq::recv_result_t result = m_zmq_socket.recv(zmq_reply, flags);
+
+    if (!result)
+    {
+        NS_ASSERT_MSG(!blocking, "Failed to receive reply from Sionna server.");
+        return false;
+    }
+
+    if (m_prefetch)
+    {
+        // skip the empty delimiter frame; the payload follows immediately
+        NS_ASSERT_MSG(zmq_reply.size() == 0 && zmq_reply.more(), "Malformed reply from Sionna server.");
+        result = m_zmq_socket.recv(zmq_reply, zmq::recv_flags::none);
+        NS_ASSERT_MSG(result, "Failed to receive reply from Sionna server.");
+    }
+
+    m_pending_replies--;
+
+    // replies arrive in request order
+    auto now = std::chrono::steady_clock::now();
+    m_ipc_stats.m_last_rtt_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_send_times.front()).count();
+    m_send_times.pop_front();
+    uint64_t rtt_us = m_ipc_stats.m_last_rtt_ns / 1000;
+    size_t bucket = 0;
+    while (bucket + 1 < RTT_HISTOGRAM_BUCKETS && (1ULL << bucket) < rtt_us)
+    {
+        bucket++;
+    }
+    m_ipc_stats.m_rtt_histogram[bucket]++;
+
+    wrapper.ParseFromArray(zmq_reply.data(), zmq_reply.size());
+    m_ipc_stats.m_parse_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - now).count();
+    m_ipc_stats.m_replies++;
+    m_ipc_stats.m_bytes_received += zmq_reply.size();
+    m_ipc_stats.m_last_reply_bytes = zmq_reply.size();
+
+    if (wrapper.has_channel_state_response() && wrapper.channel_state_response().has_timing())
+    {
+        const auto& timing = wrapper.channel_state_response().timing();
+        m_ipc_stats.m_server_trace_time += timing.trace_ns() * 1e-9;
+        m_ipc_stats.m_server_postprocess_time += timing.postprocess_ns() * 1e-9;
+        m_ipc_stats.m_server_fill_time += timing.fill_ns() * 1e-9;
+        m_ipc_stats.m_server_serialize_time += timing.serialize_ns() * 1e-9;
+    }
+    return true;
+}
+
+uint32_t
+SionnaHelper::GetPendingReplies() const
+{
+    return m_pending_replies;
+}
+
+const SionnaHelper::IpcStats&
+SionnaHelper::GetIpcStats() const
+{
+    return m_ipc_stats;
+}
+
+void
+SionnaHelper::PrintIpcStats() const
+{
+    std::cout << "ns3sionna: IPC #requests: " << m_ipc_stats.m_requests << ", #bytes sent: "
+        << m_ipc_stats.m_bytes_sent << ", received: " << m_ipc_stats.m_bytes_received << ", parse time: "
+        << m_ipc_stats.m_parse_time << "s, server trace: " << m_ipc_stats.m_server_trace_time
+        << "s, postprocess: " << m_ipc_stats.m_server_postprocess_time << "s, fill: "
+        << m_ipc_stats.m_server_fill_time << "s, serialize: " << m_ipc_stats.m_server_serialize_time << "s"
+        << std::endl;
+}
+
 void
 SionnaHelper::Configure(int frequency, int channel_bw, int fft_size, int ofdm_subcarrier_spacing, int min_coherence_time_ms)
 {
@@ -157,17 +502,8 @@ SionnaHelper::RandomVariableStreamMessage(ns3sionna::SimInitMessage::NodeInfo::R
 }
 
 void
-SionnaHelper::Start()
+SionnaHelper::FillSimInitMessage(ns3sionna::SimInitMessage* simulation_info)
 {
-    std::cout << "ns3sionna configured for mode: " << m_mode << ", submode: " << m_sub_mode << std::endl;
-
-    std::cout << "ns3sionna: trying to connect to sionna via " << m_zmq_url << std::endl;
-
-    // Prepare the information message
-    ns3sionna::Wrapper wrapper;
-
-    // Fill the information message
-    ns3sionna::SimInitMessage* simulation_info = wrapper.mutable_sim_init_msg();
     simulation_info->set_scene_fname(m_environment);
     simulation_info->set_seed(RngSeedManager::GetSeed());
     simulation_info->set_frequency(m_frequency);
@@ -178,7 +514,40 @@ SionnaHelper::Start()
     simulation_info->set_subcarrier_spacing(m_subcarrier_spacing);
     simulation_info->set_mode(m_mode);
     simulation_info->set_sub_mode(m_sub_mode);
+    simulation_info->set_p2mp_radius(m_p2mp_radius);
+    simulation_info->set_p2mp_max_loss(m_p2mp_max_loss);
+    simulation_info->set_csi_encoding(m_csi_encoding);
+    for (const Band& band : m_bands)
+    {
+        ns3sionna::SimInitMessage::Band* band_info = simulation_info->add_bands();
+        band_info->set_frequency(band.m_frequency);
+        band_info->set_fft_size(band.m_fft_size);
+        band_info->set_subcarrier_spacing(band.m_subcarrier_spacing);
+    }
+    simulation_info->set_antenna_rows(m_antenna_rows);
+    simulation_info->set_antenna_cols(m_antenna_cols);
 
+    if (m_csi_subcarriers.empty() && m_csi_decimation > 1)
+    {
+        // every n-th subcarrier; the last one avoids extrapolation at the upper edge
+        for (int i = 0; i < m_fft_size; i += m_csi_decimation)
+        {
+            m_csi_subcarriers.push_back(i);
+        }
+        if (m_csi_subcarriers.back() != static_cast<uint32_t>(m_fft_size - 1))
+        {
+            m_csi_subcarriers.push_back(m_fft_size - 1);
+        }
+    }
+    NS_ABORT_MSG_IF(!m_csi_subcarriers.empty() && m_csi_subcarriers.back() >= static_cast<uint32_t>(m_fft_size),
+                    "ns3sionna: CSI subcarrier out of FFT range");
+    for (uint32_t subcarrier : m_csi_subcarriers)
+    {
+        simulation_info->add_csi_subcarriers(subcarrier);
+    }
+    // the CFR per antenna pair is not interpolated
+    NS_ABORT_MSG_IF(!m_csi_subcarriers.empty() && GetNumAntennas() > 1,
+                    "ns3sionna: CSI subcarriers are not supported with antenna arrays");
     NodeContainer c = NodeContainer::GetGlobal();
     for (auto iter = c.Begin(); iter != c.End(); ++iter)
     {
@@ -238,29 +607,142 @@ SionnaHelper::Start()
             }
         }
     }
+}
 
-    // Serialize the information message
-    std::string serialized_message;
-    wrapper.SerializeToString(&serialized_message);
+uint64_t
+SionnaHelper::GetConfigHash(const ns3sionna::SimInitMessage& config)
+{
+    std::string serialized_config;
+    config.SerializeToString(&serialized_config);
+    return SionnaTraceStore::Hash(serialized_config);
+}
+
+uint64_t
+SionnaHelper::GetConfigHash()
+{
+    ns3sionna::SimInitMessage config;
+    FillSimInitMessage(&config);
+    return GetConfigHash(config);
+}
+
+void
+SionnaHelper::Start()
+{
+    m_zmq_url = ExpandRank(m_zmq_url);
+    m_trace_path = ExpandRank(m_trace_path);
+
+    bool replay = m_trace_replay && !m_trace_path.empty();
+    if (replay)
+    {
+        // all CSI is taken from the trace
+        m_prefetch = false;
+    }
+
+    std::cout << "ns3sionna configured for mode: " << m_mode << ", submode: " << m_sub_mode
+        << ", prefetch: " << m_prefetch << std::endl;
+
+    if (!replay)
+    {
+        std::cout << "ns3sionna: trying to connect to sionna via " << m_zmq_url << std::endl;
+
+        // Connect; the server is ROUTER based and accepts both socket types
+        m_zmq_socket = zmq::socket_t(m_zmq_context, m_prefetch ? ZMQ_DEALER : ZMQ_REQ);
+        m_zmq_socket.connect(m_zmq_url);
+    }
+
+    if (m_shm_size > 0 && m_csi_encoding == ns3sionna::CSI_REPEATED_DOUBLE)
+    {
+        m_csi_encoding = ns3sionna::CSI_FLOAT32;
+    }
+
+    if (m_shm_size > 0 && !replay)
+    {
+        // unique per simulation; tmpfs if available
+        static uint32_t shm_instance = 0;
+        std::string dir = access("/dev/shm", W_OK) == 0 ? "/dev/shm" : "/tmp";
+        m_shm_path = dir + "/ns3sionna-" + std::to_string(getpid()) + "-" + std::to_string(shm_instance++);
+
+        int fd = open(m_shm_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        NS_ABORT_MSG_IF(fd < 0, "ns3sionna: cannot create shared memory " + m_shm_path);
+        NS_ABORT_MSG_IF(ftruncate(fd, m_shm_size) != 0, "ns3sionna: cannot size shared memory " + m_shm_path);
+        void* addr = mmap(nullptr, m_shm_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        NS_ABORT_MSG_IF(addr == MAP_FAILED, "ns3sionna: cannot map shared memory " + m_shm_path);
+        m_shm = static_cast<char*>(addr);
+        m_shm_consumed = 0;
+
+        std::cout << "ns3sionna: using shared memory " << m_shm_path << " (" << m_shm_size << " B)" << std::endl;
+    }
+
+    // Prepare the information message
+    ns3sionna::Wrapper wrapper;
+
+    // Fill the information message
+    ns3sionna::SimInitMessage* simulation_info = wrapper.mutable_sim_init_msg();
+    FillSimInitMessage(simulation_info);
+    if (!m_csi_subcarriers.empty())
+    {
+        std::cout << "ns3sionna: CFR computed for " << m_csi_subcarriers.size() << " of " << m_fft_size
+            << " subcarriers" << std::endl;
+    }
+
+    if (m_shm)
+    {
+        simulation_info->set_shm_path(m_shm_path);
+        simulation_info->set_shm_size(m_shm_size);
+    }
+
+    // the trace stores a single CFR per entry
+    NS_ABORT_MSG_IF(!m_trace_path.empty() && !m_bands.empty(), "ns3sionna: additional bands are not supported with a CSI trace");
+    NS_ABORT_MSG_IF(!m_trace_path.empty() && GetNumAntennas() > 1, "ns3sionna: antenna arrays are not supported with a CSI trace");
+    // without the paths a replayed entry would keep its CFR for its whole, much longer validity
+    NS_ABORT_MSG_IF(!m_trace_path.empty() && m_time_evo_model == "doppler",
+                    "ns3sionna: time evolution model doppler is not supported with a CSI trace");
+
+    if (!m_trace_path.empty())
+    {
+        // the location of the ring buffer does not affect the CSI
+        ns3sionna::SimInitMessage config = *simulation_info;
+        config.clear_shm_path();
+        config.clear_shm_size();
+        uint64_t config_hash = GetConfigHash(config);
+
+        if (replay)
+        {
+            m_trace_store.OpenReplay(m_trace_path, config_hash);
+            m_frequencies = m_trace_store.GetFrequencies();
+            return;
+        }
+        m_trace_store.OpenRecord(m_trace_path, config_hash);
+    }
 
     // Send the information message
-    zmq::message_t zmq_message(serialized_message.data(), serialized_message.size());
-    m_zmq_socket.send(zmq_message, zmq::send_flags::none);
+    SendMessage(wrapper);
 
     // Receive the reply message
-    zmq::message_t zmq_reply;
-    zmq::recv_result_t result = m_zmq_socket.recv(zmq_reply, zmq::recv_flags::none);
-    
-    NS_ASSERT_MSG(result, "Failed to receive reply after simulation information message.");
-    
-    // Check if the reply message is an ack
     ns3sionna::Wrapper reply_wrapper;
-    reply_wrapper.ParseFromArray(zmq_reply.data(), zmq_reply.size());
+    bool result = ReceiveMessage(reply_wrapper, true);
+
+    NS_ASSERT_MSG(result, "Failed to receive reply after simulation information message.");
 
+    // Check if the reply message is an ack
     if (reply_wrapper.has_sim_ack())
     {
         if (reply_wrapper.sim_ack().no_error()) {
             std::cout << "ns3sionna: connection ... OK" << std::endl;
+            const auto& frequencies = reply_wrapper.sim_ack().frequencies();
+            if (frequencies.size() > 0)
+            {
+                m_frequencies = std::make_shared<const std::vector<int>>(frequencies.begin(), frequencies.end());
+            }
+            const auto& band_frequencies = reply_wrapper.sim_ack().band_frequencies();
+            NS_ABORT_MSG_IF(static_cast<size_t>(band_frequencies.size()) != m_bands.size(),
+                            "ns3sionna: server does not support additional bands");
+            for (size_t i = 0; i < m_bands.size(); i++)
+            {
+                const auto& freq = band_frequencies.Get(i).frequencies();
+                m_bands[i].m_frequencies = std::make_shared<const std::vector<int>>(freq.begin(), freq.end());
+            }
         } else
         {
             NS_ABORT_MSG("ns3sionna: connection ... FAILED with error: " + reply_wrapper.sim_ack().error_msg());
@@ -274,30 +756,45 @@ SionnaHelper::Start()
 void
 SionnaHelper::Destroy()
 {
+    if (m_trace_store.IsReplaying())
+    {
+        std::cout << "ns3sionna: #replayed CSI: " << m_trace_store.GetReplayed() << ", #stale: "
+            << m_trace_store.GetStale() << std::endl;
+        m_trace_store.Close();
+        return;
+    }
+    m_trace_store.Close();
+
+    // discard replies of prefetch requests still in flight
+    ns3sionna::Wrapper reply_wrapper;
+    while (GetPendingReplies() > 0)
+    {
+        ReceiveMessage(reply_wrapper, true);
+    }
+
     // Prepare the request message
     ns3sionna::Wrapper wrapper;
     wrapper.mutable_sim_close_request();
-    
-    // Serialize the request message
-    std::string serialized_message;
-    wrapper.SerializeToString(&serialized_message);
 
     // Send the request message
-    zmq::message_t zmq_message(serialized_message.data(), serialized_message.size());
-    m_zmq_socket.send(zmq_message, zmq::send_flags::none);
+    SendMessage(wrapper);
 
     // Receive the reply message
-    zmq::message_t zmq_reply;
-    zmq::recv_result_t result = m_zmq_socket.recv(zmq_reply, zmq::recv_flags::none);
-    
+    bool result = ReceiveMessage(reply_wrapper, true);
+
     NS_ASSERT_MSG(result, "Failed to receive reply after close request message.");
-    
+
     // Check if the reply message is an ack
-    ns3sionna::Wrapper reply_wrapper;
-    reply_wrapper.ParseFromArray(zmq_reply.data(), zmq_reply.size());
-    
+
     NS_ASSERT_MSG(reply_wrapper.has_sim_ack(), "Reply after close request is not an ack.");
 
+    if (m_shm)
+    {
+        munmap(m_shm, m_shm_size);
+        unlink(m_shm_path.c_str());
+        m_shm = nullptr;
+    }
+
     // Close socket
     m_zmq_socket.close();
     std::cout << "ns3sionna socket closed" << std::endl;
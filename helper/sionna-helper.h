@@ -21,22 +21,57 @@
 #define SIONNA_HELPER_H
 
 #include "../model/message.pb.h"
+#include "../model/sionna-cfr.h"
+#include "../model/sionna-trace-store.h"
 #include "sionna-utils.h"
+#include "ns3/ptr.h"
 #include <zmq.hpp>
 
+#include <chrono>
+#include <deque>
+
 namespace ns3
 {
 
+class SionnaPropagationCache;
+
 /**
  * This helper is used to configure the ns3sionna framework.
  */
 class SionnaHelper
 {
 public:
+    /**
+     * Statistics of the communication with the Sionna server, e.g. for benchmarking.
+     */
+    struct IpcStats
+    {
+        IpcStats();
+
+        uint64_t m_requests;
+        uint64_t m_replies;
+        uint64_t m_bytes_sent;
+        uint64_t m_bytes_received;
+        double m_parse_time; // s, protobuf parsing of the replies
+        // bucket i counts round trips in (2^(i-1), 2^i] us; the last one all longer ones
+        std::vector<uint64_t> m_rtt_histogram;
+        // time spent by the server as reported in the responses, s
+        double m_server_trace_time;
+        double m_server_postprocess_time;
+        double m_server_fill_time;
+        double m_server_serialize_time;
+        // of the last received reply
+        uint64_t m_last_rtt_ns;
+        uint64_t m_last_reply_bytes;
+    };
+
     /**
      * Selects the Sionna scene and URL to server.
      * @param environment the relative path to the XML file describing the Sionna scene, e.g. "simple_room/simple_room.xml"
-     * @param zmq_url the URL of the Python Sionna server component (local or remote)
+     * @param zmq_url the URL of the Python Sionna server component (local or remote); in distributed
+     *        (MPI) runs "{rank}" is replaced by the system ID of the rank, e.g. "tcp://localhost:555{rank}",
+     *        so that each rank talks to its own server. Same for the path of a CSI trace. The ranks
+     *        do not share CSI, i.e. a link looked up on two ranks is traced by both servers.
      */
     SionnaHelper(std::string environment, std::string zmq_url);
     virtual ~SionnaHelper();
@@ -79,6 +114,7 @@ public:
      * @param mode MODE_P2P, MODE_P2MP or MODE_P2MP_LAH
      */
     void SetMode(int mode);
+    int GetMode() const;
 
     /**
      * Set the submode
@@ -86,10 +122,191 @@ public:
      */
     void SetSubMode(int sub_mode);
 
+    /**
+     * Limit the receivers traced by the server in mode P2MP/P2MP_LAH to those near the TX; the
+     * requested receiver is always included. Must be called before Start().
+     * @param max_distance max. distance of a receiver to the TX [m]; zero if not used
+     * @param max_loss max. Friis loss between TX and receiver [dB]; zero if not used
+     */
+    void SetP2mpReceiverSelection(double max_distance, double max_loss);
+
+    /**
+     * Enable asynchronous CSI prefetching; must be called before Start(). A DEALER socket is
+     * used so that several requests can be in flight while ns-3 continues processing events.
+     * @param prefetch true to enable
+     */
+    void SetPrefetch(bool prefetch);
+    bool IsPrefetch() const;
+
+    /**
+     * Set the wire format of the CFR; must be called before Start(). The packed formats carry
+     * the CFR as a single bytes field and the frequency grid only once in the ack of Start().
+     * @param encoding CSI_REPEATED_DOUBLE (default), CSI_FLOAT32, CSI_FLOAT16 or CSI_INT16
+     */
+    void SetCsiEncoding(ns3sionna::CsiEncoding encoding);
+    ns3sionna::CsiEncoding GetCsiEncoding() const;
+
+    /**
+     * The subcarrier frequencies received once from the server; empty handle if the frequencies
+     * are sent per link.
+     */
+    FreqHandle GetFrequencies() const;
+
+    /**
+     * Compute the CFR only for every n-th subcarrier (and the last one); the cache interpolates
+     * linearly onto the remaining PSD bins. Must be called before Start().
+     * @param decimation the decimation factor; one computes all subcarriers
+     */
+    void SetCsiDecimation(uint32_t decimation);
+
+    /**
+     * Compute the CFR only for the given subcarriers, e.g. a 20 MHz subchannel; the cache
+     * interpolates onto the remaining PSD bins. Overrides SetCsiDecimation. Must be called
+     * before Start().
+     * @param subcarriers ascending indices into the (guard band extended) FFT of Configure()
+     */
+    void SetCsiSubcarriers(std::vector<uint32_t> subcarriers);
+
+    // the subcarriers the CFR is computed for; empty if all
+    const std::vector<uint32_t>& GetCsiSubcarriers() const;
+
+    /**
+     * Set the time evolution model of the CSI; must be called before Start().
+     * "position": each CSI is valid for the coherence time of the link.
+     * "doppler": the server sends the propagation paths of each link; the cache synthesizes the
+     * CFR at the lookup time from the Doppler shift of each path, i.e. a link is retraced much
+     * less often. Not supported in MODE_P2MP_LAH (the server falls back to "position") nor with
+     * a CSI trace.
+     * @param model "position" (default) or "doppler"
+     */
+    void SetTimeEvolutionModel(std::string model);
+
+    // FFT size incl. guard bands, i.e. the number of OFDM subcarriers of the CFR
+    int GetFFTSize() const;
+
+    /**
+     * Add a band, e.g. another link of a multi-link device or a dual-band setup; must be called
+     * before Start(). The server traces the paths once at the frequency of Configure() and
+     * evaluates the CFR of each band from them; delay and wideband loss are shared by all bands.
+     * Not supported with a CSI trace.
+     * @param frequency the center frequency [MHz]
+     * @param fft_size the FFT size incl. guard bands; must match the PSD of the band
+     * @param ofdm_subcarrier_spacing the OFDM subcarrier spacing [Hz]
+     * @return the index of the band; band 0 is the one of Configure()
+     */
+    uint32_t AddBand(int frequency, int fft_size, int ofdm_subcarrier_spacing);
+    // number of bands incl. the one of Configure()
+    uint32_t GetNumBands() const;
+    // the band whose center frequency is closest to the given one [Hz]
+    uint32_t GetBand(double frequency) const;
+    // center frequency [MHz] and FFT size of a band
+    int GetBandFrequency(uint32_t band) const;
+    int GetBandFFTSize(uint32_t band) const;
+    // subcarrier frequencies of an additional band (band >= 1) received from the server
+    FreqHandle GetBandFrequencies(uint32_t band) const;
+
+    /**
+     * Use a uniform planar array with half-wavelength spacing at all nodes; must be called before
+     * Start(). The server sends the CFR between all antenna pairs of the primary band, which is
+     * used by the SionnaPhasedArraySpectrumPropagationLossModel to apply the beamforming vectors of
+     * the nodes; delay, wideband loss and the CFR of the other models are those of the first
+     * antenna pair. The PhasedArrayModel of each node must have the same number of elements.
+     * Neither supported with CSI subcarriers nor with a CSI trace; "doppler" falls back to "position".
+     * @param num_rows the number of rows of the array
+     * @param num_cols the number of columns of the array
+     */
+    void SetAntennaArray(uint32_t num_rows, uint32_t num_cols);
+    // number of antenna elements of each node; one if not set
+    uint32_t GetNumAntennas() const;
+
+    /**
+     * Use a memory-mapped ring buffer for the CFR payloads if ns-3 and the Sionna server run on
+     * the same host; ZMQ then carries only the control messages. Requires a packed CSI encoding
+     * (CSI_FLOAT32 is used if none is set). Must be called before Start().
+     * @param size the size of the ring buffer in bytes; zero disables it
+     */
+    void SetSharedMemory(uint64_t size);
+
+    /**
+     * Payload in the ring buffer, valid until reported as consumed.
+     * @param offset the (monotonic) offset as given in the response
+     * @param size the size of the payload in bytes
+     */
+    const char* GetSharedMemory(uint64_t offset, uint32_t size) const;
+
+    // the server may overwrite the ring buffer up to this offset; sent with every request
+    uint64_t GetSharedMemoryConsumed() const;
+    void SetSharedMemoryConsumed(uint64_t consumed);
+
+    /**
+     * Record all CSI received from the server into a trace file. Must be called before Start();
+     * neither additional bands, antenna arrays nor time evolution model "doppler" are supported.
+     * @param path the trace file; overwritten if it exists
+     */
+    void SetTraceRecord(std::string path);
+
+    /**
+     * Replay the CSI of a trace file recorded with the same configuration instead of connecting
+     * to the server. Must be called before Start(); prefetching is disabled.
+     * @param path the trace file
+     */
+    void SetTraceReplay(std::string path);
+    bool IsReplay() const;
+
+    // the trace store if recording or replaying; nullptr otherwise
+    SionnaTraceStore* GetTraceStore();
+
+    /**
+     * Hash of the configuration (scene, radio parameters, seed, nodes and their mobility) which
+     * a CSI trace is recorded for; replay refuses a trace of another one. Nodes and parameters
+     * must be set up as for Start().
+     */
+    uint64_t GetConfigHash();
+
+    /**
+     * Trace all links between the nodes in large batches after Start() and before
+     * Simulator::Run(), so that the simulation runs without waiting for the server. Intended for
+     * nodes with constant positions or a random walk with a fixed seed. The server traces up to
+     * rt_max_parallel_links links at once; progress and throughput are reported on stdout.
+     * Nothing is done when replaying a CSI trace; when recording, the precomputed CSI is recorded.
+     * @param cache the cache using this helper which is filled
+     * @param duration length of a trajectory sweep; zero traces the current positions only. The
+     *        server's mobility is then at the sweep end, so a sweep aborts with prefetching or a
+     *        limit (MaxEntriesPerLink, MaxMemory, MaxEntryAge) of the cache
+     * @param step time between two points of the sweep; the CSI of a point is used at least
+     *        until the next one
+     * @param max_links_per_request maximum number of links per round trip to the server
+     */
+    void Precompute(Ptr<SionnaPropagationCache> cache, Time duration = Seconds(0), Time step = Seconds(0),
+                    uint32_t max_links_per_request = 4096);
+
+    /**
+     * Send a message to the Sionna server.
+     * @param wrapper the message
+     */
+    void SendMessage(const ns3sionna::Wrapper& wrapper);
+
+    /**
+     * Receive the next reply from the Sionna server; replies arrive in request order.
+     * @param wrapper the received message
+     * @param blocking if false return immediately if no reply is available
+     * @return true if a reply was received
+     */
+    bool ReceiveMessage(ns3sionna::Wrapper& wrapper, bool blocking);
+
+    // number of sent requests whose reply was not received yet
+    uint32_t GetPendingReplies() const;
+
+    const IpcStats& GetIpcStats() const;
+    void PrintIpcStats() const;
+
     double GetNoiseFloor();
     int GetFrequency();
 
 private:
+    // the SimInitMessage without the shared memory, which does not affect the CSI
+    void FillSimInitMessage(ns3sionna::SimInitMessage* simulation_info);
+    static uint64_t GetConfigHash(const ns3sionna::SimInitMessage& config);
     void SetFrequency(int frequency); // in MHz
     void SetChannelBandwidth(int channel_bw); // in MHz
     void SetFFTSize(int fft_size);
@@ -100,6 +317,23 @@ private:
     std::string m_environment; // relative location of XML scenario fi
     int m_mode; // 1=P2P, 2=P2MP, 3=P2MP=LAH
     int m_sub_mode; // used by mode 3
+    double m_p2mp_radius; // m, zero if not used
+    double m_p2mp_max_loss; // dB, zero if not used
+    bool m_prefetch; // DEALER socket with multiple requests in flight
+    uint32_t m_pending_replies;
+    std::deque<std::chrono::steady_clock::time_point> m_send_times; // of the pending requests
+    IpcStats m_ipc_stats;
+    ns3sionna::CsiEncoding m_csi_encoding;
+    FreqHandle m_frequencies; // from SimAck in case of packed CSI or CSI subcarriers
+    uint32_t m_csi_decimation;
+    std::vector<uint32_t> m_csi_subcarriers;
+    uint64_t m_shm_size; // ring buffer size, zero if not used
+    std::string m_shm_path;
+    char* m_shm;
+    uint64_t m_shm_consumed;
+    std::string m_trace_path; // empty if neither recording nor replaying
+    bool m_trace_replay;
+    SionnaTraceStore m_trace_store;
     zmq::context_t m_zmq_context;
     int m_frequency; // in MHz
     int m_channel_bw; // in Mhz
@@ -109,6 +343,18 @@ private:
     double m_noiseDbm;
     std::string m_time_evo_model; // position or doppler based
 
+    struct Band
+    {
+        int m_frequency; // in MHz
+        int m_fft_size;
+        int m_subcarrier_spacing; // in Hz
+        FreqHandle m_frequencies; // from SimAck
+    };
+
+    std::vector<Band> m_bands; // additional bands; index is band - 1
+    uint32_t m_antenna_rows;
+    uint32_t m_antenna_cols;
+
 public:
     zmq::socket_t m_zmq_socket; // ZMQ socket used for connecting ns3 with Sionna
 
@@ -122,6 +368,8 @@ public:
 
     // default value used by ns spectrummodel
     const static int GUARD_MULTIPLIER = 3;
+
+    const static size_t RTT_HISTOGRAM_BUCKETS = 32;
 };
 } // namespace ns3
 
@@ -18,8 +18,12 @@
  */
 
 #include "cfr-tag.h"
+#include "ns3/abort.h"
 #include "ns3/log.h"
+#include <deque>
 #include <iomanip>
+#include <mutex>
+#include <unordered_map>
 
 namespace ns3 {
 
@@ -42,8 +46,86 @@ CFRTag::GetInstanceTypeId (void) const
     return GetTypeId ();
 }
 
+namespace {
+// shared by all default-constructed tags so that creating a tag does not allocate
+const CfrHandle g_emptyCfr = std::make_shared<const CfrVector> ();
+
+/**
+ * The CFRs referenced by tags in reference mode. A CFR shared by many frames (e.g. all MPDUs
+ * of an A-MPDU) is registered once; the oldest registered CFR is dropped first. Tags may be
+ * created and resolved by concurrent lookups of the propagation cache.
+ */
+class CfrRegistry
+{
+public:
+    CfrRegistry () : m_nextId (1), m_maxSize (256)
+    {
+    }
+
+    uint64_t Register (const CfrHandle& cfr)
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        auto it = m_ids.find (cfr.get ());
+        if (it != m_ids.end ())
+        {
+            return it->second;
+        }
+
+        uint64_t id = m_nextId++;
+        m_ids[cfr.get ()] = id;
+        m_cfrs[id] = cfr;
+        m_order.push_back (id);
+        Shrink ();
+        return id;
+    }
+
+    CfrHandle Lookup (uint64_t id) const
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        auto it = m_cfrs.find (id);
+        return it != m_cfrs.end () ? it->second : nullptr;
+    }
+
+    void SetMaxSize (size_t size)
+    {
+        NS_ASSERT (size > 0);
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_maxSize = size;
+        Shrink ();
+    }
+
+private:
+    // m_mutex held
+    void Shrink ()
+    {
+        while (m_order.size () > m_maxSize)
+        {
+            auto it = m_cfrs.find (m_order.front ());
+            m_ids.erase (it->second.get ());
+            m_cfrs.erase (it);
+            m_order.pop_front ();
+        }
+    }
+
+    // a registered CFR is kept alive, i.e. its address cannot be reused by another CFR
+    std::unordered_map<const CfrVector*, uint64_t> m_ids;
+    std::unordered_map<uint64_t, CfrHandle> m_cfrs;
+    std::deque<uint64_t> m_order; // in registration order
+    uint64_t m_nextId;
+    size_t m_maxSize;
+    mutable std::mutex m_mutex;
+};
+
+CfrRegistry&
+GetCfrRegistry ()
+{
+    static CfrRegistry registry;
+    return registry;
+}
+}
+
 CFRTag::CFRTag ()
-  : Tag (), m_complexes ()
+  : Tag (), m_complexes (g_emptyCfr), m_cfrId (0), m_pathloss (0.0)
 {
 }
 
@@ -54,13 +136,49 @@ CFRTag::~CFRTag ()
 void
 CFRTag::SetComplexes (std::vector<std::complex<double>> complexes)
 {
-    m_complexes = complexes;
+    m_complexes = std::make_shared<const CfrVector> (std::move (complexes));
+    m_cfrId = 0;
 }
 
-std::vector<std::complex<double>>
+void
+CFRTag::SetComplexes (CfrHandle complexes)
+{
+    NS_ASSERT (complexes);
+    m_complexes = std::move (complexes);
+    m_cfrId = 0;
+}
+
+void
+CFRTag::SetComplexesReference (CfrHandle complexes)
+{
+    NS_ASSERT (complexes);
+    m_cfrId = GetCfrRegistry ().Register (complexes);
+    m_complexes = std::move (complexes);
+}
+
+const std::vector<std::complex<double>>&
 CFRTag::GetComplexes (void) const
 {
-    return m_complexes;
+    if (!m_complexes)
+    {
+        // reference mode: resolve on first access
+        m_complexes = GetCfrRegistry ().Lookup (m_cfrId);
+        NS_ABORT_MSG_IF (!m_complexes, "CFR " << m_cfrId << " no longer in the registry; "
+                                       "increase its size with CFRTag::SetRegistrySize");
+    }
+    return *m_complexes;
+}
+
+bool
+CFRTag::IsReference (void) const
+{
+    return m_cfrId != 0;
+}
+
+void
+CFRTag::SetRegistrySize (size_t size)
+{
+    GetCfrRegistry ().SetMaxSize (size);
 }
 
 void
@@ -78,11 +196,21 @@ CFRTag::GetPathloss (void) const
 void
 CFRTag::Serialize (TagBuffer i) const
 {
+    // mode flag: 1 for reference mode, 0 for a copy of the CFR
+    i.WriteU8 (m_cfrId != 0 ? 1 : 0);
+    if (m_cfrId != 0)
+    {
+        // reference mode: the CFR itself is kept in the registry
+        i.WriteU64 (m_cfrId);
+        i.WriteDouble (m_pathloss);
+        return;
+    }
+
     // Serialize size first
-    i.WriteU32 (m_complexes.size ());
+    i.WriteU32 (m_complexes->size ());
 
     // Serialize each complex as real + imag doubles
-    for (const auto& c : m_complexes) {
+    for (const auto& c : *m_complexes) {
         i.WriteDouble (c.real ());
         i.WriteDouble (c.imag ());
     }
@@ -94,34 +222,51 @@ CFRTag::Serialize (TagBuffer i) const
 void
 CFRTag::Deserialize (TagBuffer i)
 {
+    if (i.ReadU8 () != 0)
+    {
+        m_cfrId = i.ReadU64 ();
+        m_complexes = nullptr;
+        m_pathloss = i.ReadDouble ();
+        return;
+    }
+
+    m_cfrId = 0;
+
     // Deserialize size
     uint32_t size = i.ReadU32 ();
 
     // Resize and deserialize each complex
-    m_complexes.resize (size);
+    auto complexes = std::make_shared<CfrVector> (size);
     for (uint32_t j = 0; j < size; ++j) {
         double real = i.ReadDouble ();
         double imag = i.ReadDouble ();
-        m_complexes[j] = std::complex<double> (real, imag);
+        (*complexes)[j] = std::complex<double> (real, imag);
     }
+    m_complexes = complexes;
     m_pathloss = i.ReadDouble ();
 }
 
 uint32_t
 CFRTag::GetSerializedSize () const
 {
-    // 4 bytes for size + 16 bytes per complex (2 doubles) + 8 for pathloss double
-    return 4 + static_cast<uint32_t> (m_complexes.size ()) * 16 + 8;
+    if (m_cfrId != 0)
+    {
+        // 1 byte for the mode flag + 8 bytes for the registry ID + 8 for pathloss double
+        return 1 + 8 + 8;
+    }
+    // 1 byte for the mode flag + 4 bytes for size + 16 bytes per complex (2 doubles) + 8 for pathloss double
+    return 1 + 4 + static_cast<uint32_t> (m_complexes->size ()) * 16 + 8;
 }
 
 void
 CFRTag::Print (std::ostream &os) const
 {
+    const CfrVector& complexes = GetComplexes ();
     os << "CFR=[";
-    for (size_t i = 0; i < m_complexes.size (); ++i) {
+    for (size_t i = 0; i < complexes.size (); ++i) {
         if (i > 0) os << ", ";
         os << "(" << std::fixed << std::setprecision(2)
-           << m_complexes[i].real () << "+" << m_complexes[i].imag () << "j)";
+           << complexes[i].real () << "+" << complexes[i].imag () << "j)";
     }
     os << "]";
     os << ", Pathloss=" << m_pathloss << "dB";
@@ -22,6 +22,7 @@
 
 #include "ns3/tag.h"
 #include "ns3/simple-ref-count.h"
+#include "sionna-cfr.h"
 #include <vector>      // For std::vector
 #include <complex>     // For std::complex<double>
 
@@ -30,6 +31,11 @@ namespace ns3 {
 /**
  * Tag used to deliver pathloss and channel state information (channel frequency response)
  * to application layer.
+ *
+ * By default the CFR is serialized into the tag. In reference mode only the ID of the shared CFR
+ * in a process-wide registry is serialized; the CFR is resolved when it is read. The registry
+ * keeps the most recently referenced CFRs alive (see SetRegistrySize); reading a tag whose CFR
+ * has been dropped from the registry aborts the simulation.
  */
 class CFRTag : public Tag
 {
@@ -42,8 +48,16 @@ public:
 
     // Set the vector of complex numbers (e.g., CFR coefficients)
     void SetComplexes (std::vector<std::complex<double>> complexes);
+    // Share an immutable CFR (e.g. from SionnaPropagationCache) without copying it
+    void SetComplexes (CfrHandle complexes);
+    // Reference mode: only the registry ID of the shared CFR is serialized
+    void SetComplexesReference (CfrHandle complexes);
     // Get the vector of complex numbers
-    std::vector<std::complex<double>> GetComplexes (void) const;
+    const std::vector<std::complex<double>>& GetComplexes (void) const;
+    bool IsReference (void) const;
+
+    // max. number of CFRs kept alive for tags in reference mode
+    static void SetRegistrySize (size_t size);
 
     void SetPathloss (double pathloss);
     double GetPathloss (void) const;
@@ -55,7 +69,8 @@ public:
     virtual void Print (std::ostream &os) const;
 
 private:
-    std::vector<std::complex<double>> m_complexes;  // complex CFR per OFDM subcarriers
+    mutable CfrHandle m_complexes;  // complex CFR per OFDM subcarriers; resolved lazily in reference mode
+    uint64_t m_cfrId; // registry ID in reference mode, 0 otherwise
     double m_pathloss; // the propagation pathloss
 };
 
@@ -7,6 +7,14 @@ def print_sim_init(sim_init_msg):
     print("    Seed:", sim_init_msg.seed, ", fc:", sim_init_msg.frequency, ", B:", sim_init_msg.channel_bw
           , ", FFT:", sim_init_msg.fft_size, ", dSC:", sim_init_msg.subcarrier_spacing
           , ", Tc_min:", sim_init_msg.min_coherence_time_ms, ", time_evo:", sim_init_msg.time_evo_model)
+    if len(sim_init_msg.csi_subcarriers) > 0:
+        print("    CSI subcarriers:", len(sim_init_msg.csi_subcarriers), "of", sim_init_msg.fft_size)
+    if sim_init_msg.p2mp_radius > 0 or sim_init_msg.p2mp_max_loss > 0:
+        print("    P2MP receivers: max. distance:", sim_init_msg.p2mp_radius, "m, max. loss:", sim_init_msg.p2mp_max_loss, "dB")
+    for band in sim_init_msg.bands:
+        print("    Additional band: fc:", band.frequency, ", FFT:", band.fft_size, ", dSC:", band.subcarrier_spacing)
+    if sim_init_msg.antenna_rows * sim_init_msg.antenna_cols > 1:
+        print("    Antenna array:", sim_init_msg.antenna_rows, "x", sim_init_msg.antenna_cols)
 
     print("Node Information:")
     for node_info in sim_init_msg.nodes:
@@ -53,6 +61,12 @@ def print_csi_request(csi_req):
     print("    NodeId2:  ", csi_req.rx_node)
 
 
+def print_batch_csi_request(batch_req):
+    print("Batched CSI request:")
+    for link_set in batch_req.links:
+        print("    %0.9fs: TxNodeId: %d, RxNodeIds: %s" % (link_set.time / 1e9, link_set.tx_node, list(link_set.rx_nodes)))
+
+
 def print_csi_response(simulation_time, node_a, node_b, node_a_pos, node_b_pos, delay, loss, ttl):
     print("%0.9fs: Propagation response:" % (simulation_time / 1e9))
     print("Tx:%d - Rx:%d" % (node_a, node_b))
@@ -0,0 +1,55 @@
+import math
+
+'''
+    Adaptive lookahead horizon of mode P2MP_LAH. ns3 reports per TX node how many lookahead steps
+    (the CSI of all receivers at one lookahead time) were looked up (used, any of their receivers)
+    or evicted without being looked up (unused). The horizon of the next request of that TX is
+    sized to the number of steps used per request and doubled as long as all steps are used; it is
+    always limited by the GPU memory budget.
+
+    author: Zubow
+'''
+class LookaheadController:
+
+    # multiplicative increase while all lookahead entries are used
+    GROWTH = 2
+
+    def __init__(self):
+        self.horizon = None # last horizon; None before the first request
+        self.used = 0
+        self.unused = 0
+        self.requests = 0 # lookahead requests since the last update of the horizon
+
+
+    def add_feedback(self, used: int, unused: int):
+        '''
+        :param used: lookahead steps of which ns3 looked up at least one entry
+        :param unused: lookahead steps whose entries ns3 evicted without looking them up
+        '''
+        self.used += used
+        self.unused += unused
+
+
+    def get_horizon(self, budget: int):
+        '''
+        Horizon of the current request
+        :param budget: max. no. of lookahead steps which fit into GPU memory
+        :return: no. of lookahead steps
+        '''
+        budget = max(1, budget)
+        if self.horizon is None:
+            # no feedback yet: use the whole budget
+            self.horizon = budget
+        elif self.used + self.unused > 0:
+            if self.unused == 0:
+                self.horizon = self.horizon * LookaheadController.GROWTH
+            else:
+                # one step more than used so that the horizon can grow again
+                self.horizon = math.ceil(self.used / max(1, self.requests)) + 1
+            self.used = 0
+            self.unused = 0
+            self.requests = 0
+
+        self.horizon = min(max(1, self.horizon), budget)
+        self.requests += 1
+        return self.horizon
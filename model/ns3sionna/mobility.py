@@ -1,28 +1,112 @@
 import numpy as np
 from abc import ABC, abstractmethod
+from bisect import bisect_right
 
 '''
     All mobility models defined here
 
     author: Zubow
 '''
+class MobilityHistory:
+    '''
+    Time-sorted history of the positions and velocities of a node. A lookup returns the entry
+    last updated at or before the requested time. The server never goes back in time, i.e. the
+    history is pruned to the time of the current request and in addition bounded in length.
+
+    author: Zubow
+    '''
+    def __init__(self, max_len=None):
+        '''
+        :param max_len: max. no. of entries; None keeps the full history (debugging only)
+        '''
+        self.max_len = max_len
+        self.times = []
+        self.pos = []
+        self.velo = []
+        self.start = 0 # index of the oldest kept entry
+
+
+    def __len__(self):
+        return len(self.times) - self.start
+
+
+    def append(self, sim_time, pos, velocity):
+        if len(self) > 0 and sim_time == self.times[-1]:
+            self.pos[-1] = pos
+            self.velo[-1] = velocity
+            return
+        assert len(self) == 0 or sim_time > self.times[-1]
+        self.times.append(sim_time)
+        self.pos.append(pos)
+        self.velo.append(velocity)
+
+        if self.max_len is not None and len(self) > self.max_len:
+            self.start += 1
+            self._compact()
+
+
+    def prune(self, sim_time):
+        '''
+        Drop all entries not needed for lookups at or after the given time
+        :param sim_time: time of the oldest possible lookup
+        '''
+        if self.max_len is None:
+            return
+        # the entry valid at sim_time is kept
+        idx = bisect_right(self.times, sim_time, lo=self.start) - 1
+        if idx > self.start:
+            self.start = idx
+            self._compact()
+
+
+    def _compact(self):
+        # amortized O(1) per dropped entry
+        if self.start >= 64 and self.start >= len(self.times) // 2:
+            del self.times[:self.start]
+            del self.pos[:self.start]
+            del self.velo[:self.start]
+            self.start = 0
+
+
+    def _index(self, req_time):
+        idx = bisect_right(self.times, req_time, lo=self.start) - 1
+        if idx < self.start:
+            raise KeyError(f'No mobility history at time {req_time}')
+        return idx
+
+
+    def get_pos_at(self, req_time):
+        return self.pos[self._index(req_time)]
+
+
+    def get_velo_at(self, req_time):
+        return self.velo[self._index(req_time)]
+
+
+    def items(self):
+        '''
+        :return: (times, positions) of all kept entries in time order
+        '''
+        return self.times[self.start:], self.pos[self.start:]
+
+
 class AbstractMobility(ABC):
     '''
     Base class for all mobile models
 
     author: Zubow
     '''
-    def __init__(self, node_id, pos, collect_history=True):
+    # max. no. of kept history entries per node unless the full history is collected
+    HISTORY_LEN = 1024
+
+    def __init__(self, node_id, pos, full_history=False):
         self.node_id = node_id
         self.pos = np.array(pos)
         self.velocity = np.array([0.0, 0.0, 0.0])
         self.last_update = 0
 
-        self.collect_history = collect_history
-
-        if self.collect_history:
-            self.pos_history = {} # time -> pos
-            self.velo_history = {}  # time -> velocity
+        # needed by the lookahead of mode 3; the full history only for debugging
+        self.history = MobilityHistory(None if full_history else AbstractMobility.HISTORY_LEN)
 
 
     def update_pos(self, sim_time, pos, velocity, hit_wall):
@@ -32,9 +116,7 @@ class AbstractMobility(ABC):
         self.velocity = velocity
         self.hit_wall = hit_wall
 
-        if self.collect_history:
-            self.pos_history[sim_time] = pos
-            self.velo_history[sim_time] = velocity
+        self.history.append(sim_time, pos, velocity)
 
 
     @abstractmethod
@@ -65,8 +147,8 @@ class ConstantMobility(AbstractMobility):
     '''
     Just static placement of nodes. The position is set from ns3.
     '''
-    def __init__(self, node_id, pos, collect_history=True):
-        super(ConstantMobility, self).__init__(node_id, pos, collect_history)
+    def __init__(self, node_id, pos, full_history=False):
+        super(ConstantMobility, self).__init__(node_id, pos, full_history)
 
 
     def get_next_direction_angle(self):
@@ -104,8 +186,8 @@ class RandomWalkMobility(AbstractMobility):
     '''
     A random walk mobility model with different modes and configurations.
     '''
-    def __init__(self, node_id, pos, mode, mode_params, speed, speed_params, direction, direction_params, collect_history=True):
-        super(RandomWalkMobility, self).__init__(node_id, pos, collect_history)
+    def __init__(self, node_id, pos, mode, mode_params, speed, speed_params, direction, direction_params, full_history=False):
+        super(RandomWalkMobility, self).__init__(node_id, pos, full_history)
         self.mode = mode
         self.mode_params = mode_params
         self.speed = speed
@@ -125,11 +207,11 @@ class RandomWalkMobility(AbstractMobility):
 
 
     def get_pos_at(self, req_time):
-        return self.pos_history[req_time]
+        return self.history.get_pos_at(req_time)
 
 
     def get_velo_at(self, req_time):
-        return self.velo_history[req_time]
+        return self.history.get_velo_at(req_time)
 
 
     def _set_new_velocity(self, ts=0):
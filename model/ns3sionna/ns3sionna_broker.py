@@ -0,0 +1,282 @@
+import os
+import argparse
+import time
+import multiprocessing as mp
+from collections import deque
+
+import zmq
+import GPUtil
+
+from common import message_pb2
+
+'''
+    Broker mode of the server component of ns3sionna: a single front-end socket accepts many
+    concurrent ns3 simulations (sessions) and routes each of them to a SionnaEnv worker process.
+    Workers are pinned to the available GPUs and keep their loaded scene warm such that sessions
+    using the same scene file are preferably routed to a worker which has already loaded it; the
+    preloaded scenes are loaded and warmed up by every worker.
+
+    Note: sionna/tensorflow must not be imported in the broker process as the GPU of a worker is
+    selected via CUDA_VISIBLE_DEVICES before the import.
+
+    author: Zubow
+'''
+
+def _worker_main(worker_idx, gpu_id, backend_url, env_kwargs):
+    '''
+    Worker process: serves the messages of one session after the other
+    :param worker_idx: index of the worker
+    :param gpu_id: the GPU this worker is pinned to or None
+    :param backend_url: ZMQ address of the broker back-end
+    :param env_kwargs: the arguments of SionnaEnv
+    '''
+    if gpu_id is not None:
+        os.environ["CUDA_VISIBLE_DEVICES"] = str(gpu_id)
+
+    from ns3sionna_server import SionnaEnv
+
+    env = SionnaEnv(**env_kwargs)
+    # the preloaded scenes are traced once before the first session
+    env.warm_up()
+
+    context = zmq.Context()
+    socket = context.socket(zmq.DEALER)
+    socket.connect(backend_url)
+    socket.send_multipart([SionnaBroker.READY])
+
+    print(f'Worker {worker_idx} ready on GPU {gpu_id}')
+
+    while True:
+        frames = socket.recv_multipart()
+        if frames[0] == SionnaBroker.STOP:
+            break
+        client_id, ns3_msg_str = frames
+
+        ns3_msg = message_pb2.Wrapper()
+        ns3_msg.ParseFromString(ns3_msg_str)
+
+        resp_msg, session_ended = env.handle_message(ns3_msg)
+        if session_ended:
+            # keep the scene loaded for the next session
+            env._release_shm()
+
+        socket.send_multipart([SionnaBroker.REPLY, b'1' if session_ended else b'0', client_id,
+                               resp_msg.SerializeToString()])
+
+    socket.close()
+    env.release()
+
+
+class SionnaBroker:
+
+    # back-end message types
+    READY = b'READY'
+    REPLY = b'REPLY'
+    STOP = b'STOP'
+
+    class Session:
+        def __init__(self, client_id, scene_fname, now):
+            self.client_id = client_id
+            self.scene_fname = scene_fname
+            self.worker = None
+            self.start_time = now
+            # messages waiting to be forwarded to the worker: (arrival time, payload)
+            self.queue = deque()
+            self.busy = False # a message is being processed by the worker
+            self.num_msgs = 0
+            self.init_wait = 0.0 # time until a worker was assigned
+            self.total_wait = 0.0
+            self.max_wait = 0.0
+
+    class Worker:
+        def __init__(self, worker_id, gpu_id):
+            self.worker_id = worker_id
+            self.gpu_id = gpu_id
+            self.session = None
+            self.scene_fname = None # scene kept warm by the worker
+
+    def __init__(self, zmq_url="tcp://*:5555", num_workers=None, env_kwargs=None):
+        '''
+        :param zmq_url: front-end address the ns3 simulations connect to
+        :param num_workers: number of worker processes; default one per GPU
+        :param env_kwargs: the arguments of SionnaEnv
+        '''
+        self.zmq_url = zmq_url
+        self.gpu_ids = [gpu.id for gpu in GPUtil.getGPUs()]
+        self.num_workers = num_workers if num_workers else max(1, len(self.gpu_ids))
+        self.env_kwargs = env_kwargs if env_kwargs else {}
+        self.backend_url = f'ipc:///tmp/ns3sionna-broker-{os.getpid()}'
+
+        self.sessions = {} # client id -> Session
+        self.waiting_sessions = deque() # sessions waiting for a free worker
+        self.workers = {} # worker id -> Worker
+        self.pending_workers = deque() # started but not yet signaled READY
+
+
+    def _start_workers(self):
+        ctx = mp.get_context('spawn')
+        self.processes = []
+        for worker_idx in range(self.num_workers):
+            gpu_id = self.gpu_ids[worker_idx % len(self.gpu_ids)] if len(self.gpu_ids) > 0 else None
+            p = ctx.Process(target=_worker_main, args=(worker_idx, gpu_id, self.backend_url, self.env_kwargs),
+                            daemon=True)
+            p.start()
+            self.processes.append(p)
+            self.pending_workers.append(gpu_id)
+
+
+    def _assign_worker(self, session, now):
+        '''
+        Select an idle worker; prefer one which has already loaded the scene of the session
+        :return: whether a worker was assigned
+        '''
+        idle = [w for w in self.workers.values() if w.session is None]
+        if len(idle) == 0:
+            return False
+
+        warm = [w for w in idle if w.scene_fname == session.scene_fname]
+        worker = warm[0] if len(warm) > 0 else idle[0]
+
+        worker.session = session
+        worker.scene_fname = session.scene_fname
+        session.worker = worker
+        session.init_wait = now - session.start_time
+
+        print(f'Session {session.client_id.hex()} -> worker on GPU {worker.gpu_id} (warm scene: {len(warm) > 0}), '
+              f'waited {session.init_wait:.3f}s')
+        return True
+
+
+    def _dispatch(self, backend, session, now):
+        # forward the next message of the session to its worker
+        if session.worker is None or session.busy or len(session.queue) == 0:
+            return
+
+        arrival_time, payload = session.queue.popleft()
+        wait = now - arrival_time
+        session.total_wait += wait
+        session.max_wait = max(session.max_wait, wait)
+        session.num_msgs += 1
+        session.busy = True
+
+        backend.send_multipart([session.worker.worker_id, session.client_id, payload])
+
+
+    def _end_session(self, backend, session, now):
+        worker = session.worker
+        worker.session = None
+        del self.sessions[session.client_id]
+
+        mean_wait = session.total_wait / session.num_msgs if session.num_msgs > 0 else 0.0
+        print(f'Session {session.client_id.hex()} done after {now - session.start_time:.1f}s, #msgs: {session.num_msgs}, '
+              f'queueing latency: init {session.init_wait:.3f}s, mean {mean_wait * 1e3:.2f}ms, '
+              f'max {session.max_wait * 1e3:.2f}ms')
+
+        # serve sessions waiting for a worker
+        while len(self.waiting_sessions) > 0 and self._assign_worker(self.waiting_sessions[0], now):
+            waiting = self.waiting_sessions.popleft()
+            self._dispatch(backend, waiting, now)
+
+
+    def run(self):
+        '''
+        Routes the messages between the ns3 simulations (front-end) and the workers (back-end)
+        '''
+        context = zmq.Context()
+        frontend = context.socket(zmq.ROUTER)
+        frontend.bind(self.zmq_url)
+        backend = context.socket(zmq.ROUTER)
+        backend.bind(self.backend_url)
+
+        self._start_workers()
+
+        print(f'Sionna broker ready on {self.zmq_url} with {self.num_workers} workers, GPUs: {self.gpu_ids}')
+
+        poller = zmq.Poller()
+        poller.register(frontend, zmq.POLLIN)
+        poller.register(backend, zmq.POLLIN)
+
+        try:
+            while True:
+                events = dict(poller.poll())
+                now = time.time()
+
+                if backend in events:
+                    frames = backend.recv_multipart()
+                    worker_id, kind = frames[0], frames[1]
+
+                    if kind == SionnaBroker.READY:
+                        self.workers[worker_id] = SionnaBroker.Worker(worker_id, self.pending_workers.popleft())
+                        while len(self.waiting_sessions) > 0 and self._assign_worker(self.waiting_sessions[0], now):
+                            self._dispatch(backend, self.waiting_sessions.popleft(), now)
+
+                    elif kind == SionnaBroker.REPLY:
+                        session_ended, client_id, resp_msg_str = frames[2], frames[3], frames[4]
+                        frontend.send_multipart([client_id, b'', resp_msg_str])
+
+                        session = self.sessions[client_id]
+                        session.busy = False
+                        if session_ended == b'1':
+                            self._end_session(backend, session, now)
+                        else:
+                            self._dispatch(backend, session, now)
+
+                if frontend in events:
+                    # [identity, empty delimiter, payload] from REQ or DEALER sockets
+                    frames = frontend.recv_multipart()
+                    client_id, ns3_msg_str = frames[0], frames[-1]
+
+                    session = self.sessions.get(client_id)
+                    if session is None:
+                        ns3_msg = message_pb2.Wrapper()
+                        ns3_msg.ParseFromString(ns3_msg_str)
+
+                        if not ns3_msg.HasField("sim_init_msg"):
+                            # unknown session
+                            resp_msg = message_pb2.Wrapper()
+                            resp_msg.sim_ack.no_error = False
+                            resp_msg.sim_ack.error_msg = "No session; SimInitMessage expected"
+                            frontend.send_multipart([client_id, b'', resp_msg.SerializeToString()])
+                            continue
+
+                        session = SionnaBroker.Session(client_id, ns3_msg.sim_init_msg.scene_fname, now)
+                        self.sessions[client_id] = session
+                        if not self._assign_worker(session, now):
+                            print(f'Session {client_id.hex()} waits for a free worker')
+                            self.waiting_sessions.append(session)
+
+                    session.queue.append((now, ns3_msg_str))
+                    self._dispatch(backend, session, now)
+        finally:
+            for worker_id in self.workers:
+                backend.send_multipart([worker_id, SionnaBroker.STOP])
+            for p in self.processes:
+                p.join(timeout=10)
+            frontend.close()
+            backend.close()
+            print("Sionna broker closed.")
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--model_folder", type=str, default='models/', help="The folder containing the XML files of the scenes")
+    parser.add_argument("--default_mode", type=int, default=2, help="Which mode to use if not set by ns3")
+    parser.add_argument("--rt_fast", help="Use simplified raytracing for faster computations", action='store_true')
+    parser.add_argument("--rt_max_parallel_links", type=int, default=256, help="Max no. of link simulated at once; depends on GPU memory")
+    parser.add_argument("--est_csi", help="Whether to estimate complex CSI per OFDM subcarrier", type=bool, default=True)
+    parser.add_argument("--verbose", help="Whether to run in verbose mode", action='store_true')
+    parser.add_argument("--zmq_url", type=str, default="tcp://*:5555", help="ZMQ address to bind to")
+    parser.add_argument("--geo_cache_size", type=int, default=4096,
+                        help="Max no. of traced static links kept for unchanged geometry; 0 disables it. "
+                             "Each link holds 16 B per subcarrier of each band and antenna pair")
+    parser.add_argument("--num_workers", type=int, default=0, help="No. of worker processes; default one per GPU")
+    parser.add_argument("--preload_scenes", type=str, nargs='*', default=[], help="Scene files (relative to model_folder) loaded and warmed up by each worker")
+    args = parser.parse_args()
+
+    env_kwargs = dict(model_folder=args.model_folder, rt_fast=args.rt_fast, default_mode=args.default_mode,
+                      rt_max_parallel_links=args.rt_max_parallel_links, est_csi=args.est_csi, VERBOSE=args.verbose,
+                      geo_cache_size=args.geo_cache_size, preload_scenes=args.preload_scenes)
+
+    print("ns3sionna v1.0 broker")
+    broker = SionnaBroker(args.zmq_url, args.num_workers, env_kwargs)
+    broker.run()
@@ -11,7 +11,7 @@ import gc
 from common import message_pb2
 from common.message_debug import *
 
-from collections import deque
+from collections import deque, OrderedDict
 import warnings
 
 import tensorflow as tf
@@ -19,14 +19,19 @@ import mitsuba as mi
 import math
 from millify import millify
 
-from ns3sionna_utils import subcarrier_frequencies, compute_coherence_time, SECOND, MILLISECOND, coherence_from_velocities, \
-    MAX_COHERENCE_TIME
+from ns3sionna_utils import subcarrier_frequencies, compute_coherence_time, SECOND, MILLISECOND, \
+    coherence_from_velocities_batch, doppler_validity_batch, MAX_COHERENCE_TIME
 
 import sionna
-from sionna.rt import load_scene, Camera, Transmitter, Receiver, PlanarArray, PathSolver
+from sionna.rt import Camera, Transmitter, Receiver, PlanarArray, PathSolver
 
 # import mobility models
 from mobility import *
+from shm_ring import ShmRingWriter
+from spatial_index import SpatialGrid
+from lookahead_control import LookaheadController
+from server_metrics import ServerMetrics
+from scene_pool import ScenePool
 
 class SionnaEnv:
 
@@ -37,6 +42,17 @@ class SionnaEnv:
     # compute also future channels; used only if the transmitter is static (receivers are mobile)
     MODE_P2MP_LAH   = 3
 
+    # position quantization of the geometry cache in m
+    GEO_CACHE_RESOLUTION = 1e-3
+
+    # stages timed per request and reported to ns3 in ChannelStateResponse.timing
+    TIMING_STAGES = ('trace', 'postprocess', 'fill')
+
+    # time evolution of the CSI: traced at the current positions, valid for the coherence time
+    # ('position') or propagation paths sent to ns3 which evolves the CFR by the Doppler shift of
+    # each path within a longer validity ('doppler')
+    TIME_EVO_MODELS = ('position', 'doppler')
+
     """
     This class represents the Sionna component of ns3sionna. It represents the environment where the node
     placement, mobility is controlled from the client component of ns3sionna. For IPC ZMQ is used.
@@ -44,8 +60,12 @@ class SionnaEnv:
     author: Pilz, Zubow
     """
     def __init__(self, model_folder='./models/', rt_fast=False, default_mode=MODE_P2P, rt_max_parallel_links=256, est_csi=True, VERBOSE=True,
-                 CHECKS_ENABLED=True):
+                 CHECKS_ENABLED=True, zmq_url="tcp://*:5555", geo_cache_size=4096, metrics_fname=None,
+                 metrics_interval=10.0, full_mobility_history=False, doppler_max_distance=0.25, preload_scenes=(),
+                 scene_pool=None):
         self.model_folder = model_folder
+        # address to bind to, e.g. ipc:///tmp/ns3sionna or tcp://*:5556 for parallel simulations
+        self.zmq_url = zmq_url
         self.rt_fast = rt_fast
         if rt_fast:
             self.rt_max_depth = 3  # very small
@@ -79,6 +99,9 @@ class SionnaEnv:
         # estimate small-scale fading
         self.est_csi = est_csi
 
+        # time evolution 'doppler': the paths are valid until either node has moved by this distance (in m)
+        self.doppler_max_distance = doppler_max_distance
+
         print(f'Init ns3sionna with rt_fast={rt_fast}, est_csi={est_csi}')
 
         self.VERBOSE = VERBOSE
@@ -97,6 +120,46 @@ class SionnaEnv:
         self.node_info = {}
         # all node which are currently placed on the scene
         self.placed_radio_node_names = []
+        # the path solver is kept for the whole lifetime of the environment
+        self.p_solver = PathSolver()
+        # ring buffer for CFR payloads if ns3 runs on the same host
+        self.shm = None
+        # the loaded scene is kept between simulations using the same scene file; the pool may be
+        # shared by several environments of the process
+        self.scene = None
+        self.scene_fpath = None
+        self.scene_pool = scene_pool if scene_pool is not None else ScenePool(model_folder, preload_scenes)
+        # results of already traced static links keyed by the quantized geometry and the radio
+        # config; kept between simulations, 0 disables it. An entry holds the CFR of each band and,
+        # with antenna arrays, of each antenna pair as complex128, i.e. the cache needs up to
+        # geo_cache_size * 16 B * (fft_size * (1 + num_antennas^2) + sum of the band FFT sizes)
+        self.geo_cache = OrderedDict()
+        self.geo_cache_size = geo_cache_size
+        self.geo_cache_hits = 0
+        self.geo_config = None
+        # subset of subcarriers the CFR is computed for; None: all
+        self.csi_subcarriers = None
+        # center frequencies (Hz) and subcarrier frequencies of the additional bands
+        self.band_fc = []
+        self.band_frequencies = []
+        # planar antenna array of all nodes (rows, cols); the CFR is sent per antenna pair if more than one element
+        self.antenna_shape = (1, 1)
+        self.num_antennas = 1
+        # P2MP: only receivers within this radius of the TX are traced; None: all nodes
+        self.p2mp_radius = None
+        self.rx_grid = None
+        # adaptive lookahead horizon of mode 3 per TX node
+        self.lah_controllers = {}
+        # time spent per stage in ns for the current request
+        self.timing = dict.fromkeys(SionnaEnv.TIMING_STAGES, 0)
+        self.last_serialize_ns = 0
+        # counters written periodically as JSON
+        self.metrics = ServerMetrics(metrics_fname, metrics_interval)
+        # keep the whole mobility history of all nodes; debugging only
+        self.full_mobility_history = full_mobility_history
+
+        self.last_call_times = deque(maxlen=10)
+        self.total_num_csi_samples = 0
 
 
     def init_simulation_env(self, sim_init_msg):
@@ -110,10 +173,25 @@ class SionnaEnv:
 
         # Load the sionna scene
         filepath = os.path.join(self.model_folder, sim_init_msg.scene_fname)
-        try:
-            self.scene = load_scene(filepath)
-        except Exception as e:
-            return False, "Failed to load scene file in: " + filepath + ", error: " + str(e)
+        if self.scene is not None and self.scene_fpath == filepath:
+            # warm start: only remove the radio devices of the previous simulation
+            for placed_node in self.placed_radio_node_names:
+                self.scene.remove(placed_node)
+            self.placed_radio_node_names.clear()
+            print(f'Reusing loaded scene: {filepath}')
+        else:
+            self.scene = None
+            self.scene_fpath = None
+            self.placed_radio_node_names.clear()
+            try:
+                # loaded from file unless pinned or used by the previous simulation
+                self.scene = self.scene_pool.acquire(filepath)
+            except Exception as e:
+                return False, "Failed to load scene file in: " + filepath + ", error: " + str(e)
+            self.scene_fpath = filepath
+
+        # nodes of a previous simulation
+        self.node_info = {}
 
         self.bbox = self.scene.mi_scene.bbox()
 
@@ -136,7 +214,21 @@ class SionnaEnv:
         else:
             self.sub_mode = self.rt_max_parallel_links
 
-        self.time_evo_model = sim_init_msg.time_evo_model
+        self.time_evo_model = sim_init_msg.time_evo_model if sim_init_msg.time_evo_model else 'position'
+        if self.time_evo_model not in SionnaEnv.TIME_EVO_MODELS:
+            return False, "Unsupported time evolution model: " + self.time_evo_model
+
+        # wire format of the CFR
+        self.csi_encoding = sim_init_msg.csi_encoding
+
+        # same-host transport of the CFR payloads; falls back to the ZMQ message
+        self._release_shm()
+        if sim_init_msg.shm_path and self.csi_encoding != message_pb2.CSI_REPEATED_DOUBLE:
+            try:
+                self.shm = ShmRingWriter(sim_init_msg.shm_path, sim_init_msg.shm_size)
+                print(f'Using shared memory {sim_init_msg.shm_path} of {millify(sim_init_msg.shm_size)}B for CSI')
+            except Exception as e:
+                warnings.warn(f"Cannot map shared memory {sim_init_msg.shm_path}: {e}; sending CSI via ZMQ.", UserWarning)
 
         # Set scene parameters
         self.scene.frequency = sim_init_msg.frequency * 1e6
@@ -154,6 +246,41 @@ class SionnaEnv:
         # Subcarrier frequencies
         self.frequencies = subcarrier_frequencies(num_subcarriers=self.fft_size, subcarrier_spacing=self.subcarrier_spacing)
 
+        # the CFR is computed only for the selected subcarriers; ns3 interpolates the others
+        self.csi_subcarriers = None
+        self.csi_frequencies = self.frequencies
+        if len(sim_init_msg.csi_subcarriers) > 0:
+            self.csi_subcarriers = np.asarray(sim_init_msg.csi_subcarriers, dtype=int)
+            if np.any(np.diff(self.csi_subcarriers) <= 0) or self.csi_subcarriers[-1] >= self.fft_size:
+                return False, "CSI subcarriers must be ascending and smaller than the FFT size"
+            self.csi_frequencies = self.frequencies[self.csi_subcarriers]
+            print(f'Computing CFR for {len(self.csi_subcarriers)} of {self.fft_size} subcarriers')
+
+        # additional bands (e.g. multi-link or dual-band devices): the paths are traced once at fc; the CFR
+        # of a band is evaluated from them on its subcarriers shifted by its distance to fc
+        self.band_fc = [band.frequency * 1e6 for band in sim_init_msg.bands]
+        self.band_frequencies = [subcarrier_frequencies(num_subcarriers=band.fft_size,
+                                                        subcarrier_spacing=band.subcarrier_spacing)
+                                 for band in sim_init_msg.bands]
+        if len(self.band_fc) > 0:
+            print(f'Computing CFR for #additional bands: {len(self.band_fc)} at '
+                  f'{[band.frequency for band in sim_init_msg.bands]} MHz')
+
+        # antenna arrays: the same at all nodes such that the channel stays reciprocal
+        self.antenna_shape = (max(1, sim_init_msg.antenna_rows), max(1, sim_init_msg.antenna_cols))
+        self.num_antennas = self.antenna_shape[0] * self.antenna_shape[1]
+        if self.num_antennas > 1:
+            print(f'Computing CFR per antenna pair of {self.antenna_shape[0]}x{self.antenna_shape[1]} arrays')
+
+        # everything except the node positions a traced link depends on
+        self.geo_config = hash((self.scene_fpath, self.fc, self.scene.bandwidth, self.fft_size, self.subcarrier_spacing,
+                                tuple(sim_init_msg.csi_subcarriers),
+                                tuple((band.frequency, band.fft_size, band.subcarrier_spacing) for band in sim_init_msg.bands),
+                                self.antenna_shape,
+                                self.rt_max_depth, self.rt_samples_per_src, self.rt_los, self.rt_specular_reflection,
+                                self.rt_diffuse_reflection, self.rt_refraction, self.rt_synthetic_array,
+                                self.rt_diffraction, self.rt_edge_diffraction, self.rt_diffraction_lit_region))
+
         # Set the random seed for reproducibility
         np.random.seed(sim_init_msg.seed)
         tf.random.set_seed(sim_init_msg.seed)
@@ -161,6 +288,22 @@ class SionnaEnv:
 
         # configure mobility models
         self._init_mobility(sim_init_msg)
+        self.lah_controllers = {}
+
+        # receiver selection of P2MP: by distance and/or by the distance at which the Friis loss
+        # exceeds the given maximum
+        self.p2mp_radius = None
+        self.rx_grid = None
+        if sim_init_msg.p2mp_radius > 0:
+            self.p2mp_radius = sim_init_msg.p2mp_radius
+        if sim_init_msg.p2mp_max_loss > 0:
+            friis_radius = 299792458.0 / (4 * math.pi * self.fc) * 10 ** (sim_init_msg.p2mp_max_loss / 20)
+            self.p2mp_radius = friis_radius if self.p2mp_radius is None else min(self.p2mp_radius, friis_radius)
+        if self.p2mp_radius is not None:
+            self.rx_grid = SpatialGrid(self.p2mp_radius)
+            for node_id in self.node_info:
+                self.rx_grid.update(node_id, self.node_info[node_id].pos)
+            print(f'P2MP traces receivers within {self.p2mp_radius:.1f}m of the TX')
 
         # for mode 3 if only constant speed model supported
         if self.mode == SionnaEnv.MODE_P2MP_LAH:
@@ -184,12 +327,22 @@ class SionnaEnv:
 
             print(f'Running mode=3 w/ Tc: {self.chan_coh_time_mode3/1e6}ms')
 
+        if self.mode == SionnaEnv.MODE_P2MP_LAH and self.time_evo_model == 'doppler':
+            warnings.warn(f"Time evolution model doppler is not supported in mode P2MP(LAH); using position.", UserWarning)
+            self.time_evo_model = 'position'
+
+        if self.num_antennas > 1 and self.time_evo_model == 'doppler':
+            warnings.warn(f"Time evolution model doppler is not supported with antenna arrays; using position.", UserWarning)
+            self.time_evo_model = 'position'
+
         # Configure antenna array for all transmitters/receivers
-        self.scene.tx_array = PlanarArray(num_rows=1, num_cols=1, vertical_spacing=0.5, horizontal_spacing=0.5,
-                                     pattern="tr38901", polarization="V")
+        self.scene.tx_array = PlanarArray(num_rows=self.antenna_shape[0], num_cols=self.antenna_shape[1],
+                                          vertical_spacing=0.5, horizontal_spacing=0.5,
+                                          pattern="tr38901", polarization="V")
 
-        self.scene.rx_array = PlanarArray(num_rows=1, num_cols=1, vertical_spacing=0.5, horizontal_spacing=0.5,
-                                     pattern="dipole", polarization="V")
+        self.scene.rx_array = PlanarArray(num_rows=self.antenna_shape[0], num_cols=self.antenna_shape[1],
+                                          vertical_spacing=0.5, horizontal_spacing=0.5,
+                                          pattern="dipole", polarization="V")
 
         # set current sim time to 0ns
         self.sim_time = 0
@@ -202,24 +355,25 @@ class SionnaEnv:
         tx_node_id = csi_req.tx_node
         rx_node_id = csi_req.rx_node
 
+        self._prune_mobility_history()
+
+        # outcome of earlier lookahead CSI
+        for lah_feedback in csi_req.lah_feedback:
+            self.lah_controllers.setdefault(lah_feedback.tx_node, LookaheadController()) \
+                .add_feedback(lah_feedback.used, lah_feedback.unused)
+
         if self.mode == SionnaEnv.MODE_P2MP_LAH:
             if isinstance(self.node_info[tx_node_id], RandomWalkMobility) and isinstance(self.node_info[rx_node_id], ConstantMobility):
-                # Exploit channel reciprocity - swap mobile TX with static RX
+                # Exploit channel reciprocity - swap mobile TX with static RX; a fixed TX is
+                # traced only once for all lookahead positions
                 csi_req.tx_node = rx_node_id
                 csi_req.rx_node = tx_node_id
 
-        # check if mode 3 can be used
-        if self.mode == SionnaEnv.MODE_P2MP_LAH and isinstance(self.node_info[tx_node_id], ConstantMobility):
-            # mode=3 is feasible if TX is fixed
+            # mode=3 with fixed or mobile TX
             return self.compute_cfr_with_lookahead(csi_req, reply_wrapper)
         else:
-            req_mode = self.mode
-            # mode=1/2 or if TX node is mobile
-            if self.mode == SionnaEnv.MODE_P2MP_LAH:
-                req_mode = SionnaEnv.MODE_P2MP
-                print(f'Fallback to mode={req_mode} as TX node is mobile')
-
-            return self.compute_cfr_classic(csi_req, reply_wrapper, req_mode)
+            # mode=1/2
+            return self.compute_cfr_classic(csi_req, reply_wrapper, self.mode)
 
 
     def compute_cfr_with_lookahead(self, csi_req, reply_wrapper):
@@ -243,30 +397,42 @@ class SionnaEnv:
         # update position of all nodes
         nodes_to_update = list(self.node_info.keys())
 
-        # compute look-ahead
-        look_ahead = math.floor(self.sub_mode / (len(nodes_to_update) - 1))
+        # a fixed TX is traced once to the receivers of all lookahead positions; a mobile TX once
+        # per lookahead position to the receivers of that position. Either way #links = LAH * #RX
+        fixed_tx_node = isinstance(self.node_info[tx_node_id], ConstantMobility)
+
+        # compute look-ahead; the no. of receivers is estimated from the current positions and the
+        # horizon adapted to the lookahead actually used by ns3 within the GPU memory budget
+        num_rx = len(self._select_p2mp_receivers(tx_node_id, rx_node_id))
+        lah_budget = max(1, math.floor(self.sub_mode / num_rx))
+        look_ahead = self.lah_controllers.setdefault(tx_node_id, LookaheadController()).get_horizon(lah_budget)
 
-        print(f'compute CFR to #RX={len(nodes_to_update) - 1} with LAH={look_ahead}')
+        if self.VERBOSE:
+            print(f'compute CFR to #RX={num_rx} with LAH={look_ahead} (budget: {lah_budget})')
 
         # sim future node positions
         lah_time_vec = []
+        selected_rx_nodes = set()
         for lah_i in range(look_ahead):
             # move in time
             dt = req_sim_time - self.sim_time
 
-            csi_tc_arr = []
             for node_id in nodes_to_update:
                 # perform walk
                 self._walk(node_id, dt)
-                if node_id != tx_node_id:
-                    tc = coherence_from_velocities(self.node_info[node_id].velocity,
-                                                    self.node_info[tx_node_id].velocity, self.fc,
-                                                    pos_tx=self.node_info[node_id].pos,
-                                                    pos_rx=self.node_info[tx_node_id].pos)
-                    csi_tc_arr.append(tc)
+
+            # receivers in range at any of the lookahead positions
+            lah_rx_nodes = self._select_p2mp_receivers(tx_node_id, rx_node_id)
+            selected_rx_nodes.update(lah_rx_nodes)
+
+            csi_tc_arr = coherence_from_velocities_batch(
+                np.asarray([self.node_info[node_id].velocity for node_id in lah_rx_nodes]),
+                self.node_info[tx_node_id].velocity, self.fc,
+                pos_tx=np.asarray([self.node_info[node_id].pos for node_id in lah_rx_nodes]),
+                pos_rx=self.node_info[tx_node_id].pos)
 
             # take the worst case Tc from all RX nodes
-            Tc_p2mp = int(np.min(np.asarray(csi_tc_arr)))
+            Tc_p2mp = int(np.min(csi_tc_arr))
 
             # update time
             self.sim_time = req_sim_time
@@ -276,44 +442,22 @@ class SionnaEnv:
 
 
         # place TX and RX nodes together with their future positions
-        rx_nodes = nodes_to_update
-        rx_nodes.remove(tx_node_id)
-
-        self._place_tx_rx_nodes_with_lah(lah_time_vec, tx_node_id, rx_nodes)
-
-        # create pathsolver; todo: check reuse
-        p_solver  = PathSolver()
-
-        # Compute propagation paths
-        paths = p_solver(scene=self.scene,
-                         max_depth=self.rt_max_depth,
-                         samples_per_src=self.rt_samples_per_src,
-                         los=self.rt_los,
-                         specular_reflection=self.rt_specular_reflection,  # Can rays bounce off surfaces?
-                         diffuse_reflection=self.rt_diffuse_reflection,
-                         refraction=self.rt_refraction,  # Can rays pass through materials?
-                         synthetic_array=self.rt_synthetic_array,
-                         diffraction=self.rt_diffraction,  # costly
-                         edge_diffraction=self.rt_edge_diffraction,  # rays that bend around edges
-                         diffraction_lit_region=self.rt_diffraction_lit_region)  # higher physical accuracy
-
-        # AZU: sampling_frequency is only used if num_time_steps > 1
-        # a: shape [num_rx, num_rx_ant, num_tx, num_tx_ant, num_paths, num_time_steps],
-        a, tau = paths.cir(sampling_frequency=1e9, normalize_delays=False, out_type="numpy")
+        rx_nodes = [node_id for node_id in nodes_to_update if node_id in selected_rx_nodes]
 
-        # shape: [num_rx, num_rx_ant, num_tx, num_tx_ant, num_ofdm_symbols, num_subcarriers]
-        h_raw = paths.cfr(frequencies=self.frequencies,
-                  sampling_frequency=1.0,  # not used
-                  num_time_steps=1,
-                  normalize_delays=True,
-                  # If set to True, path delays are normalized such that the first path between any pair of
-                  # antennas of a transmitter and receiver arrives at tau=0
-                  normalize=False,  # Normalize energy
-                  out_type="numpy")
-
-        # max single transmitter
-        assert h_raw.shape[2] == 1
-        num_computed_lnks = h_raw.shape[0]
+        # Compute propagation paths; per lookahead position: (tau, h_raw, h_bands, index of its first RX)
+        if fixed_tx_node:
+            self._place_tx_rx_nodes_with_lah(lah_time_vec, tx_node_id, rx_nodes)
+            tau, h_raw, _, h_bands = self._compute_paths()
+            lah_paths = [(tau, h_raw, h_bands, lah_time_idx * len(rx_nodes)) for lah_time_idx in range(len(lah_time_vec))]
+        else:
+            # one (TX snapshot, RX snapshot) scene per position instead of all TX snapshots to all RX
+            lah_paths = []
+            for lah_time in lah_time_vec:
+                self._place_tx_rx_nodes_with_lah([lah_time], tx_node_id, rx_nodes)
+                tau, h_raw, _, h_bands = self._compute_paths()
+                lah_paths.append((tau, h_raw, h_bands, 0))
+        assert all(h_raw.shape[2] == 1 for _, h_raw, _, _ in lah_paths)
+        num_computed_lnks = len(lah_time_vec) * len(rx_nodes)
 
         # Create ZMQ response
         chan_response = reply_wrapper.channel_state_response
@@ -323,68 +467,58 @@ class SionnaEnv:
             csi = chan_response.csi.add()
 
             csi.start_time = lah_time
-            # tx node is fixed
-            tx_pos = self.node_info[tx_node_id].pos
+            # tx node at its lookahead position
+            tau, h_raw, h_bands, rx_offset = lah_paths[lah_time_idx]
+            tx_id = 0
+            tx_pos = self.node_info[tx_node_id].get_pos_at(lah_time)
+            tx_velo = self.node_info[tx_node_id].get_velo_at(lah_time)
             csi.tx_node.id = tx_node_id
             csi.tx_node.position.x = tx_pos[0]
             csi.tx_node.position.y = tx_pos[1]
             csi.tx_node.position.z = tx_pos[2]
+            csi.tx_node.velocity.x, csi.tx_node.velocity.y, csi.tx_node.velocity.z = map(float, tx_velo)
+
+            # all receiver(s) of this lookahead position at once
+            rx_ids = rx_offset + np.arange(len(rx_nodes))
+            lnk_delay, lnk_loss, h_normalized = self._postprocess_links(tau[rx_ids, :, tx_id, :, :],
+                                                                        h_raw[rx_ids, :, tx_id, :, :, :])
+            lnk_h_bands = self._postprocess_bands([h_band[rx_ids, :, tx_id, :, :, :] for h_band in h_bands])
+            lnk_h_mimo = self._postprocess_mimo(h_raw[rx_ids, :, tx_id, :, :, :], lnk_loss)
+            packed_csi = self._pack_csi(h_normalized) if self.est_csi else None
+            packed_bands = [self._pack_csi(h_band) for h_band in lnk_h_bands] if self.est_csi else None
+            packed_mimo = self._pack_mimo_csi(lnk_h_mimo) if self.est_csi else None
+
+            rx_pos = np.asarray([self.node_info[curr_rx_node].get_pos_at(lah_time) for curr_rx_node in rx_nodes])
+            rx_velo = np.asarray([self.node_info[curr_rx_node].get_velo_at(lah_time) for curr_rx_node in rx_nodes])
+            csi_tc_arr = coherence_from_velocities_batch(rx_velo, tx_velo, self.fc, pos_tx=rx_pos, pos_rx=tx_pos)
 
-            # get receiver(s)
-            csi_tc_arr = []
             for curr_rx_id, curr_rx_node in enumerate(rx_nodes):
-
-                rx_id = lah_time_idx * len(rx_nodes) + curr_rx_id
-
-                lnk_tau = np.squeeze(tau[rx_id, :, :, :, :])
-                lnk_delay = int(round(np.min(lnk_tau[lnk_tau >= 0] * 1e9), 0))
-
-                h = np.squeeze(h_raw[rx_id, :, :, :, :, ])
-
-                # see Parseval's theorem
-                lnk_loss = float(-10 * np.log10(np.mean(np.abs(h) ** 2)))
-
-                # for frequency-selective channel
-                power = np.mean(np.abs(h) ** 2)  # shape [batch_size, 1, 1, 1]
-
-                h_normalized = h / np.sqrt(power)
-
-                # plausibility test
-                if self.CHECKS_ENABLED:
-                    power_normalized = np.mean(np.abs(h_normalized) ** 2)
-                    assert math.isclose(power_normalized, 1.0, rel_tol=1e-3)   # Should be close to 1
-
                 if self.VERBOSE:
-                    print(f'{lah_time/1e9}s: {tx_node_id}->{curr_rx_node} lnk_delay = {lnk_delay}ns, wb_loss = {lnk_loss:.3f}dB, CFR shape: {h_normalized.shape}')
+                    print(f'{lah_time/1e9}s: {tx_node_id}->{curr_rx_node} lnk_delay = {lnk_delay[curr_rx_id]}ns, wb_loss = {lnk_loss[curr_rx_id]:.3f}dB, CFR shape: {h_normalized[curr_rx_id].shape}')
 
                 rx_node_info = csi.rx_nodes.add()
-                rx_pos = self.node_info[curr_rx_node].get_pos_at(lah_time)
                 rx_node_info.id = curr_rx_node
-                rx_node_info.position.x = rx_pos[0]
-                rx_node_info.position.y = rx_pos[1]
-                rx_node_info.position.z = rx_pos[2]
-                rx_node_info.delay = lnk_delay
-                rx_node_info.wb_loss = lnk_loss
+                rx_node_info.position.x = rx_pos[curr_rx_id, 0]
+                rx_node_info.position.y = rx_pos[curr_rx_id, 1]
+                rx_node_info.position.z = rx_pos[curr_rx_id, 2]
+                rx_node_info.velocity.x, rx_node_info.velocity.y, rx_node_info.velocity.z = map(float, rx_velo[curr_rx_id])
+                rx_node_info.delay = int(lnk_delay[curr_rx_id])
+                rx_node_info.wb_loss = float(lnk_loss[curr_rx_id])
 
                 if self.est_csi:
-                    rx_node_info.frequencies.extend(self.frequencies.tolist())
-                    rx_node_info.csi_imag.extend(np.imag(h_normalized).tolist())
-                    rx_node_info.csi_real.extend(np.real(h_normalized).tolist())
+                    self._fill_csi(rx_node_info, h_normalized[curr_rx_id], packed_csi[curr_rx_id])
+                    self._fill_band_csi(rx_node_info, lnk_h_bands, packed_bands, curr_rx_id)
+                    self._fill_mimo_csi(rx_node_info, lnk_h_mimo, packed_mimo, curr_rx_id)
 
-                tc = coherence_from_velocities(self.node_info[curr_rx_node].get_velo_at(lah_time),
-                                                self.node_info[tx_node_id].velocity, self.fc,
-                                                pos_tx=self.node_info[curr_rx_node].get_pos_at(lah_time),
-                                                pos_rx=self.node_info[tx_node_id].pos)
-
-                rx_node_info.end_time2 = csi.start_time + tc
-                csi_tc_arr.append(tc)
+                rx_node_info.end_time2 = csi.start_time + int(csi_tc_arr[curr_rx_id])
 
             # take the worst case Tc from all RX nodes
-            Tc_p2mp = int(np.min(np.asarray(csi_tc_arr)))
+            Tc_p2mp = int(np.min(csi_tc_arr))
             Tc_p2mp_lah.append(Tc_p2mp)
             csi.end_time = csi.start_time + Tc_p2mp - 1 # -1ns to have non-overlapping intervals
 
-        print(f'{self.sim_time / 1e9}s: Computed CSI with Tc: {np.round(np.asarray(Tc_p2mp_lah) / 1e6,2)}ms, #links: {num_computed_lnks}')
+        if self.VERBOSE:
+            print(f'{self.sim_time / 1e9}s: Computed CSI with Tc: {np.round(np.asarray(Tc_p2mp_lah) / 1e6,2)}ms, #links: {num_computed_lnks}')
 
         return num_computed_lnks
 
@@ -392,35 +526,26 @@ class SionnaEnv:
     def _place_tx_rx_nodes_with_lah(self, lah_time_vec: list, tx_node: int, rx_nodes: list):
         '''
         Place the given nodes together with their lookahead positions in the scenario
-        :param lah_time_vec: time vector containing the lah time vector
+        :param lah_time_vec: time vector containing the lah time vector; a single time for a mobile TX
         :param tx_node: the transmitting node
         :param rx_nodes: the receiver nodes
         '''
 
-        # remove old tx and rx nodes
-        for placed_node in self.placed_radio_node_names:
-            self.scene.remove(placed_node)
-        self.placed_radio_node_names.clear()
-
-        # only supported if TX is fixed
-        fixed_tx_node = isinstance(self.node_info[tx_node], ConstantMobility)
-        assert fixed_tx_node
-
-        # Create transmitter
-        tx_pos = self.node_info[tx_node].pos
-        tx_node_name = "tx"
-        tx = Transmitter(name=tx_node_name, position=tx_pos, orientation=[0, -180, 0], display_radius=self.disp_r)
-        self.scene.add(tx)
-        self.placed_radio_node_names.append(tx_node_name)
+        # a fixed TX is placed once, a mobile TX at its position of the (single) lookahead time
+        if isinstance(self.node_info[tx_node], ConstantMobility):
+            tx_devices = [("tx", self.node_info[tx_node].pos)]
+        else:
+            assert len(lah_time_vec) == 1
+            tx_devices = [("tx", self.node_info[tx_node].get_pos_at(lah_time_vec[0]))]
 
+        # receiver(s) at their future positions
+        rx_devices = []
         for lah_time_idx, lah_time in enumerate(lah_time_vec):
-            # Create a receiver(s)
             for rx_node_i in rx_nodes:
                 rx_node_name = "rx" + str(rx_node_i) + "." + str(lah_time_idx)
-                rx_pos = self.node_info[rx_node_i].get_pos_at(lah_time)
-                rx = Receiver(name=rx_node_name, position=rx_pos, orientation=[0, -180, 0], display_radius=self.disp_r)
-                self.scene.add(rx)
-                self.placed_radio_node_names.append(rx_node_name)
+                rx_devices.append((rx_node_name, self.node_info[rx_node_i].get_pos_at(lah_time)))
+
+        self._place_radio_devices(tx_devices, rx_devices)
 
 
     def compute_cfr_classic(self, csi_req, reply_wrapper, req_mode):
@@ -437,11 +562,9 @@ class SionnaEnv:
         rx_node_id = csi_req.rx_node # this rx node must be included in result set
         req_sim_time = csi_req.time # we need CFR at that point in time [ns]
 
-        if self.time_evo_model == 'doppler':
-            #(lnk_delay, lnk_loss, h_normalized) = self.compute_cfr_via_doppler()
-            pass
-        else: # position=based
-            (rx_nodes, lnk_delay, lnk_loss, h_normalized) = self._compute_cfr_via_position(req_sim_time, tx_node_id, rx_node_id, req_mode)
+        # 'doppler': traced like 'position'; in addition the paths of each link are returned
+        (rx_nodes, lnk_delay, lnk_loss, h_normalized, lnk_paths, lnk_h_bands, lnk_h_mimo) = \
+            self._compute_cfr_via_position(req_sim_time, tx_node_id, rx_node_id, req_mode)
 
         # Create ZMQ response
         chan_response = reply_wrapper.channel_state_response
@@ -454,42 +577,636 @@ class SionnaEnv:
         csi.tx_node.position.x = tx_pos[0]
         csi.tx_node.position.y = tx_pos[1]
         csi.tx_node.position.z = tx_pos[2]
+        tx_velo = self.node_info[tx_node_id].velocity
+        csi.tx_node.velocity.x, csi.tx_node.velocity.y, csi.tx_node.velocity.z = map(float, tx_velo)
+
+        packed_csi = self._pack_csi(h_normalized) if self.est_csi and lnk_paths is None else None
+        packed_bands = [self._pack_csi(h_band) for h_band in lnk_h_bands] if self.est_csi else None
+        packed_mimo = self._pack_mimo_csi(lnk_h_mimo) if self.est_csi else None
+
+        # compute coherence time: with direction vectors you can compute the radial (projected) relative
+        # speed directly and from that the Doppler and coherence time.
+        rx_pos = np.asarray([self.node_info[comp_rx_node_id].pos for comp_rx_node_id in rx_nodes])
+        rx_velo = np.asarray([self.node_info[comp_rx_node_id].velocity for comp_rx_node_id in rx_nodes])
+        csi_tc_arr = coherence_from_velocities_batch(rx_velo, tx_velo, self.fc, pos_tx=rx_pos, pos_rx=tx_pos)
+        if lnk_paths is not None:
+            csi_tc_arr = np.maximum(csi_tc_arr, doppler_validity_batch(tx_velo, rx_velo, self.doppler_max_distance))
 
-        csi_tc_arr = []
         # for all rx nodes
         for idx, comp_rx_node_id in enumerate(rx_nodes):
             rx_node_info = csi.rx_nodes.add()
-            rx_pos = self.node_info[comp_rx_node_id].pos
             rx_node_info.id = comp_rx_node_id
-            rx_node_info.position.x = rx_pos[0]
-            rx_node_info.position.y = rx_pos[1]
-            rx_node_info.position.z = rx_pos[2]
-            rx_node_info.delay = lnk_delay[idx]
-            rx_node_info.wb_loss = lnk_loss[idx]
-
-            if self.est_csi:
-                rx_node_info.frequencies.extend(self.frequencies.tolist())
-                rx_node_info.csi_imag.extend(np.imag(h_normalized[idx]).tolist())
-                rx_node_info.csi_real.extend(np.real(h_normalized[idx]).tolist())
-
-            # compute coherence time: with direction vectors you can compute the radial (projected) relative
-            # speed directly and from that the Doppler and coherence time.
-            tc = coherence_from_velocities(self.node_info[comp_rx_node_id].velocity,
-                                            self.node_info[tx_node_id].velocity, self.fc,
-                                            pos_tx=self.node_info[comp_rx_node_id].pos,
-                                            pos_rx=self.node_info[tx_node_id].pos)
-            rx_node_info.end_time2 = tc
-            csi_tc_arr.append(tc)
+            rx_node_info.position.x = rx_pos[idx, 0]
+            rx_node_info.position.y = rx_pos[idx, 1]
+            rx_node_info.position.z = rx_pos[idx, 2]
+            rx_node_info.velocity.x, rx_node_info.velocity.y, rx_node_info.velocity.z = map(float, rx_velo[idx])
+            rx_node_info.delay = int(lnk_delay[idx])
+            rx_node_info.wb_loss = float(lnk_loss[idx])
+
+            if self.est_csi and lnk_paths is not None:
+                self._fill_paths(rx_node_info, lnk_paths[idx])
+            elif self.est_csi:
+                self._fill_csi(rx_node_info, h_normalized[idx], packed_csi[idx])
+                self._fill_band_csi(rx_node_info, lnk_h_bands, packed_bands, idx)
+                self._fill_mimo_csi(rx_node_info, lnk_h_mimo, packed_mimo, idx)
+
+            rx_node_info.end_time2 = int(csi_tc_arr[idx])
+            rx_node_info.static_link = self._is_static_link(tx_node_id, comp_rx_node_id)
 
         # take the worst case Tc from all RX nodes
-        Tc_p2mp = int(np.min(np.asarray(csi_tc_arr)))
+        Tc_p2mp = int(np.min(csi_tc_arr))
 
-        print(f'{self.sim_time / 1e9}s: Computed CSI with Tc: {round(Tc_p2mp / 1e6,2)}ms, #links: {len(rx_nodes)}')
+        if self.VERBOSE:
+            print(f'{self.sim_time / 1e9}s: Computed CSI with Tc: {round(Tc_p2mp / 1e6,2)}ms, #links: {len(rx_nodes)}')
 
         csi.end_time = self.sim_time + Tc_p2mp
         return len(rx_nodes)
 
 
+    def compute_cfr_batch(self, batch_req, reply_wrapper):
+        '''
+        Compute the requested CFRs of several links. All transmitters requested at the same point in
+        time are traced together within a single Sionna scene evaluation; the number of links per
+        evaluation is limited by rt_max_parallel_links.
+        :param batch_req: received batched CSI request (ZMQ)
+        :param reply_wrapper: the response
+        :return: no. of computed links
+        '''
+
+        if self.VERBOSE:
+            print_batch_csi_request(batch_req)
+
+        self._prune_mobility_history()
+
+        # a batch has no lookahead: ns3 only sends batches in mode 3 to precompute the CSI on its own
+        # time grid, these are computed like in mode 2
+        req_mode = SionnaEnv.MODE_P2P if self.mode == SionnaEnv.MODE_P2P else SionnaEnv.MODE_P2MP
+
+        # requested RX nodes per TX node per point in time
+        links_per_time = {}
+        for link_set in batch_req.links:
+            rx_set = links_per_time.setdefault(link_set.time, {}).setdefault(link_set.tx_node, set())
+            rx_set.update(link_set.rx_nodes)
+
+        chan_response = reply_wrapper.channel_state_response
+
+        num_computed_lnks = 0
+        for req_sim_time in sorted(links_per_time):
+            links = links_per_time[req_sim_time]
+
+            if req_mode == SionnaEnv.MODE_P2P:
+                nodes_to_update = set(links.keys()).union(*links.values())
+            else:
+                nodes_to_update = set(self.node_info.keys())
+
+            # execute mobility
+            dt = req_sim_time - self.sim_time
+            for node_id in nodes_to_update:
+                self._walk(node_id, dt)
+
+            if req_mode != SionnaEnv.MODE_P2P:
+                # each TX to all other nodes in range and the requested ones
+                for tx_node_id in links:
+                    links[tx_node_id] = links[tx_node_id].union(self._select_p2mp_receivers(tx_node_id))
+
+            # update time
+            self.sim_time = req_sim_time
+
+            tx_nodes = sorted(links.keys())
+            rx_nodes = sorted(set().union(*links.values()))
+
+            # no. of transmitters traced at once such that the links fit into GPU memory
+            tx_per_eval = max(1, self.rt_max_parallel_links // len(rx_nodes))
+
+            for chunk_start in range(0, len(tx_nodes), tx_per_eval):
+                chunk_tx_nodes = tx_nodes[chunk_start:chunk_start + tx_per_eval]
+
+                lnk_pairs = [(tx_node_id, rx_node_id) for tx_node_id in chunk_tx_nodes for rx_node_id in rx_nodes
+                             if rx_node_id in links[tx_node_id]]
+                lnk_results = self._geo_cache_get(lnk_pairs)
+                lnk_paths = None
+                if lnk_results is None:
+                    self._place_tx_rx_nodes(chunk_tx_nodes, rx_nodes)
+
+                    # Compute propagation paths of all transmitters
+                    tau, h_raw, cir, h_bands = self._compute_paths()
+
+                    rx_ids = [rx_nodes.index(rx_node_id) for _, rx_node_id in lnk_pairs]
+                    tx_ids = [chunk_tx_nodes.index(tx_node_id) for tx_node_id, _ in lnk_pairs]
+                    lnk_delay, lnk_loss, h_normalized = self._postprocess_links(tau[rx_ids, :, tx_ids, :, :],
+                                                                                h_raw[rx_ids, :, tx_ids, :, :, :])
+                    lnk_h_bands = self._postprocess_bands([h_band[rx_ids, :, tx_ids, :, :, :] for h_band in h_bands])
+                    lnk_h_mimo = self._postprocess_mimo(h_raw[rx_ids, :, tx_ids, :, :, :], lnk_loss)
+                    if cir is not None:
+                        lnk_paths = self._postprocess_paths(cir[0][rx_ids, :, tx_ids, :, :], tau[rx_ids, :, tx_ids, :, :],
+                                                            cir[1][rx_ids, :, tx_ids, :, :], lnk_loss)
+                    self._geo_cache_put(lnk_pairs, self._unstack_link_results(lnk_delay, lnk_loss, h_normalized,
+                                                                              lnk_h_bands, lnk_h_mimo))
+                else:
+                    lnk_delay, lnk_loss, h_normalized, lnk_h_bands, lnk_h_mimo = self._stack_link_results(lnk_results)
+                packed_csi = self._pack_csi(h_normalized) if self.est_csi and lnk_paths is None else None
+                packed_bands = [self._pack_csi(h_band) for h_band in lnk_h_bands] if self.est_csi else None
+                packed_mimo = self._pack_mimo_csi(lnk_h_mimo) if self.est_csi else None
+
+                rx_pos = np.asarray([self.node_info[rx_node_id].pos for _, rx_node_id in lnk_pairs])
+                rx_velo = np.asarray([self.node_info[rx_node_id].velocity for _, rx_node_id in lnk_pairs])
+                csi_tc_arr = coherence_from_velocities_batch(
+                    rx_velo,
+                    np.asarray([self.node_info[tx_node_id].velocity for tx_node_id, _ in lnk_pairs]), self.fc,
+                    pos_tx=rx_pos, pos_rx=np.asarray([self.node_info[tx_node_id].pos for tx_node_id, _ in lnk_pairs]))
+                if lnk_paths is not None:
+                    csi_tc_arr = np.maximum(csi_tc_arr, doppler_validity_batch(
+                        np.asarray([self.node_info[tx_node_id].velocity for tx_node_id, _ in lnk_pairs]), rx_velo,
+                        self.doppler_max_distance))
+                lnk_idx = 0
+
+                for tx_node_id in chunk_tx_nodes:
+                    csi = chan_response.csi.add()
+
+                    csi.start_time = self.sim_time
+                    # tx node info
+                    tx_pos = self.node_info[tx_node_id].pos
+                    csi.tx_node.id = tx_node_id
+                    csi.tx_node.position.x = tx_pos[0]
+                    csi.tx_node.position.y = tx_pos[1]
+                    csi.tx_node.position.z = tx_pos[2]
+                    tx_velo = self.node_info[tx_node_id].velocity
+                    csi.tx_node.velocity.x, csi.tx_node.velocity.y, csi.tx_node.velocity.z = map(float, tx_velo)
+
+                    tx_lnk_start = lnk_idx
+                    for rx_node_id in rx_nodes:
+                        if rx_node_id not in links[tx_node_id]:
+                            continue
+
+                        if self.VERBOSE:
+                            print(f'{self.sim_time/1e9}s: {tx_node_id}->{rx_node_id} lnk_delay = {lnk_delay[lnk_idx]}ns, wb_loss = {lnk_loss[lnk_idx]:.3f}dB')
+
+                        rx_node_info = csi.rx_nodes.add()
+                        rx_node_info.id = rx_node_id
+                        rx_node_info.position.x = rx_pos[lnk_idx, 0]
+                        rx_node_info.position.y = rx_pos[lnk_idx, 1]
+                        rx_node_info.position.z = rx_pos[lnk_idx, 2]
+                        rx_node_info.velocity.x, rx_node_info.velocity.y, rx_node_info.velocity.z = map(float, rx_velo[lnk_idx])
+                        rx_node_info.delay = int(lnk_delay[lnk_idx])
+                        rx_node_info.wb_loss = float(lnk_loss[lnk_idx])
+
+                        if self.est_csi and lnk_paths is not None:
+                            self._fill_paths(rx_node_info, lnk_paths[lnk_idx])
+                        elif self.est_csi:
+                            self._fill_csi(rx_node_info, h_normalized[lnk_idx], packed_csi[lnk_idx])
+                            self._fill_band_csi(rx_node_info, lnk_h_bands, packed_bands, lnk_idx)
+                            self._fill_mimo_csi(rx_node_info, lnk_h_mimo, packed_mimo, lnk_idx)
+
+                        rx_node_info.end_time2 = int(csi_tc_arr[lnk_idx])
+                        rx_node_info.static_link = self._is_static_link(tx_node_id, rx_node_id)
+                        lnk_idx += 1
+                        num_computed_lnks += 1
+
+                    # take the worst case Tc from all RX nodes
+                    Tc_p2mp = int(np.min(csi_tc_arr[tx_lnk_start:lnk_idx]))
+                    csi.end_time = self.sim_time + Tc_p2mp
+
+            if self.VERBOSE:
+                print(f'{self.sim_time / 1e9}s: Computed batched CSI for #TX: {len(tx_nodes)}, #RX: {len(rx_nodes)}')
+
+        return num_computed_lnks
+
+
+    def _trace_paths(self, scene):
+        return self.p_solver(scene=scene,
+                             max_depth=self.rt_max_depth,
+                             samples_per_src=self.rt_samples_per_src,
+                             los=self.rt_los,
+                             specular_reflection=self.rt_specular_reflection,  # Can rays bounce off surfaces?
+                             diffuse_reflection=self.rt_diffuse_reflection,
+                             refraction=self.rt_refraction,  # Can rays pass through materials?
+                             # arrays: a single trace per node; the phase of each element is computed analytically
+                             synthetic_array=self.rt_synthetic_array or self.num_antennas > 1,
+                             diffraction=self.rt_diffraction,  # costly
+                             edge_diffraction=self.rt_edge_diffraction,  # rays that bend around edges
+                             diffraction_lit_region=self.rt_diffraction_lit_region)  # higher physical accuracy
+
+
+    def warm_up(self):
+        '''
+        Trace a single link in each pinned scene such that the kernels of the path solver are compiled
+        before the first simulation; they are kept by Dr.Jit for the lifetime of the process
+        '''
+        for filepath in self.scene_pool.pinned:
+            t_start = time.perf_counter()
+            scene = self.scene_pool.acquire(filepath)
+            bbox = scene.mi_scene.bbox()
+            center = [float(bbox.min[i] + bbox.max[i]) / 2 for i in range(3)]
+            scene.tx_array = PlanarArray(num_rows=1, num_cols=1, vertical_spacing=0.5, horizontal_spacing=0.5,
+                                         pattern="tr38901", polarization="V")
+            scene.rx_array = PlanarArray(num_rows=1, num_cols=1, vertical_spacing=0.5, horizontal_spacing=0.5,
+                                         pattern="dipole", polarization="V")
+            scene.add(Transmitter(name="warmup.tx", position=center))
+            scene.add(Receiver(name="warmup.rx", position=[center[0] + 1.0, center[1], center[2]]))
+            paths = self._trace_paths(scene)
+            paths.cfr(frequencies=subcarrier_frequencies(num_subcarriers=64, subcarrier_spacing=312500),
+                      sampling_frequency=1.0, num_time_steps=1, normalize_delays=True, normalize=False,
+                      out_type="numpy")
+            scene.remove("warmup.tx")
+            scene.remove("warmup.rx")
+            print(f'Warm-up trace in scene {filepath} took {time.perf_counter() - t_start:.2f}s')
+
+
+    def _compute_paths(self):
+        '''
+        Trace the propagation paths between all placed transmitters and receivers
+        :return: (path delays, CFR, CIR, CFR per additional band) of shape [num_rx, num_rx_ant, num_tx, num_tx_ant, num_paths]
+            and [num_rx, num_rx_ant, num_tx, num_tx_ant, num_ofdm_symbols, num_subcarriers]; CIR is
+            (complex path gains, Doppler shifts in Hz) of the same shape as the path delays with time
+            evolution model 'doppler' and None otherwise; no CFR of the additional bands with 'doppler'
+        '''
+        t_start = time.perf_counter_ns()
+
+        # Compute propagation paths
+        paths = self._trace_paths(self.scene)
+
+        # AZU: sampling_frequency is only used if num_time_steps > 1
+        # a: shape [num_rx, num_rx_ant, num_tx, num_tx_ant, num_paths, num_time_steps],
+        a, tau = paths.cir(sampling_frequency=1e9, normalize_delays=False, out_type="numpy")
+
+        # shape: [num_rx, num_rx_ant, num_tx, num_tx_ant, num_ofdm_symbols, num_subcarriers]
+        h_raw = paths.cfr(frequencies=self.csi_frequencies,
+                  sampling_frequency=1.0,  # not used
+                  num_time_steps=1,
+                  normalize_delays=True,
+                  # If set to True, path delays are normalized such that the first path between any pair of
+                  # antennas of a transmitter and receiver arrives at tau=0
+                  normalize=False,  # Normalize energy
+                  out_type="numpy")
+
+        cir = None
+        h_bands = []
+        if self.time_evo_model == 'doppler':
+            # from the velocities of the radio devices; ns3 synthesizes the CFR of all bands
+            cir = (a[..., 0], np.asarray(paths.doppler.numpy()))
+        else:
+            # the same paths on the subcarriers of the additional bands
+            for band_fc, band_frequencies in zip(self.band_fc, self.band_frequencies):
+                h_bands.append(paths.cfr(frequencies=band_frequencies + (band_fc - self.fc),
+                                         sampling_frequency=1.0,
+                                         num_time_steps=1,
+                                         normalize_delays=True,
+                                         normalize=False,
+                                         out_type="numpy"))
+
+        self._add_timing('trace', t_start)
+        return tau, h_raw, cir, h_bands
+
+
+    def _geo_key(self, tx_node, rx_node):
+        # positions are quantized to GEO_CACHE_RESOLUTION
+        tx_pos = np.round(np.asarray(self.node_info[tx_node].pos, dtype=float) / SionnaEnv.GEO_CACHE_RESOLUTION)
+        rx_pos = np.round(np.asarray(self.node_info[rx_node].pos, dtype=float) / SionnaEnv.GEO_CACHE_RESOLUTION)
+        return self.geo_config, tuple(tx_pos.astype(np.int64)), tuple(rx_pos.astype(np.int64))
+
+
+    def _geo_cache_get(self, lnk_pairs: list):
+        '''
+        Look up already traced links with unchanged geometry
+        :param lnk_pairs: list of (tx node, rx node)
+        :return: list of (link propagation delay, wideband loss, normalized CFR, normalized CFR per additional band)
+            or None if any link is unknown
+        '''
+        # 'doppler': the paths depend on the velocities as well
+        if self.geo_cache_size == 0 or self.time_evo_model == 'doppler':
+            return None
+
+        keys = [self._geo_key(tx_node, rx_node) for tx_node, rx_node in lnk_pairs]
+        if not all(key in self.geo_cache for key in keys):
+            return None
+
+        for key in keys:
+            self.geo_cache.move_to_end(key)
+        self.geo_cache_hits += len(keys)
+        if self.VERBOSE:
+            print(f'Geometry cache hit for #links: {len(keys)}, total: {self.geo_cache_hits}')
+        return [self.geo_cache[key] for key in keys]
+
+
+    def _geo_cache_put(self, lnk_pairs: list, lnk_results: list):
+        '''
+        Store traced static links; the least recently used ones are evicted. A link with a
+        mobile node is never looked up again at the same quantized geometry and is not stored.
+        :param lnk_pairs: list of (tx node, rx node)
+        :param lnk_results: list of (link propagation delay, wideband loss, normalized CFR, normalized CFR per additional band)
+        '''
+        if self.geo_cache_size == 0 or self.time_evo_model == 'doppler':
+            return
+
+        for (tx_node, rx_node), lnk_result in zip(lnk_pairs, lnk_results):
+            if not self._is_static_link(tx_node, rx_node):
+                continue
+            key = self._geo_key(tx_node, rx_node)
+            self.geo_cache[key] = lnk_result
+            self.geo_cache.move_to_end(key)
+
+        while len(self.geo_cache) > self.geo_cache_size:
+            self.geo_cache.popitem(last=False)
+
+
+    def _is_static_link(self, tx_node, rx_node):
+        # neither node will ever move
+        return isinstance(self.node_info[tx_node], ConstantMobility) and isinstance(self.node_info[rx_node], ConstantMobility)
+
+
+    def _postprocess_links(self, lnk_tau, lnk_h):
+        '''
+        Compute propagation delay, wideband loss and normalized CFR of several links at once
+        :param lnk_tau: path delays, first dimension are the links
+        :param lnk_h: raw CFR, first dimension are the links
+        :return: (link propagation delays [num_links], wideband losses [num_links], normalized CFRs [num_links, num_subcarriers])
+        '''
+        t_start = time.perf_counter_ns()
+        num_links = lnk_tau.shape[0]
+
+        # shortest valid path; invalid paths have negative delays
+        lnk_tau = lnk_tau.reshape(num_links, -1)
+        lnk_delay = np.rint(np.min(np.where(lnk_tau >= 0, lnk_tau, np.inf), axis=1) * 1e9).astype(np.int64)
+
+        # antenna arrays: delay and loss are those of the first antenna pair like for a single antenna
+        h = self._first_antenna_pair(lnk_h).reshape(num_links, -1)
+
+        # see Parseval's theorem; for frequency-selective channel
+        power = np.mean(np.abs(h) ** 2, axis=1)
+        lnk_loss = -10 * np.log10(power)
+
+        h_normalized = h / np.sqrt(power)[:, np.newaxis]
+
+        # plausibility test
+        if self.CHECKS_ENABLED:
+            power_normalized = np.mean(np.abs(h_normalized) ** 2, axis=1)
+            assert np.allclose(power_normalized, 1.0, rtol=1e-3, atol=0)   # Should be close to 1
+
+        self._add_timing('postprocess', t_start)
+        return lnk_delay, lnk_loss, h_normalized
+
+
+    def _postprocess_paths(self, lnk_a, lnk_tau, lnk_doppler, lnk_loss):
+        '''
+        Extract the valid propagation paths of several links at once for the time evolution model 'doppler'
+        :param lnk_a: complex path gains, first dimension are the links
+        :param lnk_tau: path delays, first dimension are the links
+        :param lnk_doppler: Doppler shifts of the paths, first dimension are the links
+        :param lnk_loss: wideband losses [num_links] as returned by _postprocess_links
+        :return: list of (gains normalized like the CFR, delays relative to the shortest path in ns,
+            Doppler shifts in Hz) per link
+        '''
+        t_start = time.perf_counter_ns()
+        num_links = lnk_tau.shape[0]
+
+        a = lnk_a.reshape(num_links, -1)
+        tau = lnk_tau.reshape(num_links, -1)
+        nu = lnk_doppler.reshape(num_links, -1)
+
+        # invalid paths have negative delays
+        valid = (tau >= 0) & (np.abs(a) > 0)
+        tau_min = np.min(np.where(valid, tau, np.inf), axis=1, keepdims=True)
+        delay_ns = (tau - np.where(np.isfinite(tau_min), tau_min, 0.0)) * 1e9
+        # the same normalization as of the CFR at the traced time
+        gain = a / np.sqrt(10 ** (-np.asarray(lnk_loss) / 10))[:, np.newaxis]
+
+        lnk_paths = [(gain[i, valid[i]], delay_ns[i, valid[i]], nu[i, valid[i]]) for i in range(num_links)]
+        self._add_timing('postprocess', t_start)
+        return lnk_paths
+
+
+    def _postprocess_bands(self, lnk_h_bands):
+        '''
+        Normalize the CFRs of the additional bands of several links at once. Each band is normalized to
+        its own mean power; propagation delay and wideband loss are those of the primary band.
+        :param lnk_h_bands: raw CFR per additional band, first dimension are the links
+        :return: normalized CFRs [num_links, num_subcarriers] per additional band
+        '''
+        t_start = time.perf_counter_ns()
+        h_bands = []
+        for lnk_h in lnk_h_bands:
+            h = self._first_antenna_pair(lnk_h).reshape(lnk_h.shape[0], -1)
+            power = np.mean(np.abs(h) ** 2, axis=1)
+            h_bands.append(h / np.sqrt(np.where(power > 0, power, 1.0))[:, np.newaxis])
+        self._add_timing('postprocess', t_start)
+        return h_bands
+
+
+    def _first_antenna_pair(self, lnk_h):
+        # [num_links, num_rx_ant, num_tx_ant, ...] -> [num_links, ...]; as is for a single antenna
+        return lnk_h[:, 0, 0] if self.num_antennas > 1 else lnk_h
+
+
+    def _postprocess_mimo(self, lnk_h, lnk_loss):
+        '''
+        CFRs between all antenna pairs of several links at once, normalized like the CFR of the first
+        antenna pair such that the beamforming gain is kept
+        :param lnk_h: raw CFR [num_links, num_rx_ant, num_tx_ant, num_ofdm_symbols, num_subcarriers]
+        :param lnk_loss: wideband losses [num_links] as returned by _postprocess_links
+        :return: normalized CFRs [num_links, num_subcarriers, num_rx_ant, num_tx_ant]; None for a single antenna
+        '''
+        if self.num_antennas == 1:
+            return None
+        t_start = time.perf_counter_ns()
+        # per subcarrier a contiguous channel matrix
+        h = np.transpose(lnk_h[:, :, :, 0, :], (0, 3, 1, 2))
+        h_mimo = h / np.sqrt(10 ** (-np.asarray(lnk_loss) / 10))[:, np.newaxis, np.newaxis, np.newaxis]
+        self._add_timing('postprocess', t_start)
+        return h_mimo
+
+
+    def _stack_link_results(self, lnk_results: list):
+        '''
+        :param lnk_results: list of (link propagation delay, wideband loss, normalized CFR, normalized CFR per
+            additional band, normalized CFR per antenna pair or None), e.g. from the geometry cache
+        :return: the same as arrays over the links as returned by _postprocess_links, _postprocess_bands and
+            _postprocess_mimo
+        '''
+        return (np.asarray([lnk_result[0] for lnk_result in lnk_results]),
+                np.asarray([lnk_result[1] for lnk_result in lnk_results]),
+                np.stack([lnk_result[2] for lnk_result in lnk_results]),
+                [np.stack([lnk_result[3][band] for lnk_result in lnk_results]) for band in range(len(self.band_fc))],
+                None if lnk_results[0][4] is None else np.stack([lnk_result[4] for lnk_result in lnk_results]))
+
+
+    def _unstack_link_results(self, lnk_delay, lnk_loss, h_normalized, lnk_h_bands, lnk_h_mimo=None):
+        '''
+        Inverse of _stack_link_results
+        :return: list of (link propagation delay, wideband loss, normalized CFR, normalized CFR per additional band,
+            normalized CFR per antenna pair or None)
+        '''
+        return [(lnk_delay[i], lnk_loss[i], h_normalized[i], [h_band[i] for h_band in lnk_h_bands],
+                 None if lnk_h_mimo is None else lnk_h_mimo[i])
+                for i in range(len(lnk_delay))]
+
+
+    def _pack_csi(self, h_normalized):
+        '''
+        Encode the normalized CFRs of several links at once using the configured packed wire format
+        :param h_normalized: normalized CFRs [num_links, num_subcarriers]
+        :return: list of (packed CSI, quantization step or None) per link; None for CSI_REPEATED_DOUBLE
+        '''
+        if self.csi_encoding == message_pb2.CSI_REPEATED_DOUBLE:
+            return None
+
+        t_start = time.perf_counter_ns()
+        # interleaved I/Q
+        num_links = h_normalized.shape[0]
+        iq = np.empty((num_links, 2 * h_normalized.shape[1]), dtype=np.float64)
+        iq[:, 0::2] = np.real(h_normalized)
+        iq[:, 1::2] = np.imag(h_normalized)
+
+        scale = None
+        if self.csi_encoding == message_pb2.CSI_FLOAT32:
+            packed = iq.astype('<f4')
+        elif self.csi_encoding == message_pb2.CSI_FLOAT16:
+            packed = iq.astype('<f2')
+        elif self.csi_encoding == message_pb2.CSI_INT16:
+            max_abs = np.max(np.abs(iq), axis=1)
+            scale = np.where(max_abs > 0, max_abs / np.iinfo(np.int16).max, 1.0)
+            packed = np.round(iq / scale[:, np.newaxis]).astype('<i2')
+        else:
+            raise ValueError(f'Unknown CSI encoding: {self.csi_encoding}')
+
+        packed_csi = [(packed[i].tobytes(), None if scale is None else float(scale[i])) for i in range(num_links)]
+        self._add_timing('fill', t_start)
+        return packed_csi
+
+
+    def _fill_csi(self, rx_node_info, h_normalized, packed_csi=None):
+        '''
+        Fill the CFR of a single link into the response using the configured wire format
+        :param rx_node_info: the RxNodeInfo of the response
+        :param h_normalized: the normalized CFR
+        :param packed_csi: the CFR already encoded by _pack_csi; optional
+        '''
+        t_start = time.perf_counter_ns()
+        try:
+            if self.csi_encoding == message_pb2.CSI_REPEATED_DOUBLE:
+                if self.csi_subcarriers is None:
+                    rx_node_info.frequencies.extend(self.frequencies.tolist())
+                rx_node_info.csi_imag.extend(np.imag(h_normalized).tolist())
+                rx_node_info.csi_real.extend(np.real(h_normalized).tolist())
+                return
+
+            if packed_csi is None:
+                packed_csi = self._pack_csi(np.reshape(h_normalized, (1, -1)))[0]
+                # the packing is accounted by _pack_csi
+                t_start = time.perf_counter_ns()
+            packed, scale = packed_csi
+            if scale is not None:
+                rx_node_info.csi_scale = scale
+
+            if self.shm is not None:
+                offset = self.shm.write(packed)
+                if offset is not None:
+                    rx_node_info.csi_shm_offset = offset
+                    rx_node_info.csi_shm_size = len(packed)
+                    return
+                # ring buffer full as ns3 has not yet consumed older payloads
+
+            rx_node_info.csi_packed = packed
+        finally:
+            self._add_timing('fill', t_start)
+
+
+    def _fill_band_csi(self, rx_node_info, lnk_h_bands, packed_bands, lnk_idx):
+        '''
+        Fill the CFRs of the additional bands of a single link into the response using the configured wire format;
+        the ring buffer is used for the primary band only
+        :param rx_node_info: the RxNodeInfo of the response
+        :param lnk_h_bands: normalized CFRs per additional band as returned by _postprocess_bands
+        :param packed_bands: the same encoded by _pack_csi per band
+        :param lnk_idx: the link within lnk_h_bands
+        '''
+        t_start = time.perf_counter_ns()
+        for band, h_band in enumerate(lnk_h_bands):
+            band_csi = rx_node_info.band_csi.add()
+            if packed_bands[band] is None:
+                band_csi.csi_real.extend(np.real(h_band[lnk_idx]).tolist())
+                band_csi.csi_imag.extend(np.imag(h_band[lnk_idx]).tolist())
+                continue
+            packed, scale = packed_bands[band][lnk_idx]
+            band_csi.csi_packed = packed
+            if scale is not None:
+                band_csi.csi_scale = scale
+        self._add_timing('fill', t_start)
+
+
+    def _pack_mimo_csi(self, lnk_h_mimo):
+        # see _pack_csi; None for a single antenna
+        if lnk_h_mimo is None:
+            return None
+        return self._pack_csi(lnk_h_mimo.reshape(lnk_h_mimo.shape[0], -1))
+
+
+    def _fill_mimo_csi(self, rx_node_info, lnk_h_mimo, packed_mimo, lnk_idx):
+        '''
+        Fill the CFRs of all antenna pairs of a single link into the response using the configured wire format
+        :param rx_node_info: the RxNodeInfo of the response
+        :param lnk_h_mimo: normalized CFRs per antenna pair as returned by _postprocess_mimo; None for a single antenna
+        :param packed_mimo: the same encoded by _pack_mimo_csi
+        :param lnk_idx: the link within lnk_h_mimo
+        '''
+        if lnk_h_mimo is None:
+            return
+        t_start = time.perf_counter_ns()
+        if packed_mimo is None:
+            h = lnk_h_mimo[lnk_idx].reshape(-1)
+            rx_node_info.mimo_csi_real.extend(np.real(h).tolist())
+            rx_node_info.mimo_csi_imag.extend(np.imag(h).tolist())
+        else:
+            packed, scale = packed_mimo[lnk_idx]
+            rx_node_info.mimo_csi_packed = packed
+            if scale is not None:
+                rx_node_info.mimo_csi_scale = scale
+        self._add_timing('fill', t_start)
+
+
+    def _fill_paths(self, rx_node_info, lnk_path):
+        '''
+        Fill the propagation paths of a single link into the response; ns3 synthesizes the CFR from them
+        :param rx_node_info: the RxNodeInfo of the response
+        :param lnk_path: (normalized gains, delays in ns, Doppler shifts in Hz) as returned by _postprocess_paths
+        '''
+        t_start = time.perf_counter_ns()
+        gain, delay_ns, doppler = lnk_path
+        if self.csi_encoding == message_pb2.CSI_REPEATED_DOUBLE and self.csi_subcarriers is None:
+            # otherwise sent once in the SimAck
+            rx_node_info.frequencies.extend(self.frequencies.tolist())
+        rx_node_info.path_gain_real.extend(np.real(gain).tolist())
+        rx_node_info.path_gain_imag.extend(np.imag(gain).tolist())
+        rx_node_info.path_delay.extend(delay_ns.tolist())
+        rx_node_info.path_doppler.extend(doppler.tolist())
+        self._add_timing('fill', t_start)
+
+
+    def _add_timing(self, stage, t_start):
+        self.timing[stage] += time.perf_counter_ns() - t_start
+
+
+    def _reset_timing(self):
+        self.timing = dict.fromkeys(SionnaEnv.TIMING_STAGES, 0)
+
+
+    def _set_timing(self, csi_response):
+        '''
+        Report the time spent on the current request to ns3
+        :param csi_response: the ChannelStateResponse
+        '''
+        csi_response.timing.trace_ns = self.timing['trace']
+        csi_response.timing.postprocess_ns = self.timing['postprocess']
+        csi_response.timing.fill_ns = self.timing['fill']
+        # the serialization of this response is not yet done
+        csi_response.timing.serialize_ns = self.last_serialize_ns
+
+
+    def _release_shm(self):
+        if self.shm is not None:
+            self.shm.release()
+            self.shm = None
+
+
     def _walk(self, node_id, dt):
         """
         Move the given node to the given time interval.
@@ -551,33 +1268,83 @@ class SionnaEnv:
 
         # update node pos & velocity
         self.node_info[node_id].update_pos(self.sim_time + init_dt, next_pos, velocity, False)
+        if self.rx_grid is not None:
+            self.rx_grid.update(node_id, next_pos)
         # check if new velocity must be set
         self.node_info[node_id].check_set_new_velocity(self.sim_time + init_dt, distance)
 
 
+    def _select_p2mp_receivers(self, tx_node, rx_node=None):
+        '''
+        Select the receivers of a P2MP request at the current node positions
+        :param tx_node: the transmitter node id
+        :param rx_node: the requested receiver which is always included; optional
+        :return: list of receiver node ids in the order of node_info
+        '''
+        if self.rx_grid is None:
+            return [node_id for node_id in self.node_info if node_id != tx_node]
+
+        in_range = self.rx_grid.query(self.node_info[tx_node].pos, self.p2mp_radius)
+        return [node_id for node_id in self.node_info
+                if node_id != tx_node and (node_id in in_range or node_id == rx_node)]
+
+
     def _place_tx_rx_node(self, tx_node: int, rx_nodes: list):
         '''
         Place the given nodes in the scenario
         :param tx_node: the transmitting node
         :param rx_nodes: the receiver nodes
         '''
+        self._place_tx_rx_nodes([tx_node], rx_nodes)
+
+
+    def _place_tx_rx_nodes(self, tx_nodes: list, rx_nodes: list):
+        '''
+        Place several transmitters and the given receivers in the scenario
+        :param tx_nodes: the transmitting nodes
+        :param rx_nodes: the receiver nodes
+        '''
+
+        tx_devices = [("tx" + str(tx_node_i), self.node_info[tx_node_i].pos) for tx_node_i in tx_nodes]
+        rx_devices = [("rx" + str(rx_node_i), self.node_info[rx_node_i].pos) for rx_node_i in rx_nodes]
+
+        self._place_radio_devices(tx_devices, rx_devices)
+
+        if self.time_evo_model == 'doppler':
+            # the Doppler shift of each path follows from the velocities of the radio devices
+            for name, node_id in [("tx" + str(n), n) for n in tx_nodes] + [("rx" + str(n), n) for n in rx_nodes]:
+                self.scene.get(name).velocity = mi.Vector3f(*map(float, self.node_info[node_id].velocity))
+
+
+    def _place_radio_devices(self, tx_devices: list, rx_devices: list):
+        '''
+        Place the given transmitters and receivers in the scene. If the same devices are already
+        placed only their positions are updated; otherwise all devices are re-created.
+        :param tx_devices: list of (name, position) of the transmitters
+        :param rx_devices: list of (name, position) of the receivers
+        '''
+
+        device_names = [name for name, _ in tx_devices] + [name for name, _ in rx_devices]
+
+        if device_names == self.placed_radio_node_names:
+            # same node set: only move the devices; the order of the receivers is kept
+            for name, pos in tx_devices + rx_devices:
+                self.scene.get(name).position = pos
+            return
 
         # remove old tx and rx nodes
         for placed_node in self.placed_radio_node_names:
             self.scene.remove(placed_node)
         self.placed_radio_node_names.clear()
 
-        # Create transmitter
-        tx_pos = self.node_info[tx_node].pos
-        tx_node_name = "tx"
-        tx = Transmitter(name=tx_node_name, position=tx_pos, orientation=[0, -180, 0], display_radius=self.disp_r)
-        self.scene.add(tx)
-        self.placed_radio_node_names.append(tx_node_name)
+        # Create transmitter(s)
+        for tx_node_name, tx_pos in tx_devices:
+            tx = Transmitter(name=tx_node_name, position=tx_pos, orientation=[0, -180, 0], display_radius=self.disp_r)
+            self.scene.add(tx)
+            self.placed_radio_node_names.append(tx_node_name)
 
         # Create a receiver(s)
-        for rx_node_i in rx_nodes:
-            rx_node_name = "rx" + str(rx_node_i)
-            rx_pos = self.node_info[rx_node_i].pos
+        for rx_node_name, rx_pos in rx_devices:
             rx = Receiver(name=rx_node_name, position=rx_pos, orientation=[0, -180, 0], display_radius=self.disp_r)
             self.scene.add(rx)
             self.placed_radio_node_names.append(rx_node_name)
@@ -589,7 +1356,10 @@ class SionnaEnv:
         :param req_sim_time: current simulation time
         :param tx_node: the transmitter node id
         :param rx_node: the receiver node id
-        :return: (list(rx_node), list(link propagation delay), list(wideband loss), list(normalized CFR))
+        :return: (list(rx_node), link propagation delays, wideband losses, normalized CFRs, link paths, normalized CFRs
+            per additional band, normalized CFRs per antenna pair) as arrays over the receivers; link paths as returned
+            by _postprocess_paths with time evolution model 'doppler', otherwise None; CFRs per antenna pair as
+            returned by _postprocess_mimo
         '''
 
         # execute mobility
@@ -608,78 +1378,48 @@ class SionnaEnv:
         # update time
         self.sim_time = req_sim_time
 
-        # place TX and RX
-        rx_nodes = nodes_to_update
-        rx_nodes.remove(tx_node)
-        self._place_tx_rx_node(tx_node, rx_nodes)
-
-        # create pathsolver; todo: check reuse
-        p_solver  = PathSolver()
-
-        # Compute propagation paths
-        paths = p_solver(scene=self.scene,
-                         max_depth=self.rt_max_depth,
-                         samples_per_src=self.rt_samples_per_src,
-                         los=self.rt_los,
-                         specular_reflection=self.rt_specular_reflection,  # Can rays bounce off surfaces?
-                         diffuse_reflection=self.rt_diffuse_reflection,
-                         refraction=self.rt_refraction,  # Can rays pass through materials?
-                         synthetic_array=self.rt_synthetic_array,
-                         diffraction=self.rt_diffraction,  # costly
-                         edge_diffraction=self.rt_edge_diffraction,  # rays that bend around edges
-                         diffraction_lit_region=self.rt_diffraction_lit_region)  # higher physical accuracy
-
-        # AZU: sampling_frequency is only used if num_time_steps > 1
-        # a: shape [num_rx, num_rx_ant, num_tx, num_tx_ant, num_paths, num_time_steps],
-        a, tau = paths.cir(sampling_frequency=1e9, normalize_delays=False, out_type="numpy")
-
-        # shape: [num_rx, num_rx_ant, num_tx, num_tx_ant, num_ofdm_symbols, num_subcarriers]
-        h_raw = paths.cfr(frequencies=self.frequencies,
-                  sampling_frequency=1.0,  # not used
-                  num_time_steps=1,
-                  normalize_delays=True,
-                  # If set to True, path delays are normalized such that the first path between any pair of
-                  # antennas of a transmitter and receiver arrives at tau=0
-                  normalize=False,  # Normalize energy
-                  out_type="numpy")
-
-        lnk_delay_arr = []
-        lnk_loss_arr = []
-        h_normalized_arr = []
-
-        for rx_id, curr_rx_node in enumerate(rx_nodes):
-            lnk_tau = np.squeeze(tau[rx_id, :, :, :, :])
-            lnk_delay = int(round(np.min(lnk_tau[lnk_tau >= 0] * 1e9), 0))
-
-            h = np.squeeze(h_raw[rx_id, :, :, :, :, ])
-
-            # see Parseval's theorem
-            lnk_loss = float(-10 * np.log10(np.mean(np.abs(h) ** 2)))
-
-            # for frequency-selective channel
-            power = np.mean(np.abs(h) ** 2)  # shape [batch_size, 1, 1, 1]
-
-            h_normalized = h / np.sqrt(power)
+        if req_mode == SionnaEnv.MODE_P2P:
+            rx_nodes = [rx_node]
+        else:
+            rx_nodes = self._select_p2mp_receivers(tx_node, rx_node)
+
+        lnk_pairs = [(tx_node, curr_rx_node) for curr_rx_node in rx_nodes]
+        lnk_results = self._geo_cache_get(lnk_pairs)
+        lnk_paths = None
+        if lnk_results is None:
+            # place TX and RX
+            self._place_tx_rx_node(tx_node, rx_nodes)
+
+            # Compute propagation paths
+            tau, h_raw, cir, h_bands = self._compute_paths()
+
+            lnk_delay, lnk_loss, h_normalized = self._postprocess_links(tau[:len(rx_nodes), :, 0, :, :],
+                                                                        h_raw[:len(rx_nodes), :, 0, :, :, :])
+            lnk_h_bands = self._postprocess_bands([h_band[:len(rx_nodes), :, 0, :, :, :] for h_band in h_bands])
+            lnk_h_mimo = self._postprocess_mimo(h_raw[:len(rx_nodes), :, 0, :, :, :], lnk_loss)
+            if cir is not None:
+                lnk_paths = self._postprocess_paths(cir[0][:len(rx_nodes), :, 0, :, :], tau[:len(rx_nodes), :, 0, :, :],
+                                                    cir[1][:len(rx_nodes), :, 0, :, :], lnk_loss)
+            self._geo_cache_put(lnk_pairs, self._unstack_link_results(lnk_delay, lnk_loss, h_normalized, lnk_h_bands,
+                                                                      lnk_h_mimo))
+        else:
+            lnk_delay, lnk_loss, h_normalized, lnk_h_bands, lnk_h_mimo = self._stack_link_results(lnk_results)
 
-            # plausibility test
-            if self.CHECKS_ENABLED:
-                power_normalized = np.mean(np.abs(h_normalized) ** 2)
-                assert math.isclose(power_normalized, 1.0, rel_tol=1e-3)   # Should be close to 1
+        if self.VERBOSE:
+            for idx in range(len(rx_nodes)):
+                print(f'{self.sim_time/1e9}s: lnk_delay = {lnk_delay[idx]}ns, wb_loss = {lnk_loss[idx]:.3f}dB, CFR shape: {h_normalized[idx].shape}')
 
-            if self.VERBOSE:
-                print(f'{self.sim_time/1e9}s: lnk_delay = {lnk_delay}ns, wb_loss = {lnk_loss:.3f}dB, CFR shape: {h_normalized.shape}')
+        return rx_nodes, lnk_delay, lnk_loss, h_normalized, lnk_paths, lnk_h_bands, lnk_h_mimo
 
-            lnk_delay_arr.append(lnk_delay)
-            lnk_loss_arr.append(lnk_loss)
-            h_normalized_arr.append(h_normalized)
 
-        return rx_nodes, lnk_delay_arr, lnk_loss_arr, h_normalized_arr
+    def _get_mobility_history(self, node_id):
+        return self.node_info[node_id].history.items()
 
 
-    def _get_mobility_history(self, node_id):
-        ts = sorted(self.node_info[node_id].pos_history.keys())
-        pos = [self.node_info[node_id].pos_history[t] for t in ts]
-        return ts, pos
+    def _prune_mobility_history(self):
+        # requests never go back in time; positions before the current time are not looked up anymore
+        for node in self.node_info.values():
+            node.history.prune(self.sim_time)
 
 
     def _init_mobility(self, sim_init_msg):
@@ -688,7 +1428,8 @@ class SionnaEnv:
             if (node_info.HasField("constant_position_model")):
                 # fixed position; no mobility
                 pos = node_info.constant_position_model.position
-                self.node_info[node_info.id] = ConstantMobility(node_info.id, [pos.x, pos.y, pos.z])
+                self.node_info[node_info.id] = ConstantMobility(node_info.id, [pos.x, pos.y, pos.z],
+                                                                full_history=self.full_mobility_history)
             elif (node_info.HasField("random_walk_model")):
                 # mobile scenario
                 random_walk_model = node_info.random_walk_model
@@ -731,82 +1472,139 @@ class SionnaEnv:
 
                 self.node_info[node_info.id] = RandomWalkMobility(node_info.id, [pos.x, pos.y, pos.z],
                                                                   mode, mode_params, speed, speed_params,
-                                                                  direction, direction_params)
+                                                                  direction, direction_params,
+                                                                  full_history=self.full_mobility_history)
+
+
+    def handle_message(self, ns3_msg):
+        '''
+        Handles a single message received from the ns3 simulator
+        :param ns3_msg: the received message
+        :return: (reply message, whether to terminate)
+        '''
+
+        # Prepare reply message
+        resp_msg = message_pb2.Wrapper()
+        do_terminate = False
+
+        # Fill the reply message
+        if ns3_msg.HasField("sim_init_msg"):
+            # handle SimInitMessage & send ACK
+            successful, error_msg = self.init_simulation_env(ns3_msg.sim_init_msg)
+            resp_msg.sim_ack.no_error = successful
+            resp_msg.sim_ack.error_msg = error_msg
+            resp_msg.sim_ack.SetInParent()
+
+            if successful and (self.csi_encoding != message_pb2.CSI_REPEATED_DOUBLE or self.csi_subcarriers is not None):
+                # the frequency grid is the same for all links; sent only once
+                resp_msg.sim_ack.frequencies.extend(self.frequencies.tolist())
+
+            if successful:
+                # always sent once; the bands' CSI never carries its frequencies
+                for band_frequencies in self.band_frequencies:
+                    resp_msg.sim_ack.band_frequencies.add().frequencies.extend(band_frequencies.tolist())
+
+            if successful:
+                print("Sionna server init sucessful ...")
+            else:
+                print("Sionna server init failed ...")
+                do_terminate = True
+
+        elif ns3_msg.HasField("channel_state_request"):
+            # handle ChannelStateRequest by sending ChannelStateResponse
+            if self.shm is not None:
+                self.shm.set_consumed(ns3_msg.channel_state_request.shm_consumed)
+            start_time = time.time()
+            self._reset_timing()
+            num_csi_req = self.compute_cfr(ns3_msg.channel_state_request, resp_msg)
+            self._set_timing(resp_msg.channel_state_response)
+            self.total_num_csi_samples += num_csi_req
+            self.last_call_times.append(time.time() - start_time)
+            self.metrics.add_request(False, num_csi_req, self.timing, int((time.time() - start_time) * 1e9))
+
+            if self.total_num_csi_samples % 1000 == 0: # every 1k make printout
+                print(f'Total no. computed CSI samples: {millify(self.total_num_csi_samples)}')
+
+            if self.VERBOSE:
+                avg_call_time = sum(self.last_call_times) / len(self.last_call_times)
+                print("t=%.9fs: average event processing time: %.2f sec"
+                      % (ns3_msg.channel_state_request.time/1e9, avg_call_time))
+                # show GPU load
+                if len(self.gpus) > 0:
+                    GPUtil.showUtilization()
+
+        elif ns3_msg.HasField("batch_channel_state_request"):
+            # handle BatchChannelStateRequest by sending a single ChannelStateResponse
+            if self.shm is not None:
+                self.shm.set_consumed(ns3_msg.batch_channel_state_request.shm_consumed)
+            start_time = time.time()
+            self._reset_timing()
+            num_csi_req = self.compute_cfr_batch(ns3_msg.batch_channel_state_request, resp_msg)
+            self._set_timing(resp_msg.channel_state_response)
+            self.total_num_csi_samples += num_csi_req
+            self.last_call_times.append(time.time() - start_time)
+            self.metrics.add_request(True, num_csi_req, self.timing, int((time.time() - start_time) * 1e9))
+
+        elif ns3_msg.HasField("sim_close_request"):
+            do_terminate = True
+            resp_msg.sim_ack.SetInParent()
+
+        return resp_msg, do_terminate
 
 
     def run(self):
         '''
-        Handles communication with the ns3 simulator using ZMQ socket
+        Handles communication with the ns3 simulator using ZMQ socket. A ROUTER socket is used so
+        that the client may either use a REQ socket (lock-step) or a DEALER socket (prefetching with
+        several requests in flight). Requests are answered in the order they were received.
         '''
 
         context = zmq.Context()
-        socket = zmq.Socket(context, zmq.REP)
-        socket.bind("tcp://*:5555")
+        socket = zmq.Socket(context, zmq.ROUTER)
+        socket.bind(self.zmq_url)
 
-        print("Sionna server socket ready ...")
+        print(f"Sionna server socket ready on {self.zmq_url} ...")
 
-        last_call_times = deque(maxlen=10)
-        total_num_csi_samples = 0
+        self.last_call_times = deque(maxlen=10)
+        self.total_num_csi_samples = 0
 
         do_terminate = False
         while not do_terminate:
-            # Receive message from ns3 simulator
-            ns3_msg_str = socket.recv()
+            # Receive message from ns3 simulator: [identity, empty delimiter, payload]
+            frames = socket.recv_multipart()
+            envelope, ns3_msg_str = frames[:-1], frames[-1]
 
             # Deserialize received message
             ns3_msg = message_pb2.Wrapper()
             ns3_msg.ParseFromString(ns3_msg_str)
 
-            # Prepare reply message
-            resp_msg = message_pb2.Wrapper()
-
-            # Fill the reply message
-            if ns3_msg.HasField("sim_init_msg"):
-                # handle SimInitMessage & send ACK
-                successful, error_msg = self.init_simulation_env(ns3_msg.sim_init_msg)
-                resp_msg.sim_ack.no_error = successful
-                resp_msg.sim_ack.error_msg = error_msg
-                resp_msg.sim_ack.SetInParent()
-
-                if successful:
-                    print("Sionna server init sucessful ...")
-                else:
-                    print("Sionna server init failed ...")
-                    do_terminate = True
-
-            elif ns3_msg.HasField("channel_state_request"):
-                # handle ChannelStateRequest by sending ChannelStateResponse
-                start_time = time.time()
-                num_csi_req = self.compute_cfr(ns3_msg.channel_state_request, resp_msg)
-                total_num_csi_samples += num_csi_req
-                last_call_times.append(time.time() - start_time)
-
-                if total_num_csi_samples % 1000 == 0: # every 1k make printout
-                    print(f'Total no. computed CSI samples: {millify(total_num_csi_samples)}')
-
-                if self.VERBOSE:
-                    avg_call_time = sum(last_call_times) / len(last_call_times)
-                    print("t=%.9fs: average event processing time: %.2f sec"
-                          % (ns3_msg.channel_state_request.time/1e9, avg_call_time))
-                    # show GPU load
-                    if len(self.gpus) > 0:
-                        GPUtil.showUtilization()
-
-            elif ns3_msg.HasField("sim_close_request"):
-                do_terminate = True
-                resp_msg.sim_ack.SetInParent()
+            resp_msg, do_terminate = self.handle_message(ns3_msg)
 
             # Serialize and send the reply message
-            socket.send(resp_msg.SerializeToString())
+            t_start = time.perf_counter_ns()
+            resp_msg_str = resp_msg.SerializeToString()
+            self.last_serialize_ns = time.perf_counter_ns() - t_start
+            socket.send_multipart(envelope + [resp_msg_str])
+
+            self.metrics.time_ns['serialize'] = self.metrics.time_ns.get('serialize', 0) + self.last_serialize_ns
+            self.metrics.add_io(len(ns3_msg_str), len(resp_msg_str))
+            self.metrics.write(self._metrics_extra(), force=do_terminate)
 
         socket.close()
-        print("Computed no. CSI samples: %d" % total_num_csi_samples)
+        self._release_shm()
+        print("Computed no. CSI samples: %d" % self.total_num_csi_samples)
         print("Sionna server socket closed.")
 
 
+    def _metrics_extra(self):
+        return {'geo_cache_hits': self.geo_cache_hits, 'geo_cache_size': len(self.geo_cache),
+                'scene_loads': self.scene_pool.loads}
+
+
     def release(self):
-        # delete / release the scene before loading a new one
-        del self.scene
+        # delete / release the scene before loading a new one; kept if still referenced by the pool
+        self.scene = None
+        self.scene_fpath = None
         gc.collect()  # force garbage collection
 
 
@@ -819,15 +1617,34 @@ if __name__ == '__main__':
     parser.add_argument("--rt_max_parallel_links", type=int, default=256, help="Max no. of link simulated at once; depends on GPU memory")
     parser.add_argument("--est_csi", help="Whether to estimate complex CSI per OFDM subcarrier", type=bool, default=True)
     parser.add_argument("--verbose", help="Whether to run in verbose mode", action='store_true')
+    parser.add_argument("--zmq_url", type=str, default="tcp://*:5555", help="ZMQ address to bind to, e.g. ipc:///tmp/ns3sionna")
+    parser.add_argument("--geo_cache_size", type=int, default=4096,
+                        help="Max no. of traced static links kept for unchanged geometry; 0 disables it. "
+                             "Each link holds 16 B per subcarrier of each band and antenna pair")
+    parser.add_argument("--metrics_file", type=str, default=None, help="JSON file the server counters are written to periodically")
+    parser.add_argument("--full_mobility_history", help="Keep the whole mobility history of all nodes (debugging)", action='store_true')
+    parser.add_argument("--metrics_interval", type=float, default=10.0, help="Min. time in s between two writes of the metrics file")
+    parser.add_argument("--doppler_max_distance", type=float, default=0.25, help="Time evolution doppler: max. displacement in m of a node until a link is retraced")
+    parser.add_argument("--preload_scenes", type=str, nargs='*', default=[], help="Scene files (relative to model_folder) loaded at startup, warmed up and kept for all jobs")
     args = parser.parse_args()
 
     print("ns3sionna v1.0")
+    # kept across jobs; a job in a pinned or the previous scene does not load it again
+    scene_pool = ScenePool(args.model_folder, args.preload_scenes)
+    warm_up = len(args.preload_scenes) > 0
     while True:
-        print("Using config: model_folder=%s, single_run=%s, mode=%d, rt_fast=%s, rt_max_parallel_links=%d, est_csi=%r"
-              % (args.model_folder, args.single_run, args.default_mode, args.rt_fast, args.rt_max_parallel_links, args.est_csi))
+        print("Using config: model_folder=%s, single_run=%s, mode=%d, rt_fast=%s, rt_max_parallel_links=%d, est_csi=%r, zmq_url=%s"
+              % (args.model_folder, args.single_run, args.default_mode, args.rt_fast, args.rt_max_parallel_links, args.est_csi,
+                 args.zmq_url))
         print("Waiting for new job ...")
         env = SionnaEnv(args.model_folder, args.rt_fast, args.default_mode, args.rt_max_parallel_links,
-                        args.est_csi, VERBOSE=args.verbose)
+                        args.est_csi, VERBOSE=args.verbose, zmq_url=args.zmq_url, geo_cache_size=args.geo_cache_size,
+                        metrics_fname=args.metrics_file, metrics_interval=args.metrics_interval,
+                        full_mobility_history=args.full_mobility_history,
+                        doppler_max_distance=args.doppler_max_distance, scene_pool=scene_pool)
+        if warm_up:
+            env.warm_up()
+            warm_up = False
         env.run()
 
         if args.single_run:
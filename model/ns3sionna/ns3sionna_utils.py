@@ -137,6 +137,49 @@ def coherence_from_velocities(v_tx, v_rx, f_c,
     return int(T_c_worst * 1e9)
 
 
+def coherence_from_velocities_batch(v_tx, v_rx, f_c, pos_tx, pos_rx):
+    """
+    Vectorized LOS variant of coherence_from_velocities for N links
+    v_tx, v_rx : arrays (N,3) or (3,) velocities in m/s
+    f_c        : carrier freq (Hz)
+    pos_tx,pos_rx : arrays (N,3) or (3,) positions defining the LOS direction
+    Returns array (N,) of T_c in ns; MAX_COHERENCE_TIME for links without radial motion.
+    """
+    v_rel = np.atleast_2d(np.asarray(v_rx, dtype=float) - np.asarray(v_tx, dtype=float))
+    vec = np.atleast_2d(np.asarray(pos_rx, dtype=float) - np.asarray(pos_tx, dtype=float))
+    v_rel, vec = np.broadcast_arrays(v_rel, vec)
+
+    norms = np.linalg.norm(vec, axis=1)
+    v_rel_norm = np.linalg.norm(v_rel, axis=1)
+    # coinciding positions: worst-case direction parallel to v_rel
+    v_rad_abs = np.where(norms > 0, np.abs(np.sum(vec * v_rel, axis=1)) / np.where(norms > 0, norms, 1.0), v_rel_norm)
+
+    f_D = (v_rad_abs / c) * f_c
+    eps = np.finfo(float).eps
+    moving = (v_rel_norm > eps) & (f_D > 0)
+    T_c = np.full(v_rel.shape[0], MAX_COHERENCE_TIME, dtype=np.int64)
+    T_c[moving] = (0.423 / f_D[moving] * 1e9).astype(np.int64)
+    return T_c
+
+
+def doppler_validity_batch(v_tx, v_rx, max_distance: float):
+    """
+    Validity of the propagation paths of N links for the time evolution model 'doppler': the paths
+    (gains, delays and Doppler shifts) are assumed unchanged until either node has moved by max_distance.
+    v_tx, v_rx   : arrays (N,3) or (3,) velocities in m/s
+    max_distance : max. displacement in m
+    Returns array (N,) of the validity in ns; MAX_COHERENCE_TIME for links without motion.
+    """
+    v_tx, v_rx = np.broadcast_arrays(np.atleast_2d(np.asarray(v_tx, dtype=float)),
+                                     np.atleast_2d(np.asarray(v_rx, dtype=float)))
+    # worst case: both nodes move away from the geometry they were traced at
+    speed = np.linalg.norm(v_tx, axis=1) + np.linalg.norm(v_rx, axis=1)
+    moving = speed > np.finfo(float).eps
+    T_v = np.full(speed.shape[0], MAX_COHERENCE_TIME, dtype=np.int64)
+    T_v[moving] = np.minimum(max_distance / speed[moving] * 1e9, MAX_COHERENCE_TIME).astype(np.int64)
+    return T_v
+
+
 if __name__ == '__main__':
     v = 1.0 # m/s
     fc = 5210e6 # center freq
@@ -0,0 +1,4 @@
+#!/bin/bash
+
+echo "Starting server component of ns3sionna: broker mode with one worker per GPU"
+python ns3sionna_broker.py "$@"
@@ -0,0 +1,57 @@
+import gc
+import os
+import time
+
+from sionna.rt import load_scene
+
+'''
+    Loaded Sionna scenes shared by the simulations of a server process. Pinned scenes are loaded
+    at startup and never released; besides them only the scene used last is kept. A simulation in
+    an already loaded scene only removes the radio devices of the previous one instead of loading
+    the XML file again.
+
+    author: Zubow
+'''
+class ScenePool:
+
+    def __init__(self, model_folder='./models/', pinned=()):
+        '''
+        :param model_folder: the folder containing the XML files of the scenes
+        :param pinned: file names of the scenes to be loaded now and kept for the lifetime of the pool
+        '''
+        self.model_folder = model_folder
+        self.scenes = {} # file path -> scene
+        self.pinned = [os.path.join(model_folder, fname) for fname in pinned]
+        self.loads = 0 # no. of scenes loaded from file
+        for filepath in self.pinned:
+            self.scenes[filepath] = self._load(filepath)
+
+
+    def _load(self, filepath):
+        t_start = time.perf_counter()
+        scene = load_scene(filepath)
+        self.loads += 1
+        print(f'Loaded scene {filepath} in {time.perf_counter() - t_start:.2f}s')
+        return scene
+
+
+    def acquire(self, filepath):
+        '''
+        :param filepath: path of the XML file of the scene
+        :return: the scene without any radio devices; loaded if not in the pool
+        '''
+        scene = self.scenes.get(filepath)
+        if scene is not None:
+            # devices of the previous simulation
+            for name in list(scene.transmitters) + list(scene.receivers):
+                scene.remove(name)
+            return scene
+
+        # release the last unpinned scene before loading the new one
+        for other in [other for other in self.scenes if other not in self.pinned]:
+            del self.scenes[other]
+        gc.collect()
+
+        scene = self._load(filepath)
+        self.scenes[filepath] = scene
+        return scene
@@ -0,0 +1,87 @@
+import json
+import os
+import time
+
+'''
+    Low-overhead counters of the Sionna server. Updated per request and written periodically as
+    JSON so that a running server can be monitored without per-request printing.
+
+    author: Zubow
+'''
+class ServerMetrics:
+
+    def __init__(self, fname=None, interval=10.0):
+        '''
+        :param fname: the JSON file; None if not written
+        :param interval: min. time between two writes in s
+        '''
+        self.fname = fname
+        self.interval = interval
+        self.start_time = time.time()
+        self.last_write = self.start_time
+        self.requests = 0
+        self.batch_requests = 0
+        self.csi_samples = 0
+        self.bytes_received = 0
+        self.bytes_sent = 0
+        self.time_ns = {} # total time per stage
+
+
+    def add_request(self, batch: bool, num_csi: int, timing: dict, request_ns: int):
+        '''
+        :param batch: whether it was a BatchChannelStateRequest
+        :param num_csi: no. of computed CSI samples
+        :param timing: time per stage in ns as reported to ns3
+        :param request_ns: total processing time of the request in ns
+        '''
+        if batch:
+            self.batch_requests += 1
+        else:
+            self.requests += 1
+        self.csi_samples += num_csi
+        for stage, t in timing.items():
+            self.time_ns[stage] = self.time_ns.get(stage, 0) + t
+        self.time_ns['request'] = self.time_ns.get('request', 0) + request_ns
+
+
+    def add_io(self, received: int, sent: int):
+        self.bytes_received += received
+        self.bytes_sent += sent
+
+
+    def to_dict(self, extra=None):
+        '''
+        :param extra: further counters to include, e.g. of the geometry cache
+        '''
+        metrics = {
+            'uptime_s': time.time() - self.start_time,
+            'requests': self.requests,
+            'batch_requests': self.batch_requests,
+            'csi_samples': self.csi_samples,
+            'bytes_received': self.bytes_received,
+            'bytes_sent': self.bytes_sent,
+            'time_s': {stage: t / 1e9 for stage, t in self.time_ns.items()},
+        }
+        if extra is not None:
+            metrics.update(extra)
+        return metrics
+
+
+    def write(self, extra=None, force=False):
+        '''
+        Write the metrics if the interval has passed since the last write
+        :param extra: see to_dict
+        :param force: write regardless of the interval, e.g. at the end of a simulation
+        '''
+        if self.fname is None:
+            return
+        now = time.time()
+        if not force and now - self.last_write < self.interval:
+            return
+        self.last_write = now
+
+        # readers never see a partially written file
+        tmp_fname = self.fname + '.tmp'
+        with open(tmp_fname, 'w') as f:
+            json.dump(self.to_dict(extra), f)
+        os.replace(tmp_fname, self.fname)
@@ -0,0 +1,56 @@
+import numpy as np
+
+'''
+    Memory-mapped ring buffer used to pass CFR payloads to ns3 if both run on the same host.
+    Only the control messages are sent via ZMQ; the responses contain the offsets of the payloads.
+
+    author: Zubow
+'''
+class ShmRingWriter:
+
+    def __init__(self, path: str, size: int):
+        '''
+        Map the ring buffer created by ns3
+        :param path: file of the ring buffer, e.g. in /dev/shm
+        :param size: size of the ring buffer in bytes
+        '''
+        self.buf = np.memmap(path, dtype=np.uint8, mode='r+', shape=(size,))
+        self.size = size
+        # offsets are monotonic; position in buffer is offset % size
+        self.write_offset = 0
+        self.consumed_offset = 0
+
+
+    def set_consumed(self, consumed_offset: int):
+        '''
+        ns3 has decoded all payloads up to the given offset
+        :param consumed_offset: reported with every request
+        '''
+        self.consumed_offset = max(self.consumed_offset, consumed_offset)
+
+
+    def write(self, payload: bytes):
+        '''
+        Append the payload; payloads are never split across the end of the buffer
+        :param payload: the packed CFR
+        :return: offset of the payload or None if the ring buffer is full
+        '''
+        n = len(payload)
+        pos = self.write_offset % self.size
+        offset = self.write_offset
+        if pos + n > self.size:
+            # skip the remainder of the buffer
+            offset += self.size - pos
+            pos = 0
+
+        if offset + n - self.consumed_offset > self.size:
+            return None
+
+        self.buf[pos:pos + n] = np.frombuffer(payload, dtype=np.uint8)
+        self.write_offset = offset + n
+        return offset
+
+
+    def release(self):
+        self.buf.flush()
+        del self.buf
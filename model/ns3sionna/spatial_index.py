@@ -0,0 +1,71 @@
+import math
+import numpy as np
+
+'''
+    Uniform grid over the x/y plane used to select the receivers of a P2MP request. Nodes are
+    re-inserted whenever their position changes; a query only visits the cells overlapping the
+    search radius.
+
+    author: Zubow
+'''
+class SpatialGrid:
+
+    def __init__(self, cell_size: float):
+        '''
+        :param cell_size: edge length of a cell in m; typically the search radius
+        '''
+        assert cell_size > 0
+        self.cell_size = cell_size
+        self.cells = {} # cell -> set of node ids
+        self.node_cell = {} # node id -> cell
+        self.node_pos = {} # node id -> position
+
+
+    def _cell(self, pos):
+        return (math.floor(pos[0] / self.cell_size), math.floor(pos[1] / self.cell_size))
+
+
+    def update(self, node_id, pos):
+        '''
+        Insert the node or move it to its new position
+        :param node_id: the node
+        :param pos: its position
+        '''
+        pos = np.asarray(pos, dtype=float)
+        self.node_pos[node_id] = pos
+        cell = self._cell(pos)
+        old_cell = self.node_cell.get(node_id)
+        if old_cell == cell:
+            return
+        if old_cell is not None:
+            self.cells[old_cell].discard(node_id)
+            if len(self.cells[old_cell]) == 0:
+                del self.cells[old_cell]
+        self.cells.setdefault(cell, set()).add(node_id)
+        self.node_cell[node_id] = cell
+
+
+    def query(self, pos, radius: float):
+        '''
+        :param pos: center of the search
+        :param radius: search radius in m (3D distance)
+        :return: ids of all nodes within the radius
+        '''
+        pos = np.asarray(pos, dtype=float)
+        cx, cy = self._cell(pos)
+        r = math.ceil(radius / self.cell_size)
+
+        if (2 * r + 1) ** 2 > len(self.cells):
+            # cheaper to visit the occupied cells only
+            candidate_cells = [c for c in self.cells
+                               if abs(c[0] - cx) <= r and abs(c[1] - cy) <= r]
+        else:
+            candidate_cells = [(x, y) for x in range(cx - r, cx + r + 1) for y in range(cy - r, cy + r + 1)
+                               if (x, y) in self.cells]
+
+        result = set()
+        for cell in candidate_cells:
+            for node_id in self.cells[cell]:
+                if np.linalg.norm(self.node_pos[node_id] - pos) <= radius:
+                    result.add(node_id)
+        return result
@@ -1,15 +1,19 @@
+import json
 import os
+import tempfile
 import time
 import numpy as np
 import unittest
 from common import message_pb2
 from ns3sionna_server import SionnaEnv
+from scene_pool import ScenePool
+from mobility import MobilityHistory
 import matplotlib.pyplot as plt
 import seaborn as sns
 import faulthandler
 import sys
 
-from ns3sionna_utils import MILLISECOND, SECOND
+from ns3sionna_utils import MILLISECOND, SECOND, doppler_validity_batch
 
 # Dump tracebacks to stderr or a file
 faulthandler.enable(file=sys.stderr, all_threads=True)
@@ -120,6 +124,17 @@ class TestServer(unittest.TestCase):
         return sim_info
 
 
+    def _create_batch_channel_state_request(self, time, links):
+        sim_info = message_pb2.Wrapper()
+        for tx_node, rx_nodes in links.items():
+            link_set = sim_info.batch_channel_state_request.links.add()
+            link_set.tx_node = tx_node
+            link_set.rx_nodes.extend(rx_nodes)
+            link_set.time = time
+
+        return sim_info
+
+
     def _create_channel_state_response(self):
         sim_info = message_pb2.Wrapper()
 
@@ -166,6 +181,360 @@ class TestServer(unittest.TestCase):
         self.env.compute_cfr(csi_req, csi_resp)
 
 
+    #@unittest.skip("Not yet")
+    def test_get_csi_batch(self):
+        '''
+        Test batched CSI request with both nodes transmitting at the same time
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        batch_req = self._create_batch_channel_state_request(0, {0: [1], 1: [0]}).batch_channel_state_request
+        csi_resp = self._create_channel_state_response()
+        num_lnks = self.env.compute_cfr_batch(batch_req, csi_resp)
+
+        self.assertEqual(num_lnks, 2)
+        csi = csi_resp.channel_state_response.csi
+        self.assertEqual(len(csi), 2)
+        self.assertEqual(sorted(entry.tx_node.id for entry in csi), [0, 1])
+
+        # channel reciprocity
+        self.assertAlmostEqual(csi[0].rx_nodes[0].wb_loss, csi[1].rx_nodes[0].wb_loss, delta=0.5)
+
+
+    #@unittest.skip("Not yet")
+    def test_geometry_cache(self):
+        '''
+        Test that static links are answered from the geometry cache without tracing again
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_resp0 = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=0).channel_state_request, csi_resp0)
+        self.assertEqual(self.env.geo_cache_hits, 0)
+
+        csi_resp1 = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=SECOND).channel_state_request, csi_resp1)
+        self.assertEqual(self.env.geo_cache_hits, 1)
+
+        rx0 = csi_resp0.channel_state_response.csi[0].rx_nodes[0]
+        rx1 = csi_resp1.channel_state_response.csi[0].rx_nodes[0]
+        self.assertTrue(rx0.static_link)
+        self.assertEqual(rx0.wb_loss, rx1.wb_loss)
+        self.assertEqual(csi_resp1.channel_state_response.csi[0].start_time, SECOND)
+
+
+    #@unittest.skip("Not yet")
+    def test_geometry_cache_mobile(self):
+        '''
+        Test that links with a mobile node are not kept in the geometry cache
+        '''
+        sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=0).channel_state_request, csi_resp)
+        self.assertFalse(csi_resp.channel_state_response.csi[0].rx_nodes[0].static_link)
+        self.assertEqual(len(self.env.geo_cache), 0)
+
+
+    #@unittest.skip("Not yet")
+    def test_p2mp_radius(self):
+        '''
+        Test that P2MP only traces the receivers within the given radius of the TX
+        '''
+        sim_info = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2MP)
+        sim_info.sim_init_msg.p2mp_radius = 10.0
+        n2 = sim_info.sim_init_msg.nodes.add()
+        n2.id                                           = 2
+        n2.constant_position_model.position.x           = 40.0
+        n2.constant_position_model.position.y           = 0.0
+        n2.constant_position_model.position.z           = 0.0
+
+        successful, error_msg = self.env.init_simulation_env(sim_info.sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=0).channel_state_request, csi_resp)
+        self.assertEqual([rx.id for rx in csi_resp.channel_state_response.csi[0].rx_nodes], [1])
+
+        # the requested receiver is always included
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=SECOND, rx_node=2).channel_state_request, csi_resp)
+        self.assertEqual(sorted(rx.id for rx in csi_resp.channel_state_response.csi[0].rx_nodes), [1, 2])
+
+
+    #@unittest.skip("Not yet")
+    def test_csi_subcarriers(self):
+        '''
+        Test CFR computed only for every 4th subcarrier
+        '''
+        sim_info = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P)
+        subcarriers = list(range(0, sim_info.sim_init_msg.fft_size, 4))
+        sim_info.sim_init_msg.csi_subcarriers.extend(subcarriers)
+
+        successful, error_msg = self.env.init_simulation_env(sim_info.sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_req = self._create_channel_state_request(time=0).channel_state_request
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(csi_req, csi_resp)
+
+        rx_node_info = csi_resp.channel_state_response.csi[0].rx_nodes[0]
+        self.assertEqual(len(rx_node_info.csi_real), len(subcarriers))
+        # the frequency grid is sent once with the ack
+        self.assertEqual(len(rx_node_info.frequencies), 0)
+
+
+    #@unittest.skip("Not yet")
+    def test_csi_encoding(self):
+        '''
+        Test packed CSI wire formats against the CFR sent as repeated doubles
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        h = np.exp(1j * np.linspace(0, 2 * np.pi, 64)) * np.linspace(0.1, 2.0, 64)
+
+        formats = [(message_pb2.CSI_FLOAT32, '<f4', 1e-6), (message_pb2.CSI_FLOAT16, '<f2', 1e-2),
+                   (message_pb2.CSI_INT16, '<i2', 1e-3)]
+        for encoding, dtype, tol in formats:
+            self.env.csi_encoding = encoding
+            rx_node_info = self._create_channel_state_response().channel_state_response.csi.add().rx_nodes.add()
+            self.env._fill_csi(rx_node_info, h)
+
+            self.assertEqual(len(rx_node_info.frequencies), 0)
+            iq = np.frombuffer(rx_node_info.csi_packed, dtype=dtype).astype(np.float64)
+            if encoding == message_pb2.CSI_INT16:
+                iq *= rx_node_info.csi_scale
+            np.testing.assert_allclose(iq[0::2] + 1j * iq[1::2], h, atol=tol)
+
+
+    #@unittest.skip("Not yet")
+    def test_postprocess_links(self):
+        '''
+        Test the batched post-processing and CSI packing against a per link computation
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        num_links = 3
+        tau = np.random.uniform(10e-9, 100e-9, size=(num_links, 1, 1, 1, 5))
+        tau[:, :, :, :, 0] = -1.0 # invalid path
+        h_raw = np.random.normal(size=(num_links, 1, 1, 1, 1, 64)) + 1j * np.random.normal(size=(num_links, 1, 1, 1, 1, 64))
+
+        lnk_delay, lnk_loss, h_normalized = self.env._postprocess_links(tau, h_raw)
+        for i in range(num_links):
+            h = np.squeeze(h_raw[i])
+            self.assertEqual(lnk_delay[i], int(round(np.min(tau[i, 0, 0, 0, 1:]) * 1e9)))
+            self.assertAlmostEqual(lnk_loss[i], -10 * np.log10(np.mean(np.abs(h) ** 2)))
+            np.testing.assert_allclose(h_normalized[i], h / np.sqrt(np.mean(np.abs(h) ** 2)))
+
+        self.env.csi_encoding = message_pb2.CSI_INT16
+        packed_csi = self.env._pack_csi(h_normalized)
+        for i in range(num_links):
+            self.assertEqual(packed_csi[i], self.env._pack_csi(h_normalized[i:i + 1])[0])
+
+
+    #@unittest.skip("Not yet")
+    def test_postprocess_paths(self):
+        '''
+        Test that the CFR synthesized from the paths of time evolution 'doppler' matches the traced CFR
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+        sim_init_msg.time_evo_model = 'doppler'
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        num_links = 2
+        freq = self.env.csi_frequencies
+        tau = np.random.uniform(10e-9, 100e-9, size=(num_links, 1, 1, 1, 5))
+        tau[:, :, :, :, 0] = -1.0 # invalid path
+        a = np.random.normal(size=tau.shape) + 1j * np.random.normal(size=tau.shape)
+        a[:, :, :, :, 0] = 0.0
+        doppler = np.full(tau.shape, 50.0) # Hz; the same for all paths
+
+        # CFR with normalized delays like Sionna
+        tau_rel = tau - np.min(np.where(tau >= 0, tau, np.inf), axis=-1, keepdims=True)
+        h_raw = np.sum(a[..., np.newaxis] * np.exp(-2j * np.pi * freq * tau_rel[..., np.newaxis]), axis=-2)
+        h_raw = h_raw[:, :, :, :, np.newaxis, :]
+
+        lnk_delay, lnk_loss, h_normalized = self.env._postprocess_links(tau, h_raw)
+        lnk_paths = self.env._postprocess_paths(a, tau, doppler, lnk_loss)
+
+        t = 2e-3 # s after tracing
+        for i in range(num_links):
+            gain, delay_ns, nu = lnk_paths[i]
+            self.assertEqual(len(gain), 4)
+            h_0 = np.sum(gain[:, np.newaxis] * np.exp(-2j * np.pi * freq * delay_ns[:, np.newaxis] * 1e-9), axis=0)
+            np.testing.assert_allclose(h_0, h_normalized[i], rtol=1e-6, atol=1e-9)
+            # a common Doppler shift only rotates the phase
+            h_t = np.sum(gain[:, np.newaxis] * np.exp(2j * np.pi * (nu[:, np.newaxis] * t
+                                                                   - freq * delay_ns[:, np.newaxis] * 1e-9)), axis=0)
+            np.testing.assert_allclose(h_t, h_normalized[i] * np.exp(2j * np.pi * 50.0 * t), rtol=1e-6, atol=1e-9)
+
+        # validity: until either node has moved by the max. distance
+        T_v = doppler_validity_batch(np.array([[1.0, 0, 0], [0, 0, 0]]), np.array([[0, 1.0, 0], [0, 0, 0]]), 0.5)
+        self.assertEqual(T_v[0], 250 * MILLISECOND)
+        self.assertEqual(T_v[1], 10 * SECOND)
+
+
+    #@unittest.skip("Not yet")
+    def test_band_csi(self):
+        '''
+        Test the CFR of an additional band: normalized to its own power and filled in the configured wire format
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+        band = sim_init_msg.bands.add()
+        band.frequency = 2412
+        band.fft_size = 256
+        band.subcarrier_spacing = 78125
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+        self.assertEqual(len(self.env.band_frequencies), 1)
+        self.assertEqual(len(self.env.band_frequencies[0]), 256)
+
+        num_links = 2
+        h_raw = 1e-4 * (np.random.normal(size=(num_links, 1, 1, 1, 1, 256))
+                        + 1j * np.random.normal(size=(num_links, 1, 1, 1, 1, 256)))
+        (h_band,) = self.env._postprocess_bands([h_raw])
+        np.testing.assert_allclose(np.mean(np.abs(h_band) ** 2, axis=1), 1.0)
+
+        for encoding in (message_pb2.CSI_REPEATED_DOUBLE, message_pb2.CSI_FLOAT32):
+            self.env.csi_encoding = encoding
+            rx_node_info = self._create_channel_state_response().channel_state_response.csi.add().rx_nodes.add()
+            self.env._fill_band_csi(rx_node_info, [h_band], [self.env._pack_csi(h_band)], 1)
+
+            self.assertEqual(len(rx_node_info.band_csi), 1)
+            band_csi = rx_node_info.band_csi[0]
+            if encoding == message_pb2.CSI_REPEATED_DOUBLE:
+                h = np.asarray(band_csi.csi_real) + 1j * np.asarray(band_csi.csi_imag)
+            else:
+                iq = np.frombuffer(band_csi.csi_packed, dtype='<f4').astype(np.float64)
+                h = iq[0::2] + 1j * iq[1::2]
+            np.testing.assert_allclose(h, h_band[1], atol=1e-6)
+
+
+    #@unittest.skip("Not yet")
+    def test_mimo_csi(self):
+        '''
+        Test the CFR per antenna pair: normalized like the CFR of the first pair and filled in the configured wire format
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+        sim_init_msg.antenna_rows = 2
+        sim_init_msg.antenna_cols = 2
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+        self.assertEqual(self.env.num_antennas, 4)
+
+        num_links = 2
+        tau = np.random.uniform(10e-9, 100e-9, size=(num_links, 4, 4, 5))
+        h_raw = 1e-4 * (np.random.normal(size=(num_links, 4, 4, 1, 256))
+                        + 1j * np.random.normal(size=(num_links, 4, 4, 1, 256)))
+        lnk_delay, lnk_loss, h_normalized = self.env._postprocess_links(tau, h_raw)
+        h_mimo = self.env._postprocess_mimo(h_raw, lnk_loss)
+        self.assertEqual(h_mimo.shape, (num_links, 256, 4, 4))
+        for i in range(num_links):
+            h = h_raw[i, 0, 0, 0]
+            self.assertAlmostEqual(lnk_loss[i], -10 * np.log10(np.mean(np.abs(h) ** 2)))
+            np.testing.assert_allclose(h_mimo[i, :, 0, 0], h_normalized[i])
+            np.testing.assert_allclose(h_mimo[i, 7], h_raw[i, :, :, 0, 7] / np.sqrt(np.mean(np.abs(h) ** 2)))
+
+        for encoding in (message_pb2.CSI_REPEATED_DOUBLE, message_pb2.CSI_FLOAT32):
+            self.env.csi_encoding = encoding
+            rx_node_info = self._create_channel_state_response().channel_state_response.csi.add().rx_nodes.add()
+            self.env._fill_mimo_csi(rx_node_info, h_mimo, self.env._pack_mimo_csi(h_mimo), 1)
+            if encoding == message_pb2.CSI_REPEATED_DOUBLE:
+                h = np.asarray(rx_node_info.mimo_csi_real) + 1j * np.asarray(rx_node_info.mimo_csi_imag)
+            else:
+                iq = np.frombuffer(rx_node_info.mimo_csi_packed, dtype='<f4').astype(np.float64)
+                h = iq[0::2] + 1j * iq[1::2]
+            np.testing.assert_allclose(h, h_mimo[1].reshape(-1), atol=1e-5)
+
+
+    #@unittest.skip("Not yet")
+    def test_scene_pool(self):
+        '''
+        Test that a pinned scene is loaded once and reused without the radio devices of a previous simulation
+        '''
+        scene_fname = "2_rooms_with_door/2_rooms_with_door_open.xml"
+        scene_pool = ScenePool('./models/', pinned=[scene_fname])
+        self.assertEqual(scene_pool.loads, 1)
+
+        for _ in range(2):
+            env = SionnaEnv(model_folder='./models/', rt_fast=True, VERBOSE=False, scene_pool=scene_pool)
+            env.warm_up()
+            successful, error_msg = env.init_simulation_env(self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg)
+            self.assertTrue(successful, error_msg)
+            self.assertEqual(len(env.scene.transmitters) + len(env.scene.receivers), 0)
+
+            csi_resp = self._create_channel_state_response()
+            env.compute_cfr(self._create_channel_state_request(time=0).channel_state_request, csi_resp)
+            self.assertEqual(len(csi_resp.channel_state_response.csi), 1)
+            env.release()
+
+        self.assertEqual(scene_pool.loads, 1)
+
+
+    #@unittest.skip("Not yet")
+    def test_server_timing(self):
+        '''
+        Test that the per stage server timing is reported with each response
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P)
+        resp_msg, do_terminate = self.env.handle_message(sim_init_msg)
+        self.assertTrue(resp_msg.sim_ack.no_error, resp_msg.sim_ack.error_msg)
+
+        csi_req = self._create_channel_state_request(time=0)
+        resp_msg, do_terminate = self.env.handle_message(csi_req)
+        self.assertTrue(resp_msg.channel_state_response.HasField("timing"))
+        timing = resp_msg.channel_state_response.timing
+        self.assertGreater(timing.trace_ns, 0)
+        self.assertGreater(timing.postprocess_ns, 0)
+        self.assertGreater(timing.fill_ns, 0)
+
+
+    #@unittest.skip("Not yet")
+    def test_server_metrics(self):
+        '''
+        Test the periodically written server counters
+        '''
+        sim_init_msg = self._create_sim_init_constant_mob(mode=SionnaEnv.MODE_P2P)
+        resp_msg, do_terminate = self.env.handle_message(sim_init_msg)
+        self.assertTrue(resp_msg.sim_ack.no_error, resp_msg.sim_ack.error_msg)
+
+        self.env.handle_message(self._create_channel_state_request(time=0))
+        self.env.handle_message(self._create_batch_channel_state_request(time=1000, links={0: [1]}))
+
+        metrics = self.env.metrics.to_dict()
+        self.assertEqual(metrics['requests'], 1)
+        self.assertEqual(metrics['batch_requests'], 1)
+        self.assertGreater(metrics['csi_samples'], 0)
+        self.assertGreater(metrics['time_s']['request'], 0)
+
+        with tempfile.TemporaryDirectory() as tmp_dir:
+            self.env.metrics.fname = os.path.join(tmp_dir, 'metrics.json')
+            self.env.metrics.write(self.env._metrics_extra(), force=True)
+            with open(self.env.metrics.fname) as f:
+                written = json.load(f)
+            self.assertEqual(written['requests'], 1)
+            self.assertIn('geo_cache_hits', written)
+
+
     #@unittest.skip("Not yet")
     def test_get_csi_mode3(self):
         '''
@@ -195,12 +564,117 @@ class TestServer(unittest.TestCase):
             prev_entry = csi_entry
 
 
+    #@unittest.skip("Not yet")
+    def test_get_csi_mode3_mobile_tx(self):
+        '''
+        Test lookahead with a mobile TX; each CSI entry is computed at the TX lookahead position
+        '''
+        sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2MP_LAH, num_mobile_nodes=2).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_req = self._create_channel_state_request(time=0, tx_node=1, rx_node=2).channel_state_request
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(csi_req, csi_resp)
+
+        csi = csi_resp.channel_state_response.csi
+        # same budget sub_mode / #RX as a fixed TX; one scene per TX snapshot
+        self.assertEqual(len(csi), 4)
+        self.assertTrue(all(entry.tx_node.id == 1 for entry in csi))
+        self.assertNotEqual(csi[0].tx_node.position.x, csi[1].tx_node.position.x)
+        self.assertEqual(csi[0].end_time + 1, csi[1].start_time)
+
+        # trajectory segments: the velocity of the mobile TX and the static node 0
+        for entry in csi:
+            tx_velo = entry.tx_node.velocity
+            self.assertTrue(3.0 <= np.linalg.norm([tx_velo.x, tx_velo.y, tx_velo.z]) <= 5.0)
+            rx_static = [rx for rx in entry.rx_nodes if rx.id == 0]
+            self.assertEqual(len(rx_static), 1)
+            self.assertEqual(rx_static[0].velocity.x, 0.0)
+            self.assertEqual(rx_static[0].velocity.y, 0.0)
+
+
+    #@unittest.skip("Not yet")
+    def test_lookahead_feedback(self):
+        '''
+        Test that the lookahead horizon of mode 3 shrinks if ns3 reports unused lookahead CSI
+        '''
+        sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2MP_LAH, num_mobile_nodes=2).sim_init_msg
+
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(self._create_channel_state_request(time=0).channel_state_request, csi_resp)
+        # no feedback yet: whole budget of sub_mode / #RX
+        self.assertEqual(len(csi_resp.channel_state_response.csi), 4)
+
+        # feedback as sent by the cache: one step per CSI, used if any of its RX entries was looked up;
+        # ns3 looked up all receivers of the first step only
+        steps = csi_resp.channel_state_response.csi
+        self.assertGreater(len(steps[0].rx_nodes), 1)
+        looked_up = {(steps[0].tx_node.id, steps[0].start_time, rx.id) for rx in steps[0].rx_nodes}
+        csi_req = self._create_channel_state_request(time=steps[-1].end_time + 1).channel_state_request
+        lah_feedback = csi_req.lah_feedback.add()
+        lah_feedback.tx_node = 0
+        lah_feedback.used = sum(any((csi.tx_node.id, csi.start_time, rx.id) in looked_up for rx in csi.rx_nodes)
+                                for csi in steps)
+        lah_feedback.unused = len(steps) - lah_feedback.used
+        self.assertEqual((lah_feedback.used, lah_feedback.unused), (1, 3))
+        csi_resp = self._create_channel_state_response()
+        self.env.compute_cfr(csi_req, csi_resp)
+        self.assertEqual(len(csi_resp.channel_state_response.csi), 2)
+
+
+    #@unittest.skip("Not yet")
+    def test_mobility_history(self):
+        '''
+        Test the bounded mobility history: lookups between updates and pruning
+        '''
+        history = MobilityHistory(max_len=4)
+        for t in range(0, 100, 10):
+            history.append(t, np.array([t, 0.0, 0.0]), np.array([1.0, 0.0, 0.0]))
+        self.assertEqual(len(history), 4)
+
+        # last update at or before the requested time
+        self.assertEqual(history.get_pos_at(60)[0], 60)
+        self.assertEqual(history.get_pos_at(75)[0], 70)
+        self.assertEqual(history.get_pos_at(1000)[0], 90)
+        with self.assertRaises(KeyError):
+            history.get_pos_at(50)
+
+        history.prune(85)
+        times, pos = history.items()
+        self.assertEqual(times, [80, 90])
+        self.assertEqual(history.get_velo_at(85)[0], 1.0)
+
+        # the full history is never pruned
+        full_history = MobilityHistory()
+        for t in range(0, 10000, 10):
+            full_history.append(t, np.zeros(3), np.zeros(3))
+        full_history.prune(5000)
+        self.assertEqual(len(full_history), 1000)
+
+        # server side: bounded by the time of the current request
+        sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+        successful, error_msg = self.env.init_simulation_env(sim_init_msg)
+        self.assertTrue(successful, error_msg)
+        for time in np.arange(50 * MILLISECOND, 1 * SECOND, 50 * MILLISECOND):
+            csi_req = self._create_channel_state_request(int(time)).channel_state_request
+            self.env.compute_cfr(csi_req, self._create_channel_state_response())
+        self.env._prune_mobility_history()
+        self.assertLessEqual(len(self.env.node_info[1].history), 1)
+
+
     #@unittest.skip("Not yet")
     def test_random_wall(self):
         '''
         Test scenario with fixed TX and mobile RX with wall mobility
         '''
         sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2P).sim_init_msg
+        # the trajectory is evaluated below
+        self.env.full_mobility_history = True
 
         successful, error_msg = self.env.init_simulation_env(sim_init_msg)
         self.assertTrue(successful, error_msg)
@@ -263,6 +737,8 @@ class TestServer(unittest.TestCase):
 
         N = 3 # no. of mobile nodes
         sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2MP, num_mobile_nodes=N).sim_init_msg
+        # the trajectory is evaluated below
+        self.env.full_mobility_history = True
 
         successful, error_msg = self.env.init_simulation_env(sim_init_msg)
         self.assertTrue(successful, error_msg)
@@ -348,6 +824,8 @@ class TestServer(unittest.TestCase):
         '''
         K = 1 # one mobile user
         sim_init_msg = self._create_sim_init_wall_mob(mode=SionnaEnv.MODE_P2P, num_mobile_nodes=K).sim_init_msg
+        # the trajectory is evaluated below
+        self.env.full_mobility_history = True
 
         successful, error_msg = self.env.init_simulation_env(sim_init_msg)
         self.assertTrue(successful, error_msg)
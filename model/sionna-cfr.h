@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2025
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: A. Zubow <zubow@tkn.tu-berlin.de>
+ */
+
+#ifndef SIONNA_CFR_H
+#define SIONNA_CFR_H
+
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace ns3
+{
+
+/**
+ * Channel frequency response (CFR) as stored in the SionnaPropagationCache: one complex value
+ * per PSD bin, i.e. the OFDM subcarriers (incl. guards) followed by the trailing bin of the
+ * spectrum model which is set to 1.
+ */
+typedef std::vector<std::complex<double>> CfrVector;
+
+/**
+ * Shared handle to an immutable CFR. The cache, the spectrum model and the CFRTag share the
+ * same buffer so that a cache hit does not copy or allocate.
+ */
+typedef std::shared_ptr<const CfrVector> CfrHandle;
+
+/**
+ * Shared handle to the (immutable) subcarrier frequencies relative to the center frequency.
+ */
+typedef std::shared_ptr<const std::vector<int>> FreqHandle;
+
+/**
+ * Power |H|^2 of the CFR per PSD bin incl. the trailing bin; computed once when the CFR is
+ * inserted into the cache and applied to the PSD of every received frame.
+ */
+typedef std::vector<double> CfrPowerVector;
+typedef std::shared_ptr<const CfrPowerVector> CfrPowerHandle;
+
+// propagation paths of a link; time evolution model 'doppler'
+struct CfrPaths
+{
+    std::vector<std::complex<double>> m_gain; // normalized like the CFR
+    std::vector<double> m_delay; // relative to the shortest path [s]
+    std::vector<double> m_doppler; // [Hz]
+};
+
+typedef std::shared_ptr<const CfrPaths> CfrPathsHandle;
+
+/**
+ * CFR resp. its power in single precision; the compact form in which the
+ * SionnaPropagationCache may store them.
+ */
+typedef std::vector<std::complex<float>> CfrFloatVector;
+typedef std::shared_ptr<const CfrFloatVector> CfrFloatHandle;
+typedef std::vector<float> CfrPowerFloatVector;
+typedef std::shared_ptr<const CfrPowerFloatVector> CfrPowerFloatHandle;
+
+inline CfrPowerHandle
+CfrPower(const CfrVector& cfr)
+{
+    auto power = std::make_shared<CfrPowerVector>(cfr.size());
+    for (size_t i = 0; i < cfr.size(); i++)
+    {
+        (*power)[i] = std::norm(cfr[i]);
+    }
+    return power;
+}
+
+inline CfrFloatHandle
+CfrToFloat(const CfrVector& cfr)
+{
+    auto compact = std::make_shared<CfrFloatVector>(cfr.size());
+    for (size_t i = 0; i < cfr.size(); i++)
+    {
+        (*compact)[i] = std::complex<float>(static_cast<float>(cfr[i].real()), static_cast<float>(cfr[i].imag()));
+    }
+    return compact;
+}
+
+inline CfrPowerFloatHandle
+CfrPowerToFloat(const CfrPowerVector& power)
+{
+    return std::make_shared<CfrPowerFloatVector>(power.begin(), power.end());
+}
+
+inline CfrHandle
+CfrFromFloat(const CfrFloatVector& compact)
+{
+    return std::make_shared<CfrVector>(compact.begin(), compact.end());
+}
+
+/**
+ * Multiply the PSD in place with the CFR power. Uses AVX or NEON if the module is compiled
+ * for it (e.g. -march=native); the scalar loop handles the remainder.
+ * @param psd values of the PSD
+ * @param power |H|^2 of the same size
+ * @param n number of PSD bins
+ */
+inline void
+CfrApplyPower(double* psd, const double* power, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(psd + i, _mm256_mul_pd(_mm256_loadu_pd(psd + i), _mm256_loadu_pd(power + i)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 2 <= n; i += 2)
+    {
+        vst1q_f64(psd + i, vmulq_f64(vld1q_f64(psd + i), vld1q_f64(power + i)));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        psd[i] *= power[i];
+    }
+}
+
+/**
+ * Multiply the PSD in place with the CFR power stored in single precision; widened to double
+ * on the fly.
+ * @param psd values of the PSD
+ * @param power |H|^2 of the same size
+ * @param n number of PSD bins
+ */
+inline void
+CfrApplyPower(double* psd, const float* power, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(psd + i, _mm256_mul_pd(_mm256_loadu_pd(psd + i), _mm256_cvtps_pd(_mm_loadu_ps(power + i))));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 2 <= n; i += 2)
+    {
+        vst1q_f64(psd + i, vmulq_f64(vld1q_f64(psd + i), vcvt_f64_f32(vld1_f32(power + i))));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        psd[i] *= power[i];
+    }
+}
+
+/**
+ * Beamforming gain |sum_r w_row[r] sum_c w_col[c] H[r][c]|^2 per subcarrier of the channel
+ * matrices of an antenna array link; the beamforming vectors are used as is, i.e. conjugated
+ * like those of a PhasedArrayModel. The matrix of a subcarrier is contiguous; the products are
+ * written out in real arithmetic as std::complex multiplication handles NaN/Inf in a library call.
+ * @param h channel matrices [subcarrier][row][col]; double or single precision
+ * @param num_subcarrier number of subcarriers
+ * @param w_row beamforming vector of the node of the rows
+ * @param num_row number of rows
+ * @param w_col beamforming vector of the node of the columns
+ * @param num_col number of columns
+ * @param gain output; num_subcarrier values
+ */
+template <typename T>
+inline void
+CfrBeamformingGain(const std::complex<T>* h, size_t num_subcarrier, const std::complex<double>* w_row,
+                   size_t num_row, const std::complex<double>* w_col, size_t num_col, double* gain)
+{
+    for (size_t k = 0; k < num_subcarrier; k++)
+    {
+        double y_re = 0.0;
+        double y_im = 0.0;
+        for (size_t r = 0; r < num_row; r++)
+        {
+            const std::complex<T>* row = h + (k * num_row + r) * num_col;
+            double x_re = 0.0;
+            double x_im = 0.0;
+            for (size_t c = 0; c < num_col; c++)
+            {
+                x_re += w_col[c].real() * row[c].real() - w_col[c].imag() * row[c].imag();
+                x_im += w_col[c].real() * row[c].imag() + w_col[c].imag() * row[c].real();
+            }
+            y_re += w_row[r].real() * x_re - w_row[r].imag() * x_im;
+            y_im += w_row[r].real() * x_im + w_row[r].imag() * x_re;
+        }
+        gain[k] = y_re * y_re + y_im * y_im;
+    }
+}
+
+// append the CFR at time t after the paths were traced: sum over the paths of
+// gain * exp(j2pi (doppler * t - freq * delay)); freq relative to the center frequency [Hz].
+// Another band of the same paths: freq_offset is its distance to the traced center frequency
+// [Hz] and doppler_scale the ratio of both center frequencies.
+inline void
+CfrSynthesize(const CfrPaths& paths, const std::vector<int>& freq, double t, CfrVector& cfr,
+              double freq_offset = 0.0, double doppler_scale = 1.0)
+{
+    const double TWO_PI = 6.283185307179586;
+    size_t offset = cfr.size();
+    cfr.resize(offset + freq.size(), std::complex<double>(0.0, 0.0));
+    if (freq.empty())
+    {
+        return;
+    }
+    // uniform grid: the phase of each path advances by a constant step per subcarrier
+    double spacing = freq.size() > 1 ? static_cast<double>(freq[1] - freq[0]) : 0.0;
+    bool uniform = true;
+    for (size_t k = 1; k < freq.size() && uniform; k++)
+    {
+        uniform = freq[k] - freq[k - 1] == freq[1] - freq[0];
+    }
+    for (size_t p = 0; p < paths.m_gain.size(); p++)
+    {
+        double delay = paths.m_delay[p];
+        std::complex<double> g = paths.m_gain[p] *
+            std::polar(1.0, TWO_PI * (paths.m_doppler[p] * doppler_scale * t - freq_offset * delay));
+        if (uniform)
+        {
+            std::complex<double> h = g * std::polar(1.0, -TWO_PI * freq[0] * delay);
+            std::complex<double> step = std::polar(1.0, -TWO_PI * spacing * delay);
+            for (size_t k = 0; k < freq.size(); k++)
+            {
+                cfr[offset + k] += h;
+                h *= step;
+            }
+        }
+        else
+        {
+            for (size_t k = 0; k < freq.size(); k++)
+            {
+                cfr[offset + k] += g * std::polar(1.0, -TWO_PI * freq[k] * delay);
+            }
+        }
+    }
+}
+
+/**
+ * Decoding of the packed CSI wire formats (interleaved little-endian I/Q, see CsiEncoding in
+ * message.proto). The values are appended to the CFR; the memcpy per element avoids unaligned
+ * access and lets the compiler vectorize the widening to double.
+ */
+
+/**
+ * Number of complex values in a packed buffer.
+ * @param num_bytes size of the buffer
+ * @param component_size size of a single I or Q component in bytes
+ */
+inline size_t
+CfrPackedCount(size_t num_bytes, size_t component_size)
+{
+    return num_bytes / (2 * component_size);
+}
+
+inline void
+CfrDecodeFloat32(const char* data, size_t n, CfrVector& cfr)
+{
+    size_t offset = cfr.size();
+    cfr.resize(offset + n);
+    for (size_t i = 0; i < n; i++)
+    {
+        float iq[2];
+        std::memcpy(iq, data + 2 * i * sizeof(float), sizeof(iq));
+        cfr[offset + i] = std::complex<double>(iq[0], iq[1]);
+    }
+}
+
+/**
+ * IEEE 754 half to single precision (incl. subnormals, inf and NaN).
+ */
+inline float
+CfrHalfToFloat(uint16_t h)
+{
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0x1f)
+    {
+        // inf or NaN
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // subnormal: normalize
+            exponent = 1;
+            while (!(mantissa & 0x400))
+            {
+                mantissa <<= 1;
+                exponent--;
+            }
+            mantissa &= 0x3ff;
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+    }
+    else
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline void
+CfrDecodeFloat16(const char* data, size_t n, CfrVector& cfr)
+{
+    size_t offset = cfr.size();
+    cfr.resize(offset + n);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint16_t iq[2];
+        std::memcpy(iq, data + 2 * i * sizeof(uint16_t), sizeof(iq));
+        cfr[offset + i] = std::complex<double>(CfrHalfToFloat(iq[0]), CfrHalfToFloat(iq[1]));
+    }
+}
+
+inline void
+CfrDecodeInt16(const char* data, size_t n, double scale, CfrVector& cfr)
+{
+    size_t offset = cfr.size();
+    cfr.resize(offset + n);
+    for (size_t i = 0; i < n; i++)
+    {
+        int16_t iq[2];
+        std::memcpy(iq, data + 2 * i * sizeof(int16_t), sizeof(iq));
+        cfr[offset + i] = std::complex<double>(iq[0] * scale, iq[1] * scale);
+    }
+}
+
+/**
+ * Linear interpolation of a CFR computed for a subset of the subcarriers onto all of them;
+ * values outside the subset are held constant. The result is appended to the CFR.
+ * @param sparse the CFR of the subset
+ * @param subcarriers ascending indices of the subset
+ * @param n total number of subcarriers
+ * @param cfr the output
+ */
+inline void
+CfrInterpolate(const CfrVector& sparse, const std::vector<uint32_t>& subcarriers, size_t n, CfrVector& cfr)
+{
+    size_t offset = cfr.size();
+    cfr.resize(offset + n, sparse.empty() ? std::complex<double>(1.0, 0.0) : sparse.front());
+    if (sparse.empty())
+    {
+        return;
+    }
+
+    for (size_t j = 0; j + 1 < sparse.size(); j++)
+    {
+        uint32_t lo = subcarriers[j];
+        uint32_t hi = subcarriers[j + 1];
+        std::complex<double> step = (sparse[j + 1] - sparse[j]) / static_cast<double>(hi - lo);
+        for (uint32_t k = lo; k < hi; k++)
+        {
+            cfr[offset + k] = sparse[j] + step * static_cast<double>(k - lo);
+        }
+    }
+    for (size_t k = subcarriers[sparse.size() - 1]; k < n; k++)
+    {
+        cfr[offset + k] = sparse.back();
+    }
+}
+
+} // namespace ns3
+
+#endif /* SIONNA_CFR_H */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2025
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: A. Zubow <zubow@tkn.tu-berlin.de>
+ */
+
+#include "sionna-link-culler.h"
+#include "sionna-mobility-model.h"
+
+#include "ns3/double.h"
+#include "ns3/log.h"
+#include "ns3/node.h"
+#include "ns3/string.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace ns3
+{
+
+NS_LOG_COMPONENT_DEFINE("SionnaLinkCuller");
+
+NS_OBJECT_ENSURE_REGISTERED(SionnaLinkCuller);
+
+TypeId
+SionnaLinkCuller::GetTypeId()
+{
+    static TypeId tid =
+        TypeId("ns3::SionnaLinkCuller")
+            .SetParent<Object>()
+            .SetGroupName("Sionna")
+            .AddConstructor<SionnaLinkCuller>()
+            .AddAttribute("Margin",
+                          "A link is only culled if its received power is below the noise floor "
+                          "by more than this margin (dB).",
+                          DoubleValue(0.0),
+                          MakeDoubleAccessor(&SionnaLinkCuller::m_margin),
+                          MakeDoubleChecker<double>())
+            .AddAttribute("MaxTxPower",
+                          "TX power (dBm) assumed for nodes without a WifiPhy. The TX power of a "
+                          "node with WifiPhys is read once, on its first cull decision.",
+                          DoubleValue(20.0),
+                          MakeDoubleAccessor(&SionnaLinkCuller::m_max_tx_power_dbm),
+                          MakeDoubleChecker<double>())
+            .AddAttribute("CellSize",
+                          "Edge length (m) of the cells of the coverage grid; at least 1 mm.",
+                          DoubleValue(1.0),
+                          MakeDoubleAccessor(&SionnaLinkCuller::m_cell_size),
+                          MakeDoubleChecker<double>(1e-3))
+            .AddAttribute("CoverageGridFile",
+                          "File with the max. path gain per cell pair; empty if not used.",
+                          StringValue(""),
+                          MakeStringAccessor(&SionnaLinkCuller::SetCoverageGridFile),
+                          MakeStringChecker());
+    return tid;
+}
+
+SionnaLinkCuller::SionnaLinkCuller()
+    : m_noise_floor_dbm(-std::numeric_limits<double>::infinity()), m_margin(0.0),
+      m_max_tx_power_dbm(20.0), m_cell_size(1.0)
+{
+    m_friisLossModel = CreateObject<FriisPropagationLossModel>();
+    m_constSpeedDelayModel = CreateObject<ConstantSpeedPropagationDelayModel>();
+}
+
+SionnaLinkCuller::~SionnaLinkCuller()
+{
+}
+
+void
+SionnaLinkCuller::Configure(double frequency, double noise_floor_dbm)
+{
+    m_friisLossModel->SetFrequency(frequency);
+    m_noise_floor_dbm = noise_floor_dbm;
+}
+
+bool
+SionnaLinkCuller::IsCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    double max_tx_power_dbm = std::max(GetMaxTxPower(a), GetMaxTxPower(b));
+    return DoIsCulled(a, b, max_tx_power_dbm);
+}
+
+bool
+SionnaLinkCuller::DoIsCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b, double max_tx_power_dbm) const
+{
+    return max_tx_power_dbm + GetMaxGain(a, b) + m_margin < m_noise_floor_dbm;
+}
+
+Time
+SionnaLinkCuller::GetDelay(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    return m_constSpeedDelayModel->GetDelay(a, b);
+}
+
+double
+SionnaLinkCuller::GetLoss(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    return -m_friisLossModel->CalcRxPower(0.0, a, b);
+}
+
+double
+SionnaLinkCuller::GetMaxGain(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    if (!m_coverage_grid.empty())
+    {
+        auto it = m_coverage_grid.find(GetCellPair(a->GetPosition(), b->GetPosition()));
+        if (it != m_coverage_grid.end())
+        {
+            return it->second;
+        }
+    }
+    return m_friisLossModel->CalcRxPower(0.0, a, b);
+}
+
+double
+SionnaLinkCuller::GetMaxTxPower(Ptr<const MobilityModel> m) const
+{
+    Ptr<Node> node = m->GetObject<Node>();
+    if (!node)
+    {
+        return m_max_tx_power_dbm;
+    }
+
+    auto it = m_tx_power.find(node->GetId());
+    if (it != m_tx_power.end())
+    {
+        return it->second;
+    }
+
+    // strongest of all WifiPhys of the node
+    double tx_power_dbm = -std::numeric_limits<double>::infinity();
+    for (uint32_t i = 0; i < node->GetNDevices(); i++)
+    {
+        Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(node->GetDevice(i));
+        if (device && device->GetPhy())
+        {
+            tx_power_dbm = std::max(tx_power_dbm, device->GetPhy()->GetTxPowerEnd());
+        }
+    }
+    if (std::isinf(tx_power_dbm))
+    {
+        tx_power_dbm = m_max_tx_power_dbm;
+    }
+
+    NS_LOG_DEBUG("Max TX power of node " << node->GetId() << ": " << tx_power_dbm << " dBm");
+    m_tx_power[node->GetId()] = tx_power_dbm;
+    return tx_power_dbm;
+}
+
+void
+SionnaLinkCuller::AddCoverage(Vector a, Vector b, double max_gain_db)
+{
+    m_coverage_grid[GetCellPair(a, b)] = max_gain_db;
+}
+
+SionnaLinkCuller::CellId
+SionnaLinkCuller::GetCell(const Vector& position) const
+{
+    return CellId(static_cast<int64_t>(std::floor(position.x / m_cell_size)),
+                  static_cast<int64_t>(std::floor(position.y / m_cell_size)),
+                  static_cast<int64_t>(std::floor(position.z / m_cell_size)));
+}
+
+SionnaLinkCuller::CellPair
+SionnaLinkCuller::GetCellPair(const Vector& a, const Vector& b) const
+{
+    // channel reciprocity
+    CellId cell_a = GetCell(a);
+    CellId cell_b = GetCell(b);
+    return cell_a < cell_b ? CellPair(cell_a, cell_b) : CellPair(cell_b, cell_a);
+}
+
+void
+SionnaLinkCuller::SetCoverageGridFile(std::string filename)
+{
+    m_coverage_grid_file = filename;
+    m_coverage_grid.clear();
+    if (filename.empty())
+    {
+        return;
+    }
+
+    std::ifstream file(filename);
+    NS_ABORT_MSG_IF(!file, "Cannot open coverage grid file " << filename);
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        std::istringstream iss(line);
+        int64_t ax, ay, az, bx, by, bz;
+        double max_gain_db;
+        NS_ABORT_MSG_IF(!(iss >> ax >> ay >> az >> bx >> by >> bz >> max_gain_db),
+                        "Malformed line in coverage grid file " << filename << ": " << line);
+        CellId cell_a(ax, ay, az);
+        CellId cell_b(bx, by, bz);
+        m_coverage_grid[cell_a < cell_b ? CellPair(cell_a, cell_b) : CellPair(cell_b, cell_a)] = max_gain_db;
+    }
+    NS_LOG_INFO("Loaded coverage grid with #cell pairs: " << m_coverage_grid.size());
+}
+
+} // namespace ns3
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: A. Zubow <zubow@tkn.tu-berlin.de>
+ */
+
+#ifndef SIONNA_LINK_CULLER_H
+#define SIONNA_LINK_CULLER_H
+
+#include "ns3/mobility-model.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/ptr.h"
+#include "ns3/vector.h"
+
+#include <ns3/propagation-delay-model.h>
+#include "ns3/propagation-loss-model.h"
+
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+namespace ns3
+{
+
+/**
+ * Decides for the SionnaPropagationCache which links are too weak to be worth ray tracing. A
+ * culled link is never requested from the server; delay, loss and CSI of the link are taken
+ * from simple models instead (constant speed delay, Friis loss, flat CFR).
+ *
+ * A link is culled if the strongest TX power of both nodes plus the path gain plus a margin is
+ * below the noise floor. The TX power is taken from the WifiPhys of the nodes (MaxTxPower if a
+ * node has none) when a node is first seen; later changes of it are not taken into account.
+ * The path gain is an upper bound taken from a precomputed coverage grid if the cell pair of
+ * the two nodes is contained and from Friis otherwise. Subclasses may override DoIsCulled.
+ *
+ * Coverage grid file: one cell pair per line "ax ay az bx by bz max_gain_db", with the integer
+ * cell indices floor(position / CellSize) of both nodes and the max. path gain between any two
+ * positions within the cells (e.g. from a Sionna radio map of the scene).
+ */
+class SionnaLinkCuller : public Object
+{
+  public:
+    static TypeId GetTypeId();
+
+    SionnaLinkCuller();
+    ~SionnaLinkCuller() override;
+
+    /**
+     * Set the parameters of the simulated channel; called by the cache before the first lookup.
+     * @param frequency the center frequency [Hz]
+     * @param noise_floor_dbm the noise floor of the receivers [dBm]
+     */
+    void Configure(double frequency, double noise_floor_dbm);
+
+    /**
+     * The cull decision; the same for (a, b) and (b, a) and for delay, loss and CSI.
+     * @return true if the link does not need to be ray traced
+     */
+    bool IsCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+
+    // fallback delay and loss of culled links
+    Time GetDelay(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+    double GetLoss(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+
+    /**
+     * Add an entry of the coverage grid
+     * @param a position within the cell of the first node
+     * @param b position within the cell of the second node
+     * @param max_gain_db max. path gain between the cells [dB]
+     */
+    void AddCoverage(Vector a, Vector b, double max_gain_db);
+
+    // strongest TX power of the node [dBm]; read from its WifiPhys on the first call only
+    double GetMaxTxPower(Ptr<const MobilityModel> m) const;
+
+  protected:
+    /**
+     * @param a the first node
+     * @param b the second node
+     * @param max_tx_power_dbm the strongest TX power of both nodes
+     * @return true if the link does not need to be ray traced
+     */
+    virtual bool DoIsCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b, double max_tx_power_dbm) const;
+
+    // upper bound of the path gain between both nodes [dB]
+    double GetMaxGain(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+
+    double m_noise_floor_dbm;
+    double m_margin; // dB
+
+  private:
+    typedef std::tuple<int64_t, int64_t, int64_t> CellId;
+    typedef std::pair<CellId, CellId> CellPair; // ordered such that first <= second
+
+    CellId GetCell(const Vector& position) const;
+    CellPair GetCellPair(const Vector& a, const Vector& b) const;
+    void SetCoverageGridFile(std::string filename);
+
+    double m_max_tx_power_dbm; // default if a node has no WifiPhy
+    double m_cell_size; // m
+    std::string m_coverage_grid_file;
+    std::map<CellPair, double> m_coverage_grid; // max. path gain per cell pair
+    mutable std::unordered_map<uint32_t, double> m_tx_power; // per node ID, resolved lazily
+    Ptr<FriisPropagationLossModel> m_friisLossModel;
+    Ptr<ConstantSpeedPropagationDelayModel> m_constSpeedDelayModel;
+};
+
+} // namespace ns3
+
+#endif // SIONNA_LINK_CULLER_H
@@ -12,9 +12,13 @@
 #include "ns3/boolean.h"
 #include "ns3/enum.h"
 #include "ns3/log.h"
+#include "ns3/node.h"
 #include "ns3/pointer.h"
+#include "ns3/simulator.h"
 #include "ns3/string.h"
 
+#include <algorithm>
+
 namespace ns3
 {
 
@@ -79,6 +83,7 @@ SionnaMobilityModel::GetTypeId()
 }
 
 SionnaMobilityModel::SionnaMobilityModel()
+    : m_nodeId(UINT32_MAX)
 {
 }
 
@@ -145,22 +150,106 @@ SionnaMobilityModel::GetDirection() const
     return m_direction;
 }
 
+uint32_t
+SionnaMobilityModel::GetNodeId() const
+{
+    uint32_t id = m_nodeId;
+    if (id == UINT32_MAX)
+    {
+        Ptr<Node> node = GetObject<Node>();
+        NS_ASSERT_MSG(node, "SionnaMobilityModel is not aggregated to a node.");
+        id = node->GetId();
+        m_nodeId = id;
+    }
+    return id;
+}
+
+void
+SionnaMobilityModel::AddSegment(Time start, Time end, const Vector& position, const Vector& velocity)
+{
+    Time now = Simulator::Now();
+    bool course_change;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Vector old_velocity = GetVelocity(now);
+
+        auto it = std::lower_bound(m_segments.begin(), m_segments.end(), start,
+            [](const Segment& s, Time t) { return s.m_start < t; });
+        if (it != m_segments.end() && it->m_start == start)
+        {
+            *it = Segment{start, end, position, velocity};
+        }
+        else
+        {
+            m_segments.insert(it, Segment{start, end, position, velocity});
+        }
+
+        // only the active segment and the future ones are needed
+        auto active = std::upper_bound(m_segments.begin(), m_segments.end(), now,
+            [](Time t, const Segment& s) { return t < s.m_start; });
+        if (active != m_segments.begin())
+        {
+            m_segments.erase(m_segments.begin(), std::prev(active));
+        }
+
+        course_change = start <= now && GetVelocity(now) != old_velocity;
+    }
+
+    // without the lock; the listeners query the position
+    if (course_change)
+    {
+        NotifyCourseChange();
+    }
+}
+
+const SionnaMobilityModel::Segment*
+SionnaMobilityModel::GetSegment(Time now) const
+{
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), now,
+        [](Time t, const Segment& s) { return t < s.m_start; });
+    return it == m_segments.begin() ? nullptr : &*std::prev(it);
+}
+
 Vector
 SionnaMobilityModel::DoGetPosition() const
 {
-    return m_position;
+    Time now = Simulator::Now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Segment* segment = GetSegment(now);
+    if (!segment)
+    {
+        return m_position;
+    }
+    double dt = (std::min(now, segment->m_end) - segment->m_start).GetSeconds();
+    return Vector(segment->m_position.x + segment->m_velocity.x * dt,
+                  segment->m_position.y + segment->m_velocity.y * dt,
+                  segment->m_position.z + segment->m_velocity.z * dt);
 }
 
 void
 SionnaMobilityModel::DoSetPosition(const Vector& position)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     m_position = position;
+    m_segments.clear();
 }
 
 Vector
 SionnaMobilityModel::DoGetVelocity() const
 {
-    return Vector(0.0, 0.0, 0.0);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return GetVelocity(Simulator::Now());
+}
+
+Vector
+SionnaMobilityModel::GetVelocity(Time now) const
+{
+    const Segment* segment = GetSegment(now);
+    if (!segment || now > segment->m_end)
+    {
+        return Vector(0.0, 0.0, 0.0);
+    }
+    return segment->m_velocity;
 }
 
 } // namespace ns3
@@ -14,6 +14,10 @@
 #include "ns3/ptr.h"
 #include "ns3/random-variable-stream.h"
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 namespace ns3
 {
 
@@ -22,7 +26,9 @@ namespace ns3
  * - constant position
  * - random walk
  *
- * Note: mobility is simulated inside Sionna and propagated back no ns3.
+ * Note: mobility is simulated inside Sionna and propagated back no ns3. The Sionna cache pushes
+ * the trajectory segments (position, velocity, validity) received with the CSI into the model;
+ * position and velocity are interpolated from the segment active at the current time.
  */
 class SionnaMobilityModel : public MobilityModel
 {
@@ -59,7 +65,36 @@ class SionnaMobilityModel : public MobilityModel
 
         Ptr<RandomVariableStream> GetDirection() const;
 
+        /**
+         * The ID of the node this model is aggregated to; resolved once and cached as it
+         * is needed on every propagation lookup.
+         */
+        uint32_t GetNodeId() const;
+
+        /**
+         * Add a trajectory segment as computed by Sionna; a segment with the same start replaces
+         * the known one. Segments superseded at the current time are dropped.
+         *
+         * @param start time at which the node is at position
+         * @param end end of the validity; the position is held afterwards
+         * @param position position at start
+         * @param velocity constant velocity (m/s) within [start, end]
+         */
+        void AddSegment(Time start, Time end, const Vector& position, const Vector& velocity);
+
     private:
+        struct Segment
+        {
+            Time m_start;
+            Time m_end;
+            Vector m_position;
+            Vector m_velocity;
+        };
+
+        // latest segment started at or before now; nullptr if none. m_mutex held
+        const Segment* GetSegment(Time now) const;
+        Vector GetVelocity(Time now) const; // m_mutex held
+
         Vector DoGetPosition() const override;
 
         void DoSetPosition(const Vector& position) override;
@@ -74,6 +109,10 @@ class SionnaMobilityModel : public MobilityModel
         Time m_modeTime;
         Ptr<RandomVariableStream> m_speed;
         Ptr<RandomVariableStream> m_direction;
+        mutable std::atomic<uint32_t> m_nodeId; // cached node ID, UINT32_MAX if not yet resolved
+        // segments are pushed by the cache while other threads may look up the position
+        mutable std::mutex m_mutex;
+        std::vector<Segment> m_segments; // sorted by start; cleared by SetPosition
 };
 
 } // namespace ns3
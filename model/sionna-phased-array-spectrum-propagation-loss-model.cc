@@ -19,14 +19,10 @@
 
 
 #include "sionna-phased-array-spectrum-propagation-loss-model.h"
+#include "sionna-mobility-model.h"
 
-#include <ns3/double.h>
 #include <ns3/log.h>
 #include <ns3/node.h>
-#include <ns3/object-factory.h>
-#include <ns3/pointer.h>
-#include <ns3/random-variable-stream.h>
-#include <ns3/string.h>
 
 #include <algorithm>
 
@@ -40,7 +36,6 @@ NS_OBJECT_ENSURE_REGISTERED(SionnaPhasedArraySpectrumPropagationLossModel);
 SionnaPhasedArraySpectrumPropagationLossModel::SionnaPhasedArraySpectrumPropagationLossModel()
 {
     NS_LOG_FUNCTION(this);
-    NS_ASSERT_MSG(false, "Not yet implemented");
 }
 
 SionnaPhasedArraySpectrumPropagationLossModel::~SionnaPhasedArraySpectrumPropagationLossModel()
@@ -51,6 +46,7 @@ SionnaPhasedArraySpectrumPropagationLossModel::~SionnaPhasedArraySpectrumPropaga
 void
 SionnaPhasedArraySpectrumPropagationLossModel::DoDispose()
 {
+    m_propagationCache = nullptr;
 }
 
 void
@@ -67,77 +63,20 @@ SionnaPhasedArraySpectrumPropagationLossModel::GetTypeId()
             .SetParent<PhasedArraySpectrumPropagationLossModel>()
             .SetGroupName("Sionna")
             .AddConstructor<SionnaPhasedArraySpectrumPropagationLossModel>();
-            //.AddAttribute(
-            //    "ChannelConditionModel",
-            //    "Pointer to the channel condition model.",
-            //    PointerValue(),
-            //    MakePointerAccessor(&TwoRaySpectrumPropagationLossModel::m_channelConditionModel),
-            //    MakePointerChecker<ChannelConditionModel>())
-            //.AddAttribute(
-            //    "Scenario",
-            //    "The 3GPP scenario (RMa, UMa, UMi-StreetCanyon, InH-OfficeOpen, InH-OfficeMixed).",
-            //    StringValue("RMa"),
-            //    MakeStringAccessor(&TwoRaySpectrumPropagationLossModel::SetScenario),
-            //    MakeStringChecker())
-            //.AddAttribute("Frequency",
-            //              "The operating Frequency in Hz",
-            //              DoubleValue(500.0e6),
-            //              MakeDoubleAccessor(&TwoRaySpectrumPropagationLossModel::SetFrequency),
-            //              MakeDoubleChecker<double>());
     return tid;
 }
 
-
-double
-SionnaPhasedArraySpectrumPropagationLossModel::CalcBeamformingGain(
-    Ptr<const MobilityModel> a,
-    Ptr<const MobilityModel> b,
-    Ptr<const PhasedArrayModel> aPhasedArrayModel,
-    Ptr<const PhasedArrayModel> bPhasedArrayModel) const
+std::vector<std::complex<double>>
+SionnaPhasedArraySpectrumPropagationLossModel::GetBeamformingVector(
+    Ptr<const PhasedArrayModel> phasedArrayModel) const
 {
-    NS_LOG_FUNCTION(this);
-
-    // Get the relative angles between tx and rx phased arrays
-    Angles aAngle(b->GetPosition(), a->GetPosition());
-    Angles bAngle(a->GetPosition(), b->GetPosition());
-
-    // Compute the beamforming vectors and and array responses
-    auto aArrayResponse = aPhasedArrayModel->GetSteeringVector(aAngle);
-    auto aAntennaFields = aPhasedArrayModel->GetElementFieldPattern(aAngle);
-    auto aBfVector = aPhasedArrayModel->GetBeamformingVector();
-    auto bArrayResponse = bPhasedArrayModel->GetSteeringVector(bAngle);
-    auto bAntennaFields = bPhasedArrayModel->GetElementFieldPattern(bAngle);
-    auto bBfVector = bPhasedArrayModel->GetBeamformingVector();
-
-    std::complex<double> aArrayOverallResponse = 0;
-    std::complex<double> bArrayOverallResponse = 0;
-
-    // Compute the dot products between the array responses and the beamforming vectors
-    for (size_t i = 0; i < aPhasedArrayModel->GetNumberOfElements(); i++)
+    auto bfVector = phasedArrayModel->GetBeamformingVector();
+    std::vector<std::complex<double>> w(phasedArrayModel->GetNumberOfElements());
+    for (size_t i = 0; i < w.size(); i++)
     {
-        aArrayOverallResponse += aArrayResponse[i] * aBfVector[i];
+        w[i] = bfVector[i];
     }
-    for (size_t i = 0; i < bPhasedArrayModel->GetNumberOfElements(); i++)
-    {
-        bArrayOverallResponse += bArrayResponse[i] * bBfVector[i];
-    }
-
-    double gain = norm(aArrayOverallResponse) *
-                  (std::pow(aAntennaFields.first, 2) + std::pow(aAntennaFields.second, 2)) *
-                  norm(bArrayOverallResponse) *
-                  (std::pow(bAntennaFields.first, 2) + std::pow(bAntennaFields.second, 2));
-
-    // Retrieve LOS condition to check if a correction factor needs to be introduced
-    //ChannelCondition::LosConditionValue cond = GetLosCondition(a, b);
-    //if (cond == ChannelCondition::NLOS)
-    //{
-        // The linear penalty factor to be multiplied to the beamforming gain whenever the link is
-        // in NLOS
-    //    constexpr double NLOS_BEAMFORMING_FACTOR = 1.0 / 19;
-    //    gain *= NLOS_BEAMFORMING_FACTOR;
-    //}
-
-    return gain;
+    return w;
 }
 
 Ptr<SpectrumValue>
@@ -149,8 +88,9 @@ SionnaPhasedArraySpectrumPropagationLossModel::DoCalcRxPowerSpectralDensity(
     Ptr<const PhasedArrayModel> bPhasedArrayModel) const
 {
     NS_LOG_FUNCTION(this);
-    uint32_t aId = a->GetObject<Node>()->GetId(); // Id of the node a
-    uint32_t bId = b->GetObject<Node>()->GetId(); // Id of the node b
+    // node IDs are cached by the Sionna mobility model
+    uint32_t aId = DynamicCast<const SionnaMobilityModel>(a)->GetNodeId(); // Id of the node a
+    uint32_t bId = DynamicCast<const SionnaMobilityModel>(b)->GetNodeId(); // Id of the node b
 
     NS_ASSERT_MSG(aId != bId, "The two nodes must be different from one another");
     NS_ASSERT_MSG(a->GetDistanceFrom(b) > 0.0,
@@ -160,34 +100,62 @@ SionnaPhasedArraySpectrumPropagationLossModel::DoCalcRxPowerSpectralDensity(
 
     // Retrieve the antenna of device a
     NS_ASSERT_MSG(aPhasedArrayModel, "Antenna not found for node " << aId);
-    NS_LOG_DEBUG("a node " << a->GetObject<Node>() << " antenna " << aPhasedArrayModel);
+    NS_LOG_DEBUG("a node " << aId << " antenna " << aPhasedArrayModel);
 
     // Retrieve the antenna of the device b
     NS_ASSERT_MSG(bPhasedArrayModel, "Antenna not found for device " << bId);
     NS_LOG_DEBUG("b node " << bId << " antenna " << bPhasedArrayModel);
 
-    // Retrieve FTR params from table
-    //FtrParams ftrParams = GetFtrParameters(a, b);
+    // single lookup for the channel matrices and the SISO CFR of this link
+    const SionnaPropagationCache::CacheEntry& entry = m_propagationCache->GetPropagationEntry(a, b);
 
-    // get small-scale fading matrix
-    std::vector<std::complex<double>> H_norm = m_propagationCache->GetPropagationCSI(a, b);
-    // todo: apply
+    // band of the signal: the channel matrices are only available for the primary band
+    uint32_t band = 0;
+    const SionnaHelper* sionnaHelper = m_propagationCache->GetSionnaHelper();
+    if (sionnaHelper->GetNumBands() > 1)
+    {
+        band = sionnaHelper->GetBand(
+            (params->psd->GetSpectrumModel()->Begin()->fc + (params->psd->GetSpectrumModel()->End()-1)->fc) / 2);
+    }
 
-    auto vit = rxPsd->ValuesBegin();      // psd iterator
-    //auto sbit = tempPsd->ConstBandsBegin(); // band iterator
-    int cnt = 0;
-    while (vit != rxPsd->ValuesEnd())
+    if ((!entry.m_mimo_cfr && !entry.m_mimo_cfr_float) || band != 0)
     {
-        cnt++;
-        vit++;
+        NS_ASSERT_MSG(entry.GetCfrPowerSize(band) == rxPsd->GetValuesN(), "PSD and CFR must have the same size");
+        entry.ApplyCfrPower(band, &(*rxPsd->ValuesBegin()));
+        return rxPsd;
     }
-    std::cout << cnt << std::endl;
 
-    // Compute the beamforming gain
-    double bfGain = 1.0; //CalcBeamformingGain(a, b, aPhasedArrayModel, bPhasedArrayModel);
+    size_t num_antennas = sionnaHelper->GetNumAntennas();
+    NS_ASSERT_MSG(aPhasedArrayModel->GetNumberOfElements() == num_antennas &&
+                  bPhasedArrayModel->GetNumberOfElements() == num_antennas,
+                  "The antenna arrays must have as many elements as configured in the SionnaHelper");
+    // CfrPrecision Float: the gain is computed from the single precision matrices
+    size_t num_mimo_cfr = entry.m_mimo_cfr ? entry.m_mimo_cfr->size() : entry.m_mimo_cfr_float->size();
+    size_t num_subcarrier = num_mimo_cfr / (num_antennas * num_antennas);
+    NS_ASSERT_MSG(num_subcarrier + 1 == rxPsd->GetValuesN(), "PSD and CFR must have the same size");
+
+    // the matrices are stored from the TX of the entry to its RX; reciprocity for the reverse direction
+    std::vector<std::complex<double>> aW = GetBeamformingVector(aPhasedArrayModel);
+    std::vector<std::complex<double>> bW = GetBeamformingVector(bPhasedArrayModel);
+    bool forward = entry.m_a == aId;
+    const std::vector<std::complex<double>>& rowW = forward ? bW : aW;
+    const std::vector<std::complex<double>>& colW = forward ? aW : bW;
+
+    // |w_b^T H w_a|^2 per subcarrier; the trailing PSD bin is left as is like in the SISO CFR
+    std::vector<double> gain(rxPsd->GetValuesN());
+    if (entry.m_mimo_cfr)
+    {
+        CfrBeamformingGain(entry.m_mimo_cfr->data(), num_subcarrier, rowW.data(), num_antennas, colW.data(),
+                           num_antennas, gain.data());
+    }
+    else
+    {
+        CfrBeamformingGain(entry.m_mimo_cfr_float->data(), num_subcarrier, rowW.data(), num_antennas,
+                           colW.data(), num_antennas, gain.data());
+    }
+    gain.back() = 1.0;
 
-    // Apply the above terms to the TX PSD
-    *rxPsd *= (1.0 * bfGain);
+    CfrApplyPower(&(*rxPsd->ValuesBegin()), gain.data(), gain.size());
 
     return rxPsd;
 }
@@ -197,10 +165,7 @@ int64_t
 SionnaPhasedArraySpectrumPropagationLossModel::AssignStreams(int64_t stream)
 {
     NS_LOG_FUNCTION(this << stream);
-    //m_normalRv->SetStream(stream);
-    //m_uniformRv->SetStream(stream + 1);
-    //m_gammaRv->SetStream(stream + 2);
-    return 0; //3;
+    return 0;
 }
 
 } // namespace ns3
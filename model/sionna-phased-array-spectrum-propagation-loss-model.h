@@ -24,9 +24,8 @@
 #include "ns3/spectrum-signal-parameters.h"
 #include "sionna-propagation-cache.h"
 
-#include "ns3/channel-condition-model.h"
-
-#include <map>
+#include <complex>
+#include <vector>
 
 namespace ns3
 {
@@ -34,7 +33,11 @@ namespace ns3
 /**
  * Sionna Phased Array Spectrum Propagation Loss Model
  *
- * TODO: not yet implemented
+ * Small-scale fading and beamforming gain from the CFR between all antenna pairs traced by
+ * Sionna (see SionnaHelper::SetAntennaArray). The channel matrices are cached per link, i.e. a
+ * change of the beamforming vectors does not require retracing. The element patterns are part
+ * of the traced paths; those of the PhasedArrayModels are not applied. The propagation loss is
+ * the one of the first antenna pair and is computed separately by SionnaPropagationLossModel.
  */
 class SionnaPhasedArraySpectrumPropagationLossModel : public PhasedArraySpectrumPropagationLossModel
 {
@@ -65,19 +68,17 @@ class SionnaPhasedArraySpectrumPropagationLossModel : public PhasedArraySpectrum
      * used by this model.
      *
      * \param stream first stream index to use
-     * \return the number of stream indices assigned by this model
+     * \return the number of stream indices assigned by this model; none as the model is deterministic
      */
     int64_t AssignStreams(int64_t stream);
 
     /**
      * \brief Compute the received PSD.
      *
-     * This function computes the received PSD by applying the Fluctuating Two-Ray (FTR)
-     * fast fading model and the beamforming gain.
-     * In particular, the beamforming gain is computed as the combination of the single-element
-     * and the array gains.
-     * The path loss and shadowing are to be computed separately, using the
-     * ThreeGppPropagationLossModel class.
+     * Multiplies each PSD bin with |w_b^T H w_a|^2 of its subcarrier, where H is the cached
+     * channel matrix of the link and w_a, w_b are the current beamforming vectors. Links without
+     * channel matrices (single antenna, culled links) and additional bands get the CFR power of
+     * the SISO channel like in SionnaSpectrumPropagationLossModel.
      *
      * \param txPsd the PSD of the transmitted signal
      * \param a first node mobility model
@@ -94,32 +95,8 @@ class SionnaPhasedArraySpectrumPropagationLossModel : public PhasedArraySpectrum
         Ptr<const PhasedArrayModel> bPhasedArrayModel) const override;
 
   private:
-    /**
-     * Compute the beamforming gain by combining single-element and array gains.
-     *
-     * Computes the overall beamforming and array gain, assuming analog beamforming
-     * both at the transmitter and at the receiver and arbitrary single-element
-     * radiation patterns. The computation is performed following Rebato, Mattia, et al.
-     * "Study of realistic antenna patterns in 5G mmwave cellular scenarios.",
-     * 2018 IEEE International Conference on Communications (ICC). IEEE, 2018.
-     *
-     * Additionally, whenever the link is in NLOS a penalty factor is introduced, to take into
-     * account for the possible misalignment of the beamforming vectors due to the lack of a
-     * dominant multipath component. See Kulkarni, Mandar N., Eugene Visotsky, and Jeffrey G.
-     * Andrews. "Correction factor for analysis of MIMO wireless networks with highly directional
-     * beamforming." IEEE Wireless Communications Letters 7.5 (2018) for further details on this
-     * approach.
-     *
-     * \param a first node mobility model
-     * \param b second node mobility model
-     * \param aPhasedArrayModel the antenna array of the first node
-     * \param bPhasedArrayModel the antenna array of the second node
-     * \return the beamforming gain
-     */
-    double CalcBeamformingGain(Ptr<const MobilityModel> a,
-                               Ptr<const MobilityModel> b,
-                               Ptr<const PhasedArrayModel> aPhasedArrayModel,
-                               Ptr<const PhasedArrayModel> bPhasedArrayModel) const;
+    // beamforming vector of an array; must have one element per antenna of SionnaHelper
+    std::vector<std::complex<double>> GetBeamformingVector(Ptr<const PhasedArrayModel> phasedArrayModel) const;
 
     Ptr<SionnaPropagationCache> m_propagationCache;
 };
@@ -11,10 +11,24 @@
 #include "message.pb.h"
 #include "sionna-mobility-model.h"
 
+#include "ns3/abort.h"
+#include "ns3/boolean.h"
+#include "ns3/enum.h"
 #include "ns3/log.h"
 #include "ns3/node.h"
+#include "ns3/node-list.h"
 #include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
 #include <sstream>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace ns3
 {
@@ -23,6 +37,19 @@ NS_LOG_COMPONENT_DEFINE("SionnaPropagationCache");
 
 NS_OBJECT_ENSURE_REGISTERED(SionnaPropagationCache);
 
+namespace
+{
+
+// unique per cache; the address of a destroyed cache may be reused and hit a stale memo
+uint64_t
+NextInstance()
+{
+    static std::atomic<uint64_t> instances(0);
+    return instances++;
+}
+
+} // namespace
+
 TypeId
 SionnaPropagationCache::GetTypeId()
 {
@@ -30,94 +57,290 @@ SionnaPropagationCache::GetTypeId()
         TypeId("ns3::SionnaPropagationCache")
             .SetParent<Object>()
             .SetGroupName("Propagation")
-            .AddConstructor<SionnaPropagationCache>();
+            .AddConstructor<SionnaPropagationCache>()
+            .AddAttribute("MaxEntryAge",
+                          "Entries whose start time is older than this are evicted even if they "
+                          "are still valid. Zero disables age-based eviction.",
+                          TimeValue(Seconds(0)),
+                          MakeTimeAccessor(&SionnaPropagationCache::m_max_entry_age),
+                          MakeTimeChecker())
+            .AddAttribute("MaxEntriesPerLink",
+                          "Maximum number of cached entries per link; the entry expiring first is "
+                          "evicted. Zero means unlimited.",
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::m_max_entries_per_link),
+                          MakeUintegerChecker<uint32_t>())
+            .AddAttribute("PrefetchHorizon",
+                          "A link whose cached entry expires within this time is requested ahead of "
+                          "time. Requires prefetching enabled on the SionnaHelper. Zero disables it.",
+                          TimeValue(Seconds(0)),
+                          MakeTimeAccessor(&SionnaPropagationCache::m_prefetch_horizon),
+                          MakeTimeChecker())
+            .AddAttribute("MaxPendingPrefetches",
+                          "Maximum number of prefetch requests in flight. A true miss has to wait "
+                          "for all of them as the server answers in order.",
+                          UintegerValue(2),
+                          MakeUintegerAccessor(&SionnaPropagationCache::m_max_pending_prefetches),
+                          MakeUintegerChecker<uint32_t>(1))
+            .AddAttribute("MaxBatchLinks",
+                          "Maximum number of links requested within a single round trip on a cache "
+                          "miss; the server traces all their transmitters at once. One disables "
+                          "batching. Not supported in MODE_P2MP_LAH as batches have no lookahead.",
+                          UintegerValue(1),
+                          MakeUintegerAccessor(&SionnaPropagationCache::m_max_batch_links),
+                          MakeUintegerChecker<uint32_t>(1))
+            .AddAttribute("StaticLinks",
+                          "Keep the CSI of links whose nodes do not move until the position of "
+                          "either node changes instead of until the coherence time has passed. "
+                          "Such entries are not subject to MaxEntryAge.",
+                          BooleanValue(true),
+                          MakeBooleanAccessor(&SionnaPropagationCache::m_static_links),
+                          MakeBooleanChecker())
+            .AddAttribute("MaxMemory",
+                          "Maximum number of bytes held by the cached entries incl. their CFRs; "
+                          "the least recently used entries are evicted down to 90% of it, entries "
+                          "of the future not yet used last. Zero means unlimited.",
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::m_max_memory),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("CfrPrecision",
+                          "Precision in which the CFRs of the cached entries are stored. Float "
+                          "halves their memory; |H|^2 is applied to the PSD in single precision and "
+                          "only tagging or GetPropagationCSI convert the CFR back to double.",
+                          EnumValue(SionnaPropagationCache::CFR_PRECISION_DOUBLE),
+                          MakeEnumAccessor(&SionnaPropagationCache::m_cfr_precision),
+                          MakeEnumChecker(SionnaPropagationCache::CFR_PRECISION_DOUBLE,
+                                          "Double",
+                                          SionnaPropagationCache::CFR_PRECISION_FLOAT,
+                                          "Float"))
+            .AddAttribute("Hits",
+                          "Number of lookups answered from the cache.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetHits),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("Misses",
+                          "Number of lookups which required a request to the Sionna server.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetMisses),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("Evictions",
+                          "Number of entries evicted by the garbage collection.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetEvictions),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("Prefetches",
+                          "Number of non-blocking prefetch requests sent.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetPrefetches),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("Culled",
+                          "Number of lookups answered without ray tracing due to link culling.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetCulled),
+                          MakeUintegerChecker<uint64_t>())
+            .AddAttribute("MemoryUsage",
+                          "Number of bytes currently held by the cached entries.",
+                          TypeId::ATTR_GET,
+                          UintegerValue(0),
+                          MakeUintegerAccessor(&SionnaPropagationCache::GetMemoryUsage),
+                          MakeUintegerChecker<uint64_t>())
+            .AddTraceSource("CacheHit",
+                            "A lookup was answered from the cache.",
+                            MakeTraceSourceAccessor(&SionnaPropagationCache::m_hitTrace),
+                            "ns3::SionnaPropagationCache::LinkTracedCallback")
+            .AddTraceSource("CacheMiss",
+                            "A lookup required a request to the Sionna server.",
+                            MakeTraceSourceAccessor(&SionnaPropagationCache::m_missTrace),
+                            "ns3::SionnaPropagationCache::LinkTracedCallback")
+            .AddTraceSource("Eviction",
+                            "An entry was evicted before or after it expired.",
+                            MakeTraceSourceAccessor(&SionnaPropagationCache::m_evictTrace),
+                            "ns3::SionnaPropagationCache::LinkTracedCallback")
+            .AddTraceSource("ServerRoundTrip",
+                            "A reply of the Sionna server was received.",
+                            MakeTraceSourceAccessor(&SionnaPropagationCache::m_roundTripTrace),
+                            "ns3::SionnaPropagationCache::RoundTripTracedCallback");
     return tid;
 }
 
-SionnaPropagationCache::SionnaPropagationCache()
-    : m_sionnaHelper(nullptr), m_caching(true), m_cache_hits(0), m_cache_miss(0), m_optimize(true)
+SionnaPropagationCache::LinkTable::LinkTable()
+    : m_keys(64, EMPTY_KEY), m_links(64), m_size(0)
 {
-    m_friisLossModel = CreateObject<FriisPropagationLossModel>();
-    m_constSpeedDelayModel = CreateObject<ConstantSpeedPropagationDelayModel>();
 }
 
-SionnaPropagationCache::~SionnaPropagationCache()
+size_t
+SionnaPropagationCache::LinkTable::Slot(uint64_t key) const
 {
-    m_cache.clear();
+    // splitmix64 finalizer; table size is a power of two
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return static_cast<size_t>(key) & (m_keys.size() - 1);
 }
 
-Time
-SionnaPropagationCache::GetPropagationDelay(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+SionnaPropagationCache::LinkEntries*
+SionnaPropagationCache::LinkTable::Find(uint64_t key)
 {
-    // Check if distance is too far so that a simpler model can be used
-    if (m_optimize)
+    size_t mask = m_keys.size() - 1;
+    for (size_t i = Slot(key); m_keys[i] != EMPTY_KEY; i = (i + 1) & mask)
     {
-        const double MAX_TXPOWER_DBM = 20.0; // AZU: todo: hardcoded
-        double resultdBm = m_friisLossModel->CalcRxPower(MAX_TXPOWER_DBM, a, b);
-        if (resultdBm + m_optimize_margin < m_sionnaHelper->GetNoiseFloor())
+        if (m_keys[i] == key)
         {
-            Time const_delay = m_constSpeedDelayModel->GetDelay(a, b);
-            NS_LOG_DEBUG("Skipped raytracing for prop delay due to large distance; const delay used: " << const_delay);
-            return const_delay;
+            return &m_links[i];
         }
-        // signal is too strong and delay need to be computed with ray tracing
     }
-
-    return GetPropagationData(a, b).m_delay;
+    return nullptr;
 }
 
-double
-SionnaPropagationCache::GetPropagationLoss(Ptr<MobilityModel> a, Ptr<MobilityModel> b, double txPowerDbm) const
+SionnaPropagationCache::LinkEntries&
+SionnaPropagationCache::LinkTable::FindOrInsert(uint64_t key)
 {
-    // Check if distance is too far so that a simpler model can be used
-    if (m_optimize)
+    NS_ASSERT(key != EMPTY_KEY);
+    // keep load factor below 0.5
+    if (2 * (m_size + 1) > m_keys.size())
+    {
+        Grow();
+    }
+
+    size_t mask = m_keys.size() - 1;
+    size_t i = Slot(key);
+    while (m_keys[i] != EMPTY_KEY)
     {
-        double resultdBm = m_friisLossModel->CalcRxPower(txPowerDbm, a, b);
-        if (resultdBm + m_optimize_margin < m_sionnaHelper->GetNoiseFloor())
+        if (m_keys[i] == key)
         {
-            double friis_loss = (-1) * (resultdBm - txPowerDbm);
-            NS_LOG_DEBUG("Skipped raytracing for prop loss due to large distance; friis loss used: " << friis_loss);
-            return friis_loss;
+            return m_links[i];
         }
-        // signal is too strong and need to be computed with ray tracing
+        i = (i + 1) & mask;
     }
+    m_keys[i] = key;
+    m_size++;
+    return m_links[i];
+}
 
-    Vector pos_a = a->GetPosition();
-    Vector pos_b = b->GetPosition();
-
-    // update position on mobility models to reflect node position in Sionna
-    CacheEntry ce = GetPropagationData(a, b);
-
-    Ptr<Node> node_a = a->GetObject<Node>();
-    Ptr<Node> node_b = b->GetObject<Node>();
+void
+SionnaPropagationCache::LinkTable::Grow()
+{
+    std::vector<uint64_t> old_keys(2 * m_keys.size(), EMPTY_KEY);
+    std::vector<LinkEntries> old_links(2 * m_links.size());
+    old_keys.swap(m_keys);
+    old_links.swap(m_links);
 
-    // needed as the cache assumes channel reciprocity
-    if (node_a->GetId() == ce.m_a)
-    {
-        a->SetPosition(ce.m_a_position);
-        b->SetPosition(ce.m_b_position);
-    } else
+    size_t mask = m_keys.size() - 1;
+    for (size_t j = 0; j < old_keys.size(); j++)
     {
-        a->SetPosition(ce.m_b_position);
-        b->SetPosition(ce.m_a_position);
+        if (old_keys[j] == EMPTY_KEY)
+        {
+            continue;
+        }
+        size_t i = Slot(old_keys[j]);
+        while (m_keys[i] != EMPTY_KEY)
+        {
+            i = (i + 1) & mask;
+        }
+        m_keys[i] = old_keys[j];
+        m_links[i] = std::move(old_links[j]);
     }
+}
 
-    Time current_time = Simulator::Now();
-    if (pos_a != a->GetPosition())
+void
+SionnaPropagationCache::LinkTable::Clear()
+{
+    std::fill(m_keys.begin(), m_keys.end(), EMPTY_KEY);
+    for (auto& entries : m_links)
     {
-        NS_LOG_INFO("ns3sionna::update Pos for node: " << node_a->GetId() << " from " <<
-            ": (" << pos_a.x << "," << pos_a.y << "," << pos_a.z << ") to: " <<
-            ": (" << a->GetPosition().x << "," << a->GetPosition().y << "," << a->GetPosition().z << ")");
+        entries.clear();
     }
+    m_size = 0;
+}
+
+std::vector<SionnaPropagationCache::LinkEntries>&
+SionnaPropagationCache::LinkTable::GetLinks()
+{
+    return m_links;
+}
+
+const std::vector<uint64_t>&
+SionnaPropagationCache::LinkTable::GetKeys() const
+{
+    return m_keys;
+}
+
+SionnaPropagationCache::SionnaPropagationCache()
+    : m_sionnaHelper(nullptr), m_caching(true), m_instance(NextInstance()), m_cache_hits(0),
+      m_cache_miss(0), m_evicted_expired(0), m_evicted_age(0), m_evicted_capacity(0), m_evicted_memory(0),
+      m_bytes(0), m_max_memory(0), m_cfr_precision(CFR_PRECISION_DOUBLE), m_num_pending(0),
+      m_prefetches(0), m_lah_used(0), m_lah_unused(0),
+      m_prefetch_horizon(Seconds(0)), m_max_pending_prefetches(2), m_max_batch_links(1),
+      m_max_entry_age(Seconds(0)),
+      m_max_entries_per_link(0), m_static_links(true), m_optimize(true),
+      m_linkCullerConfigured(false), m_culled(0), m_cfr_synthesized(0),
+      m_precomputing(false), m_precompute_step(Seconds(0)), m_server_time(Time::Min())
+{
+    m_linkCuller = CreateObject<SionnaLinkCuller>();
+}
 
-    if (pos_b != b->GetPosition())
+SionnaPropagationCache::~SionnaPropagationCache()
+{
+    // the memos of other threads only hold weak handles to the entries
+    GetThreadMemos().erase(m_instance);
+    for (Shard& shard : m_shards)
     {
-        NS_LOG_INFO("ns3sionna::update Pos for node: " << node_b->GetId() << " from " <<
-            ": (" << pos_b.x << "," << pos_b.y << "," << pos_b.z << ") to: " <<
-            ": (" << b->GetPosition().x << "," << b->GetPosition().y << "," << b->GetPosition().z << ")");
+        shard.m_table.Clear();
     }
+}
+
+SionnaPropagationCache::Shard&
+SionnaPropagationCache::GetShard(uint64_t key) const
+{
+    // Fibonacci hashing; the table slot uses the low bits of another hash
+    return m_shards[(key * 0x9E3779B97F4A7C15ULL) >> (64 - SHARD_BITS)];
+}
+
+std::unordered_map<uint64_t, SionnaPropagationCache::LookupMemo>&
+SionnaPropagationCache::GetThreadMemos()
+{
+    static thread_local std::unordered_map<uint64_t, LookupMemo> memos;
+    return memos;
+}
+
+SionnaPropagationCache::LookupMemo&
+SionnaPropagationCache::GetMemo() const
+{
+    // element references of an unordered_map are stable
+    return GetThreadMemos()[m_instance];
+}
+
+bool
+SionnaPropagationCache::PinEntry(EntryHandle entry)
+{
+    // a single entry per thread, so that the reference returned by a lookup survives an
+    // eviction by another thread
+    static thread_local EntryHandle pinned;
+    pinned = std::move(entry);
+    return pinned != nullptr;
+}
 
-    return ce.m_loss;
+Time
+SionnaPropagationCache::GetPropagationDelay(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    // culled links: constant speed delay
+    return GetPropagationData(a, b).m_delay;
+}
+
+double
+SionnaPropagationCache::GetPropagationLoss(Ptr<MobilityModel> a, Ptr<MobilityModel> b, double txPowerDbm) const
+{
+    // culled links: Friis loss; the cull decision does not depend on txPowerDbm, i.e. it is the
+    // same for delay, loss and CSI. The node positions are pushed into the mobility models when
+    // the CSI is received.
+    return GetPropagationData(a, b).m_loss;
 }
 
 double
@@ -129,21 +352,43 @@ SionnaPropagationCache::GetPropagationLoss(Ptr<const MobilityModel> a, Ptr<const
     return GetPropagationData(tmp_a, tmp_b).m_loss;
 }
 
-std::vector<int>
+const std::vector<int>&
 SionnaPropagationCache::GetPropagationFreq(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const
 {
+    static const std::vector<int> no_freq;
     Ptr<MobilityModel> tmp_a = ConstCast<MobilityModel>(a);
     Ptr<MobilityModel> tmp_b = ConstCast<MobilityModel>(b);
-    return GetPropagationData(tmp_a, tmp_b).m_freq;
+    const FreqHandle& freq = GetPropagationData(tmp_a, tmp_b).m_freq;
+    return freq ? *freq : no_freq;
 }
 
 
 std::vector<std::complex<double>>
-SionnaPropagationCache::GetPropagationCSI(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const
+SionnaPropagationCache::GetPropagationCSI(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b, uint32_t band) const
+{
+    CfrHandle cfr = GetPropagationCSIHandle(a, b, band);
+    if (!cfr || cfr->empty())
+    {
+        return std::vector<std::complex<double>>();
+    }
+    // without the trailing PSD bin
+    return std::vector<std::complex<double>>(cfr->begin(), cfr->end() - 1);
+}
+
+CfrHandle
+SionnaPropagationCache::GetPropagationCSIHandle(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b,
+                                                uint32_t band) const
+{
+    NS_ASSERT_MSG(band < m_sionnaHelper->GetNumBands(), "Unknown band " << band);
+    return GetPropagationEntry(a, b).GetCfr(band);
+}
+
+const SionnaPropagationCache::CacheEntry&
+SionnaPropagationCache::GetPropagationEntry(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const
 {
     Ptr<MobilityModel> tmp_a = ConstCast<MobilityModel>(a);
     Ptr<MobilityModel> tmp_b = ConstCast<MobilityModel>(b);
-    return GetPropagationData(tmp_a, tmp_b).m_cfr;
+    return GetPropagationData(tmp_a, tmp_b);
 }
 
 void
@@ -170,109 +415,711 @@ SionnaPropagationCache::SetOptimize(bool optimize)
     m_optimize = optimize;
 }
 
+void
+SionnaPropagationCache::SetLinkCuller(Ptr<SionnaLinkCuller> linkCuller)
+{
+    m_linkCuller = linkCuller;
+    m_linkCullerConfigured = false;
+}
+
+Ptr<SionnaLinkCuller>
+SionnaPropagationCache::GetLinkCuller() const
+{
+    return m_linkCuller;
+}
+
 double
 SionnaPropagationCache::GetStats()
 {
-    double ratio = m_cache_hits / (m_cache_hits + m_cache_miss);
-    return ratio;
+    double hits = m_cache_hits;
+    double lookups = hits + m_cache_miss;
+    return lookups > 0 ? hits / lookups : 0.0;
+}
+
+uint64_t
+SionnaPropagationCache::GetHits() const
+{
+    return m_cache_hits;
+}
+
+uint64_t
+SionnaPropagationCache::GetMisses() const
+{
+    return m_cache_miss;
+}
+
+uint64_t
+SionnaPropagationCache::GetEvictions() const
+{
+    return m_evicted_expired + m_evicted_age + m_evicted_capacity + m_evicted_memory;
+}
+
+uint64_t
+SionnaPropagationCache::GetPrefetches() const
+{
+    return m_prefetches;
+}
+
+uint64_t
+SionnaPropagationCache::GetCulled() const
+{
+    return m_culled;
+}
+
+uint64_t
+SionnaPropagationCache::GetLookaheadUsed() const
+{
+    return m_lah_used;
+}
+
+uint64_t
+SionnaPropagationCache::GetLookaheadUnused() const
+{
+    return m_lah_unused;
+}
+
+uint64_t
+SionnaPropagationCache::GetMemoryUsage() const
+{
+    return m_bytes;
 }
 
 void SionnaPropagationCache::PrintStats()
 {
     std::cout << "Ns3-sionna: cache #lookups: " <<  (m_cache_hits + m_cache_miss) << ", #misses:"
-        << m_cache_miss << ", hit ratio: " <<  this->GetStats() << std::endl;
+        << m_cache_miss << ", hit ratio: " <<  this->GetStats() << ", #evictions: " << GetEvictions()
+        << " (expired: " << m_evicted_expired << ", age: " << m_evicted_age
+        << ", capacity: " << m_evicted_capacity << ", memory: " << m_evicted_memory << "), #prefetches: " << m_prefetches
+        << ", #culled: " << m_culled << ", #lookahead used: " << m_lah_used << ", unused: " << m_lah_unused
+        << ", #synthesized CFRs: " << m_cfr_synthesized << ", memory: " << m_bytes << " bytes" << std::endl;
 }
 
+const SionnaPropagationCache::EntryHandle*
+SionnaPropagationCache::FindEntry(LinkEntries& entries, Time now) const
+{
+    // first entry starting after now
+    auto it = std::upper_bound(entries.begin(), entries.end(), now,
+        [](const Time& t, const EntryHandle& e) { return t < e->m_start_time; });
 
-SionnaPropagationCache::CacheEntry
-SionnaPropagationCache::GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+    // walk back to the latest started entry that is still valid
+    while (it != entries.begin())
+    {
+        --it;
+        if ((*it)->m_end_time >= now)
+        {
+            return &(*it);
+        }
+    }
+    return nullptr;
+}
+
+uint32_t
+SionnaPropagationCache::GetNodeId(Ptr<const MobilityModel> m)
 {
-    NS_ASSERT_MSG(m_sionnaHelper, "SionnaPropagationCache must have reference to SionnaHelper.");
-    Ptr<SionnaMobilityModel> sionna_a = DynamicCast<SionnaMobilityModel> (a);
-    Ptr<SionnaMobilityModel> sionna_b = DynamicCast<SionnaMobilityModel> (b);
-    NS_ASSERT_MSG(sionna_a && sionna_b, "Not using SionnaMobilityModel.");
+    NS_ASSERT_MSG(DynamicCast<const SionnaMobilityModel>(m), "Not using SionnaMobilityModel.");
+    return static_cast<const SionnaMobilityModel*>(PeekPointer(m))->GetNodeId();
+}
 
-    Time current_time = Simulator::Now();
+bool
+SionnaPropagationCache::IsAtEntryPosition(const CacheEntry& entry, uint32_t id_a, Ptr<const MobilityModel> a,
+                                          Ptr<const MobilityModel> b)
+{
+    // tolerance in m; positions are exchanged as double with the server
+    const double MAX_POSITION_DELTA = 1e-6;
+    const Vector& pos_a = id_a == entry.m_a ? entry.m_a_position : entry.m_b_position;
+    const Vector& pos_b = id_a == entry.m_a ? entry.m_b_position : entry.m_a_position;
+    return CalculateDistance(a->GetPosition(), pos_a) <= MAX_POSITION_DELTA &&
+           CalculateDistance(b->GetPosition(), pos_b) <= MAX_POSITION_DELTA;
+}
 
-    Ptr<Node> node_a = a->GetObject<Node>();
-    Ptr<Node> node_b = b->GetObject<Node>();
-    NS_ASSERT_MSG(node_a && node_b, "Nodes not found.");
+void
+SionnaPropagationCache::InsertEntry(LinkEntries& entries, const CacheEntry& entry) const
+{
+    auto pos = std::upper_bound(entries.begin(), entries.end(), entry.m_start_time,
+        [](const Time& t, const EntryHandle& e) { return t < e->m_start_time; });
+    entries.insert(pos, std::make_shared<const CacheEntry>(entry));
 
-    NS_LOG_DEBUG("ns3sionna::GetPropagationData for lnk: " << node_a->GetId() << " to " << node_b->GetId());
+    while (m_max_entries_per_link > 0 && entries.size() > m_max_entries_per_link)
+    {
+        auto victim = std::min_element(entries.begin(), entries.end(),
+            [](const EntryHandle& x, const EntryHandle& y) { return x->m_end_time < y->m_end_time; });
+        MarkEvicted(**victim);
+        entries.erase(victim);
+        m_evicted_capacity++;
+    }
+}
 
-    if (m_caching)
+void
+SionnaPropagationCache::InsertLinkEntry(uint64_t key, const CacheEntry& entry, Time now) const
+{
+    CacheEntry stored = entry;
+    // synthesized entries keep their paths and replace the CFR on every lookup
+    if (m_cfr_precision == CFR_PRECISION_FLOAT && !stored.m_paths)
+    {
+        CompactEntry(stored);
+    }
+    stored.m_size = static_cast<uint32_t>(GetEntrySize(stored));
+    stored.m_last_used = now;
+    m_bytes += stored.m_size;
+    if (stored.m_lookahead)
     {
-        //NS_LOG_INFO("Check cache");
-        // Look in the cache and check if delay and loss have already been calculated for the two nodes
-        CacheKey key = CacheKey(node_a->GetId(), node_b->GetId());
-        auto it = m_cache.find(key);
+        std::lock_guard<std::mutex> lock(m_feedback_mutex);
+        m_lah_steps[std::make_pair(stored.m_a, stored.m_start_time.GetNanoSeconds())].m_entries++;
+    }
 
-        if (it != m_cache.end())
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    InsertEntry(shard.m_table.FindOrInsert(key), stored);
+    shard.m_generation++;
+}
+
+size_t
+SionnaPropagationCache::GetEntrySize(const CacheEntry& entry)
+{
+    // the frequencies are shared by all entries and not counted
+    size_t size = sizeof(CacheEntry) + entry.m_bands.capacity() * sizeof(CacheEntry::BandCfr);
+    auto add = [&size](const auto& handle) {
+        if (handle)
         {
-            //NS_LOG_INFO(" Cache entry found but need to check if expired ");
-            // remove outdated entries
-            std::vector<CacheEntry>::iterator vec_it = it->second.begin();
-            while (vec_it != it->second.end()) {
-                if (vec_it->m_end_time < current_time) {
-                    vec_it = it->second.erase(vec_it);
-                } else {
-                    ++vec_it;
-                }
-            }
+            size += handle->capacity() * sizeof(handle->front());
+        }
+    };
+    add(entry.m_cfr);
+    add(entry.m_cfr_power);
+    add(entry.m_cfr_float);
+    add(entry.m_cfr_power_float);
+    add(entry.m_mimo_cfr);
+    add(entry.m_mimo_cfr_float);
+    for (const CacheEntry::BandCfr& band : entry.m_bands)
+    {
+        add(band.m_cfr);
+        add(band.m_cfr_power);
+        add(band.m_cfr_float);
+        add(band.m_cfr_power_float);
+    }
+    if (entry.m_paths)
+    {
+        size += sizeof(CfrPaths) + entry.m_paths->m_gain.capacity() * sizeof(std::complex<double>) +
+                (entry.m_paths->m_delay.capacity() + entry.m_paths->m_doppler.capacity()) * sizeof(double);
+    }
+    return size;
+}
+
+void
+SionnaPropagationCache::CompactEntry(CacheEntry& entry)
+{
+    if (entry.m_cfr)
+    {
+        entry.m_cfr_float = CfrToFloat(*entry.m_cfr);
+        entry.m_cfr_power_float = CfrPowerToFloat(*entry.m_cfr_power);
+        entry.m_cfr = nullptr;
+        entry.m_cfr_power = nullptr;
+    }
+    if (entry.m_mimo_cfr)
+    {
+        entry.m_mimo_cfr_float = CfrToFloat(*entry.m_mimo_cfr);
+        entry.m_mimo_cfr = nullptr;
+    }
+    for (CacheEntry::BandCfr& band : entry.m_bands)
+    {
+        if (band.m_cfr)
+        {
+            band.m_cfr_float = CfrToFloat(*band.m_cfr);
+            band.m_cfr_power_float = CfrPowerToFloat(*band.m_cfr_power);
+            band.m_cfr = nullptr;
+            band.m_cfr_power = nullptr;
+        }
+    }
+}
 
-            // iterate over all stored entries for that link
-            for (CacheEntry c_entry : it->second) {
-                //NS_LOG_INFO(" " << c_entry.m_start_time << " " << c_entry.m_end_time << " " << current_time);
-                // If delay and loss exist in the cache, check if the entry is not outdated
-                if (c_entry.m_end_time >= current_time && c_entry.m_start_time <= current_time)
+void
+SionnaPropagationCache::EnforceMemoryBudget(Time now) const
+{
+    if (m_max_memory == 0 || m_bytes <= m_max_memory)
+    {
+        return;
+    }
+
+    // all shards at once, in index order; everybody else holds at most one of them
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(NUM_SHARDS);
+    for (Shard& shard : m_shards)
+    {
+        locks.emplace_back(shard.m_mutex);
+    }
+
+    // eviction order: least recently used first; entries of the future which have not been
+    // used yet (prefetched, lookahead) last, the farthest first; ties in table order
+    struct Candidate
+    {
+        bool m_future;
+        Time m_order;
+        size_t m_index;
+        const CacheEntry* m_entry;
+    };
+    std::vector<Candidate> candidates;
+    for (Shard& shard : m_shards)
+    {
+        for (const auto& entries : shard.m_table.GetLinks())
+        {
+            for (const EntryHandle& e : entries)
+            {
+                if (e->m_last_used >= now)
                 {
-                    NS_LOG_DEBUG("\t: Cache hit for lnk: " << node_a->GetId() << " to " << node_b->GetId());
-                    m_cache_hits += 1;
-                    // Return cache entry as the value is still fresh
-                    return c_entry;
+                    // used resp. inserted by the current event
+                    continue;
                 }
+                bool future = !e->m_used && e->m_start_time > now;
+                candidates.push_back(Candidate{future, future ? Time() - e->m_start_time : e->m_last_used,
+                                               candidates.size(), e.get()});
             }
         }
     }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y) {
+        return std::tie(x.m_future, x.m_order, x.m_index) < std::tie(y.m_future, y.m_order, y.m_index);
+    });
 
-    NS_LOG_INFO("\t: Cache miss for lnk: " << node_a->GetId() << " to " << node_b->GetId());
-    m_cache_miss += 1;
+    // one by one until the usage drops to 90% of the budget
+    uint64_t target = m_max_memory / 10 * 9;
+    uint64_t freed = 0;
+    std::unordered_set<const CacheEntry*> victims;
+    for (const Candidate& candidate : candidates)
+    {
+        if (m_bytes - freed <= target)
+        {
+            break;
+        }
+        freed += candidate.m_entry->m_size;
+        victims.insert(candidate.m_entry);
+    }
+    if (victims.empty())
+    {
+        // only entries of the current time
+        return;
+    }
+
+    for (Shard& shard : m_shards)
+    {
+        bool erased = false;
+        for (auto& entries : shard.m_table.GetLinks())
+        {
+            auto last = std::remove_if(entries.begin(), entries.end(),
+                [&](const EntryHandle& e) {
+                    if (victims.count(e.get()))
+                    {
+                        MarkEvicted(*e);
+                        m_evicted_memory++;
+                        return true;
+                    }
+                    return false;
+                });
+            erased |= (last != entries.end());
+            entries.erase(last, entries.end());
+        }
+        if (erased)
+        {
+            shard.m_generation++;
+        }
+    }
+    NS_LOG_DEBUG("\t: Memory budget exceeded, usage now " << m_bytes << " bytes");
+}
+
+void
+SionnaPropagationCache::CollectGarbage(Time now) const
+{
+    bool age_limit = m_max_entry_age.IsStrictlyPositive();
+    for (Shard& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        bool erased = false;
+        for (auto& entries : shard.m_table.GetLinks())
+        {
+            auto last = std::remove_if(entries.begin(), entries.end(),
+                [&](const EntryHandle& e) {
+                    if (e->m_end_time < now)
+                    {
+                        MarkEvicted(*e);
+                        m_evicted_expired++;
+                        return true;
+                    }
+                    if (age_limit && !e->m_static && e->m_start_time + m_max_entry_age < now)
+                    {
+                        MarkEvicted(*e);
+                        m_evicted_age++;
+                        return true;
+                    }
+                    return false;
+                });
+            erased |= (last != entries.end());
+            entries.erase(last, entries.end());
+        }
+        if (erased)
+        {
+            shard.m_generation++;
+        }
+    }
+}
+
+void
+SionnaPropagationCache::MarkUsed(const CacheEntry& entry) const
+{
+    if (entry.m_used)
+    {
+        return;
+    }
+    entry.m_used = true;
+    if (entry.m_lookahead)
+    {
+        std::lock_guard<std::mutex> lock(m_feedback_mutex);
+        // the feedback counts steps: used as soon as any of its entries is
+        auto step = m_lah_steps.find(std::make_pair(entry.m_a, entry.m_start_time.GetNanoSeconds()));
+        if (step != m_lah_steps.end() && !step->second.m_used)
+        {
+            step->second.m_used = true;
+            m_lah_feedback[entry.m_a].m_used++;
+        }
+        m_lah_used++;
+    }
+}
+
+void
+SionnaPropagationCache::MarkEvicted(const CacheEntry& entry) const
+{
+    m_bytes -= entry.m_size;
+    m_evictTrace(entry.m_a, entry.m_b);
+    if (entry.m_lookahead)
+    {
+        std::lock_guard<std::mutex> lock(m_feedback_mutex);
+        // unused once all entries of the step are evicted without any lookup
+        auto step = m_lah_steps.find(std::make_pair(entry.m_a, entry.m_start_time.GetNanoSeconds()));
+        if (step != m_lah_steps.end() && --step->second.m_entries == 0)
+        {
+            if (!step->second.m_used)
+            {
+                m_lah_feedback[entry.m_a].m_unused++;
+            }
+            m_lah_steps.erase(step);
+        }
+        if (!entry.m_used)
+        {
+            m_lah_unused++;
+        }
+    }
+}
+
+void
+SionnaPropagationCache::CheckRequestTime(Time t) const
+{
+    // the server advances its mobility with every request
+    NS_ABORT_MSG_IF(t < m_server_time, "ns3sionna: request at " << t.GetNanoSeconds() << "ns precedes the "
+                    << m_server_time.GetNanoSeconds() << "ns already requested from the server; entries of a "
+                    "trajectory sweep must not be evicted or prefetched before its end");
+    m_server_time = t;
+}
+
+void
+SionnaPropagationCache::SendChannelStateRequest(uint32_t a, uint32_t b, Time now, bool prefetch) const
+{
+    CheckRequestTime(now);
 
     // Prepare the request message
     ns3sionna::Wrapper wrapper;
 
     // Fill the information message
     ns3sionna::ChannelStateRequest* propagation_request = wrapper.mutable_channel_state_request();
-    propagation_request->set_tx_node(node_a->GetId());
-    propagation_request->set_rx_node(node_b->GetId());
-    propagation_request->set_time(current_time.GetNanoSeconds());
-    
-    // Serialize the request message
-    std::string serialized_message;
-    wrapper.SerializeToString(&serialized_message);
+    propagation_request->set_tx_node(a);
+    propagation_request->set_rx_node(b);
+    propagation_request->set_time(now.GetNanoSeconds());
+    propagation_request->set_shm_consumed(m_sionnaHelper->GetSharedMemoryConsumed());
+
+    // outcome of the lookahead since the last request
+    {
+        std::lock_guard<std::mutex> lock(m_feedback_mutex);
+        for (const auto& feedback : m_lah_feedback)
+        {
+            ns3sionna::ChannelStateRequest::LookaheadFeedback* lah_feedback = propagation_request->add_lah_feedback();
+            lah_feedback->set_tx_node(feedback.first);
+            lah_feedback->set_used(feedback.second.m_used);
+            lah_feedback->set_unused(feedback.second.m_unused);
+        }
+        m_lah_feedback.clear();
+    }
 
     // Send the request message
-    zmq::message_t zmq_message(serialized_message.data(), serialized_message.size());
-    m_sionnaHelper->m_zmq_socket.send(zmq_message, zmq::send_flags::none);
+    m_sionnaHelper->SendMessage(wrapper);
+    m_pending.push_back(PendingRequest{CacheKey(a, b).m_key, prefetch});
+    m_num_pending = m_pending.size();
+}
 
-    // Receive the reply message
-    zmq::message_t zmq_reply;
-    zmq::recv_result_t result = m_sionnaHelper->m_zmq_socket.recv(zmq_reply, zmq::recv_flags::none);
-    
-    NS_ASSERT_MSG(result, "Failed to receive reply after propagation request message.");
+void
+SionnaPropagationCache::SendBatchChannelStateRequest(uint32_t a, uint32_t b, Time now) const
+{
+    CheckRequestTime(now);
 
-    // Check if the reply message is a propagation response
-    ns3sionna::Wrapper reply_wrapper;
-    reply_wrapper.ParseFromArray(zmq_reply.data(), zmq_reply.size());
-    //NS_LOG_INFO("ZMQ::CSI_RESP sz=" << zmq_reply.size() << " Bytes");
+    // Prepare the request message
+    ns3sionna::Wrapper wrapper;
+    ns3sionna::BatchChannelStateRequest* batch_request = wrapper.mutable_batch_channel_state_request();
+    batch_request->set_shm_consumed(m_sionnaHelper->GetSharedMemoryConsumed());
 
-    NS_ASSERT_MSG(reply_wrapper.has_channel_state_response(), "Reply after channel state request is not a channel state response.");
+    // the missed link first
+    ns3sionna::BatchChannelStateRequest::LinkSet* miss_link = batch_request->add_links();
+    miss_link->set_tx_node(a);
+    miss_link->add_rx_nodes(b);
+    miss_link->set_time(now.GetNanoSeconds());
 
-    // Extract the delay, loss and time to live value
-    const ns3sionna::ChannelStateResponse& csi_response = reply_wrapper.channel_state_response();
+    // known links which will miss as well; lower node ID as TX (channel reciprocity)
+    uint64_t miss_key = CacheKey(a, b).m_key;
+    uint32_t num_links = 1;
+    std::map<uint32_t, ns3sionna::BatchChannelStateRequest::LinkSet*> link_sets;
+    link_sets[a] = miss_link;
+    for (size_t s = 0; s < NUM_SHARDS && num_links < m_max_batch_links; s++)
+    {
+        std::lock_guard<std::mutex> lock(m_shards[s].m_mutex);
+        const std::vector<uint64_t>& keys = m_shards[s].m_table.GetKeys();
+        std::vector<LinkEntries>& links = m_shards[s].m_table.GetLinks();
+        for (size_t i = 0; i < keys.size() && num_links < m_max_batch_links; i++)
+        {
+            if (keys[i] == LinkTable::EMPTY_KEY || keys[i] == miss_key || FindEntry(links[i], now))
+            {
+                continue;
+            }
+
+            uint32_t tx = static_cast<uint32_t>(keys[i] >> 32);
+            auto it = link_sets.find(tx);
+            if (it == link_sets.end())
+            {
+                it = link_sets.emplace(tx, batch_request->add_links()).first;
+                it->second->set_tx_node(tx);
+                it->second->set_time(now.GetNanoSeconds());
+            }
+            it->second->add_rx_nodes(static_cast<uint32_t>(keys[i] & 0xffffffff));
+            num_links++;
+        }
+    }
 
+    NS_LOG_DEBUG("\t: Batched request with #links: " << num_links << " in #sets: " << batch_request->links_size());
+
+    // Send the request message
+    m_sionnaHelper->SendMessage(wrapper);
+    m_pending.push_back(PendingRequest{miss_key, false});
+    m_num_pending = m_pending.size();
+}
+
+void
+SionnaPropagationCache::Precompute(Time duration, Time step, uint32_t max_links)
+{
+    NS_ASSERT_MSG(m_sionnaHelper, "SionnaPropagationCache must have reference to SionnaHelper.");
+    NS_ABORT_MSG_IF(duration.IsStrictlyPositive() && !step.IsStrictlyPositive(),
+                    "ns3sionna: a precomputed trajectory sweep requires a positive step");
+    NS_ABORT_MSG_IF(max_links == 0, "ns3sionna: precomputation requires at least one link per request");
+    if (m_sionnaHelper->IsReplay())
+    {
+        // the trace already holds all CSI
+        return;
+    }
+    std::string conflict = GetSweepConflict();
+    NS_ABORT_MSG_IF(duration.IsStrictlyPositive() && !conflict.empty(),
+                    "ns3sionna: a precomputed trajectory sweep is not supported with " << conflict);
+
+    Time now = Simulator::Now();
+    std::vector<Ptr<MobilityModel>> nodes;
+    for (uint32_t i = 0; i < NodeList::GetNNodes(); i++)
+    {
+        Ptr<SionnaMobilityModel> mobility = NodeList::GetNode(i)->GetObject<SionnaMobilityModel>();
+        if (mobility)
+        {
+            nodes.push_back(mobility);
+        }
+    }
+    uint64_t num_steps = duration.IsStrictlyPositive() ? duration.GetNanoSeconds() / step.GetNanoSeconds() + 1 : 1;
+
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    // replies of earlier prefetches
+    ReceiveChannelStateResponses(now, true);
+    m_precomputing = true;
+    m_precompute_step = duration.IsStrictlyPositive() ? step : Seconds(0);
+
+    auto t_start = std::chrono::steady_clock::now();
+    auto t_report = t_start;
+    uint64_t num_links = 0;
+    uint64_t num_culled = 0;
+    ns3sionna::Wrapper wrapper;
+    uint32_t request_links = 0;
+
+    // one round trip; the server traces the links of a request in batches of rt_max_parallel_links
+    auto flush = [&]() {
+        if (request_links == 0)
+        {
+            return;
+        }
+        const auto& first = wrapper.batch_channel_state_request().links(0);
+        uint64_t key = CacheKey(first.tx_node(), first.rx_nodes(0)).m_key;
+        wrapper.mutable_batch_channel_state_request()->set_shm_consumed(m_sionnaHelper->GetSharedMemoryConsumed());
+        m_sionnaHelper->SendMessage(wrapper);
+        m_pending.push_back(PendingRequest{key, false});
+        m_num_pending = m_pending.size();
+        ReceiveChannelStateResponses(now, true);
+        num_links += request_links;
+        request_links = 0;
+        wrapper.Clear();
+
+        auto t_now = std::chrono::steady_clock::now();
+        if (t_now - t_report >= std::chrono::seconds(1))
+        {
+            double elapsed = std::chrono::duration<double>(t_now - t_start).count();
+            std::cout << "ns3sionna: precomputed #links: " << num_links << " in " << elapsed << "s ("
+                      << num_links / elapsed << " links/s)" << std::endl;
+            t_report = t_now;
+        }
+    };
+
+    for (uint64_t k = 0; k < num_steps; k++)
+    {
+        Time t = now + step * static_cast<int64_t>(k);
+        // lower node ID as TX (channel reciprocity)
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            ns3sionna::BatchChannelStateRequest::LinkSet* link_set = nullptr;
+            for (size_t j = i + 1; j < nodes.size(); j++)
+            {
+                // the positions of a sweep are only known to the server
+                if (num_steps == 1 && m_optimize && m_linkCuller && IsLinkCulled(nodes[i], nodes[j]))
+                {
+                    num_culled++;
+                    continue;
+                }
+                if (!link_set)
+                {
+                    link_set = wrapper.mutable_batch_channel_state_request()->add_links();
+                    link_set->set_tx_node(GetNodeId(nodes[i]));
+                    link_set->set_time(t.GetNanoSeconds());
+                    CheckRequestTime(t);
+                }
+                link_set->add_rx_nodes(GetNodeId(nodes[j]));
+                if (++request_links == max_links)
+                {
+                    flush();
+                    link_set = nullptr;
+                }
+            }
+        }
+        // requests must not go back in time
+        flush();
+    }
+
+    m_precomputing = false;
+    m_precompute_step = Seconds(0);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    std::cout << "ns3sionna: precomputed #links: " << num_links << " (#culled: " << num_culled << ") at #times: "
+              << num_steps << " in " << elapsed << "s (" << (elapsed > 0 ? num_links / elapsed : 0.0)
+              << " links/s), cache memory: " << m_bytes << " bytes" << std::endl;
+}
+
+std::string
+SionnaPropagationCache::GetSweepConflict() const
+{
+    // the sweep leaves the server at its end; an entry missing before would be requested back in time
+    if (m_prefetch_horizon.IsStrictlyPositive() && m_sionnaHelper && m_sionnaHelper->IsPrefetch())
+    {
+        return "prefetching";
+    }
+    if (m_max_entries_per_link > 0)
+    {
+        return "MaxEntriesPerLink";
+    }
+    if (m_max_memory > 0)
+    {
+        return "MaxMemory";
+    }
+    if (m_max_entry_age.IsStrictlyPositive())
+    {
+        return "MaxEntryAge";
+    }
+    return "";
+}
+
+void
+SionnaPropagationCache::ReceiveChannelStateResponses(Time now, bool blocking) const
+{
+    while (!m_pending.empty())
+    {
+        // Receive the reply message
+        ns3sionna::Wrapper reply_wrapper;
+        if (!m_sionnaHelper->ReceiveMessage(reply_wrapper, blocking))
+        {
+            NS_ASSERT_MSG(!blocking, "Failed to receive reply after propagation request message.");
+            return;
+        }
+        //NS_LOG_INFO("ZMQ::CSI_RESP sz=" << reply_wrapper.ByteSizeLong() << " Bytes");
+
+        PendingRequest request = m_pending.front();
+        m_pending.pop_front();
+        m_num_pending = m_pending.size();
+
+        // Check if the reply message is a propagation response
+        NS_ASSERT_MSG(reply_wrapper.has_channel_state_response(), "Reply after channel state request is not a channel state response.");
+
+        if (!m_roundTripTrace.IsEmpty())
+        {
+            const SionnaHelper::IpcStats& ipc = m_sionnaHelper->GetIpcStats();
+            uint32_t links = 0;
+            for (const auto& csi : reply_wrapper.channel_state_response().csi())
+            {
+                links += csi.rx_nodes_size();
+            }
+            m_roundTripTrace(NanoSeconds(ipc.m_last_rtt_ns), static_cast<uint32_t>(ipc.m_last_reply_bytes), links);
+        }
+
+        InsertChannelStateResponse(reply_wrapper.channel_state_response(), now);
+
+        if (!request.m_prefetch)
+        {
+            // reply of the pending miss
+            return;
+        }
+    }
+}
+
+void
+SionnaPropagationCache::Prefetch(uint64_t key, uint32_t a, uint32_t b, const CacheEntry& entry, Time now) const
+{
+    if (!m_prefetch_horizon.IsStrictlyPositive() || !m_sionnaHelper->IsPrefetch() ||
+        entry.m_end_time - now >= m_prefetch_horizon)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+    if (m_pending.size() >= m_max_pending_prefetches)
+    {
+        return;
+    }
+
+    for (const auto& request : m_pending)
+    {
+        if (request.m_key == key)
+        {
+            // already requested
+            return;
+        }
+    }
+
+    // The server advances its mobility with every request, i.e. requests must not go back in
+    // time. Therefore the link is requested at the current time and not at its expiry.
+    NS_LOG_DEBUG("\t: Prefetch for lnk: " << a << " to " << b << ", expires in "
+        << (entry.m_end_time - now).GetNanoSeconds() << "ns");
+    SendChannelStateRequest(a, b, now, true);
+    m_prefetches += 1;
+}
+
+void
+SionnaPropagationCache::InsertChannelStateResponse(const ns3sionna::ChannelStateResponse& csi_response, Time now) const
+{
     NS_LOG_INFO("ns3sionna::Req CSI data from sionna: #samples=" << csi_response.csi_size());
 
+    // drop whatever became stale since the last round trip
+    CollectGarbage(now);
+
     // result contains also future CSI; fill-up the cache
     for (int csi_i=0; csi_i < csi_response.csi_size(); csi_i++) {
         Time start_time = NanoSeconds(csi_response.csi(csi_i).start_time());
@@ -283,7 +1130,10 @@ SionnaPropagationCache::GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityMod
             << (end_time - start_time).GetNanoSeconds() << "ns");
 
         google::protobuf::uint32 txId = csi_response.csi(csi_i).tx_node().id();
-        auto txPos = csi_response.csi(csi_i).tx_node().position();
+        const auto& txPos = csi_response.csi(csi_i).tx_node().position();
+        const auto& txVelo = csi_response.csi(csi_i).tx_node().velocity();
+        UpdateTrajectory(txId, start_time, end_time, Vector(txPos.x(), txPos.y(), txPos.z()),
+                         Vector(txVelo.x(), txVelo.y(), txVelo.z()));
 
         for (int rx_i=0; rx_i < csi_response.csi(csi_i).rx_nodes_size(); rx_i++) {
             Time delay = NanoSeconds(csi_response.csi(csi_i).rx_nodes(rx_i).delay());
@@ -291,63 +1141,520 @@ SionnaPropagationCache::GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityMod
             //Time ttl = NanoSeconds(csi_response.csi(csi_i).rx_nodes(rx_i).ttl());
 
             google::protobuf::uint32 rxId = csi_response.csi(csi_i).rx_nodes(rx_i).id();
-            auto rxPos = csi_response.csi(csi_i).rx_nodes(rx_i).position();
+            const auto& rxPos = csi_response.csi(csi_i).rx_nodes(rx_i).position();
+
+            const auto& rx_info = csi_response.csi(csi_i).rx_nodes(rx_i);
+            UpdateTrajectory(rxId, start_time, end_time, Vector(rxPos.x(), rxPos.y(), rxPos.z()),
+                             Vector(rx_info.velocity().x(), rx_info.velocity().y(), rx_info.velocity().z()));
+
+            // packed CSI is either part of the message or read in place from the shared memory
+            const char* packed = nullptr;
+            size_t packed_size = 0;
+            if (rx_info.csi_shm_size() > 0)
+            {
+                packed = m_sionnaHelper->GetSharedMemory(rx_info.csi_shm_offset(), rx_info.csi_shm_size());
+                packed_size = rx_info.csi_shm_size();
+            }
+            else if (!rx_info.csi_packed().empty())
+            {
+                packed = rx_info.csi_packed().data();
+                packed_size = rx_info.csi_packed().size();
+            }
 
-            int num_ofdm_subcarrier = csi_response.csi(csi_i).rx_nodes(rx_i).csi_imag().size();
+            int num_ofdm_subcarrier = packed
+                ? static_cast<int>(CfrPackedCount(packed_size, PackedComponentSize()))
+                : rx_info.csi_imag().size();
 
             NS_LOG_DEBUG("\t\t: Response (delay: " << delay << ", loss: " << wb_loss << ")"
-              << " (TxId: " << txId << " [" << csi_response.csi(csi_i).tx_node().position().x()
-              << "," << csi_response.csi(csi_i).tx_node().position().y() << "," << csi_response.csi(csi_i).tx_node().position().z() << "] -> "
-              << rxId << " [" << csi_response.csi(csi_i).rx_nodes(rx_i).position().x() << "," << csi_response.csi(csi_i).rx_nodes(rx_i).position().y()
-              << "," << csi_response.csi(csi_i).rx_nodes(rx_i).position().z() << ",NSC" << num_ofdm_subcarrier << "])");
+              << " (TxId: " << txId << " [" << txPos.x() << "," << txPos.y() << "," << txPos.z() << "] -> "
+              << rxId << " [" << rxPos.x() << "," << rxPos.y() << "," << rxPos.z() << ",NSC" << num_ofdm_subcarrier << "])");
 
             // Add the info from all other receivers to the cache
-            CacheKey otherkey = CacheKey(txId, rxId);
             CacheEntry entry = CacheEntry(delay, wb_loss, start_time, end_time, num_ofdm_subcarrier,
                 txId, rxId ,Vector(txPos.x(),txPos.y(),txPos.z()), Vector(rxPos.x(),rxPos.y(),rxPos.z()));
 
-            // CFR: remove guards
-            for (int i=0; i < num_ofdm_subcarrier; i++)
+            // the frequency grid is the same for all links; share it
+            if (rx_info.frequencies_size() == 0 && m_sionnaHelper->GetFrequencies())
+            {
+                // packed CSI: received once at startup
+                std::atomic_store(&m_freq, m_sionnaHelper->GetFrequencies());
+            }
+            else if (!m_freq || m_freq->size() != static_cast<size_t>(rx_info.frequencies_size()) ||
+                     !std::equal(m_freq->begin(), m_freq->end(), rx_info.frequencies().begin()))
             {
-                int freq = csi_response.csi(csi_i).rx_nodes(rx_i).frequencies(i);
-                entry.m_freq.emplace_back(freq);
+                // only written under the server lock; culled lookups read it concurrently
+                std::atomic_store(&m_freq, std::make_shared<const std::vector<int>>(rx_info.frequencies().begin(),
+                                                                                   rx_info.frequencies().end()));
+            }
+            entry.m_freq = m_freq;
 
-                double imag = csi_response.csi(csi_i).rx_nodes(rx_i).csi_imag(i);
-                double real = csi_response.csi(csi_i).rx_nodes(rx_i).csi_real(i);
-                entry.m_cfr.emplace_back(real, imag);
+            // a precomputed sweep is sampled on its grid, i.e. not a lookahead
+            entry.m_lookahead = !m_precomputing && start_time > now;
+            if (m_precomputing && m_precompute_step.IsStrictlyPositive())
+            {
+                entry.m_end_time = std::max(end_time, start_time + m_precompute_step - NanoSeconds(1));
+            }
+
+            if (m_static_links && rx_info.static_link())
+            {
+                entry.m_static = true;
+                entry.m_end_time = Time::Max();
+            }
+
+            if (rx_info.path_delay_size() > 0)
+            {
+                // time evolution 'doppler': the CFR is synthesized from the paths on lookup
+                auto paths = std::make_shared<CfrPaths>();
+                for (int i = 0; i < rx_info.path_delay_size(); i++)
+                {
+                    paths->m_gain.emplace_back(rx_info.path_gain_real(i), rx_info.path_gain_imag(i));
+                    paths->m_delay.push_back(rx_info.path_delay(i) * 1e-9);
+                    paths->m_doppler.push_back(rx_info.path_doppler(i));
+                }
+                entry.m_paths = paths;
+                entry.m_num_ofdm_subcarrier = static_cast<int>(m_freq->size());
+                for (uint32_t band = 1; band < m_sionnaHelper->GetNumBands(); band++)
+                {
+                    entry.m_bands.push_back(CacheEntry::BandCfr{m_sionnaHelper->GetBandFrequencies(band), nullptr, nullptr});
+                }
+                EvolveEntry(entry, start_time);
             }
+            else
+            {
+                // CFR built once; the trailing 1 aligns it with the PSD bins of the spectrum model
+                const std::vector<uint32_t>& subcarriers = m_sionnaHelper->GetCsiSubcarriers();
+                bool interpolate = !subcarriers.empty() && num_ofdm_subcarrier > 0;
+                NS_ASSERT_MSG(!interpolate || static_cast<size_t>(num_ofdm_subcarrier) == subcarriers.size(),
+                              "Received CSI does not match the configured CSI subcarriers");
+                auto cfr = std::make_shared<CfrVector>();
+                CfrVector sparse_cfr; // CSI of the configured subcarriers only
+                CfrVector& decoded = interpolate ? sparse_cfr : *cfr;
+                decoded.reserve(num_ofdm_subcarrier + 1);
+                if (!packed)
+                {
+                    for (int i=0; i < num_ofdm_subcarrier; i++)
+                    {
+                        decoded.emplace_back(rx_info.csi_real(i), rx_info.csi_imag(i));
+                    }
+                }
+                else
+                {
+                    DecodePackedCsi(packed, rx_info.csi_scale(), num_ofdm_subcarrier, decoded);
+                    if (rx_info.csi_shm_size() > 0)
+                    {
+                        // the server may reuse this part of the ring buffer
+                        m_sionnaHelper->SetSharedMemoryConsumed(rx_info.csi_shm_offset() + rx_info.csi_shm_size());
+                    }
+                }
+                if (interpolate)
+                {
+                    cfr->reserve(m_sionnaHelper->GetFFTSize() + 1);
+                    CfrInterpolate(sparse_cfr, subcarriers, m_sionnaHelper->GetFFTSize(), *cfr);
+                    entry.m_num_ofdm_subcarrier = m_sionnaHelper->GetFFTSize();
+                }
+                cfr->emplace_back(1.0, 0.0);
+                entry.m_cfr = cfr;
+                entry.m_cfr_power = CfrPower(*cfr);
 
-            auto cache_it = m_cache.find(otherkey);
+                // the additional bands; never interpolated nor in the ring buffer
+                NS_ASSERT_MSG(rx_info.band_csi_size() + 1 == static_cast<int>(m_sionnaHelper->GetNumBands()),
+                              "Received CSI does not match the configured bands");
+                for (int band = 0; band < rx_info.band_csi_size(); band++)
+                {
+                    const auto& band_csi = rx_info.band_csi(band);
+                    auto band_cfr = std::make_shared<CfrVector>();
+                    if (band_csi.csi_packed().empty())
+                    {
+                        band_cfr->reserve(band_csi.csi_real_size() + 1);
+                        for (int i = 0; i < band_csi.csi_real_size(); i++)
+                        {
+                            band_cfr->emplace_back(band_csi.csi_real(i), band_csi.csi_imag(i));
+                        }
+                    }
+                    else
+                    {
+                        size_t n = CfrPackedCount(band_csi.csi_packed().size(), PackedComponentSize());
+                        band_cfr->reserve(n + 1);
+                        DecodePackedCsi(band_csi.csi_packed().data(), band_csi.csi_scale(), n, *band_cfr);
+                    }
+                    NS_ASSERT_MSG(band_cfr->size() == static_cast<size_t>(m_sionnaHelper->GetBandFFTSize(band + 1)),
+                                  "Received CSI of band " << band + 1 << " does not match its FFT size");
+                    band_cfr->emplace_back(1.0, 0.0);
+                    entry.m_bands.push_back(CacheEntry::BandCfr{m_sionnaHelper->GetBandFrequencies(band + 1), band_cfr,
+                                                                CfrPower(*band_cfr)});
+                }
 
-            if (cache_it != m_cache.end()) {
-                // pair already known
-                cache_it->second.push_back(entry);
-            } else {
-                // create new entry with zero vector
-                m_cache.insert(std::make_pair(otherkey, std::vector<CacheEntry>()));
-                cache_it = m_cache.find(otherkey);
-                cache_it->second.push_back(entry);
+                // the channel matrices of the antenna arrays; neither interpolated nor in the ring buffer
+                if (rx_info.mimo_csi_real_size() > 0 || !rx_info.mimo_csi_packed().empty())
+                {
+                    auto mimo_cfr = std::make_shared<CfrVector>();
+                    if (rx_info.mimo_csi_packed().empty())
+                    {
+                        mimo_cfr->reserve(rx_info.mimo_csi_real_size());
+                        for (int i = 0; i < rx_info.mimo_csi_real_size(); i++)
+                        {
+                            mimo_cfr->emplace_back(rx_info.mimo_csi_real(i), rx_info.mimo_csi_imag(i));
+                        }
+                    }
+                    else
+                    {
+                        size_t n = CfrPackedCount(rx_info.mimo_csi_packed().size(), PackedComponentSize());
+                        mimo_cfr->reserve(n);
+                        DecodePackedCsi(rx_info.mimo_csi_packed().data(), rx_info.mimo_csi_scale(), n, *mimo_cfr);
+                    }
+                    uint32_t num_antennas = m_sionnaHelper->GetNumAntennas();
+                    NS_ASSERT_MSG(mimo_cfr->size() == static_cast<size_t>(num_ofdm_subcarrier) * num_antennas * num_antennas,
+                                  "Received CSI does not match the configured antenna arrays");
+                    entry.m_mimo_cfr = mimo_cfr;
+                }
             }
+
+            SionnaTraceStore* trace = m_sionnaHelper->GetTraceStore();
+            if (trace && trace->IsRecording())
+            {
+                trace->Append(SionnaTraceStore::Record{entry.m_a, entry.m_b, entry.m_start_time, entry.m_end_time,
+                    entry.m_a_position, entry.m_b_position, entry.m_delay, entry.m_loss, entry.m_static,
+                    entry.m_freq, entry.m_cfr});
+            }
+
+            InsertLinkEntry(CacheKey(txId, rxId).m_key, entry, now);
         }
     }
+    EnforceMemoryBudget(now);
+}
 
-    // get result from cache
-    CacheKey key2 = CacheKey(node_a->GetId(), node_b->GetId());
-    auto cache_it = m_cache.find(key2);
-    if (cache_it != m_cache.end())
-    {
-        // iterate over all stored entries for that link
-        for (CacheEntry c_entry : cache_it->second) {
-            // If delay and loss exist in the cache, check if the entry is not outdated
-            if (c_entry.m_end_time >= current_time && c_entry.m_start_time <= current_time)
+size_t
+SionnaPropagationCache::PackedComponentSize() const
+{
+    return m_sionnaHelper->GetCsiEncoding() == ns3sionna::CSI_FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+void
+SionnaPropagationCache::DecodePackedCsi(const char* packed, double scale, size_t n, CfrVector& cfr) const
+{
+    switch (m_sionnaHelper->GetCsiEncoding())
+    {
+    case ns3sionna::CSI_FLOAT32:
+        CfrDecodeFloat32(packed, n, cfr);
+        break;
+    case ns3sionna::CSI_FLOAT16:
+        CfrDecodeFloat16(packed, n, cfr);
+        break;
+    case ns3sionna::CSI_INT16:
+        CfrDecodeInt16(packed, n, scale, cfr);
+        break;
+    default:
+        NS_FATAL_ERROR("Received packed CSI but no packed CSI encoding is configured.");
+    }
+}
+
+void
+SionnaPropagationCache::EvolveEntry(CacheEntry& entry, Time now) const
+{
+    if (!entry.m_paths || (entry.m_cfr && entry.m_cfr_time == now))
+    {
+        return;
+    }
+    auto cfr = std::make_shared<CfrVector>();
+    cfr->reserve(entry.m_freq->size() + 1);
+    CfrSynthesize(*entry.m_paths, *entry.m_freq, (now - entry.m_start_time).GetSeconds(), *cfr);
+    cfr->emplace_back(1.0, 0.0);
+    entry.m_cfr = cfr;
+    entry.m_cfr_power = CfrPower(*cfr);
+
+    // the same paths on the subcarriers of the additional bands; normalized to their own power
+    double fc = m_sionnaHelper->GetBandFrequency(0) * 1e6;
+    for (size_t i = 0; i < entry.m_bands.size(); i++)
+    {
+        CacheEntry::BandCfr& band = entry.m_bands[i];
+        double band_fc = m_sionnaHelper->GetBandFrequency(i + 1) * 1e6;
+        auto band_cfr = std::make_shared<CfrVector>();
+        band_cfr->reserve(band.m_freq->size() + 1);
+        CfrSynthesize(*entry.m_paths, *band.m_freq, (now - entry.m_start_time).GetSeconds(), *band_cfr,
+                      band_fc - fc, band_fc / fc);
+        double power = 0.0;
+        for (const auto& h : *band_cfr)
+        {
+            power += std::norm(h);
+        }
+        power /= std::max<size_t>(band_cfr->size(), 1);
+        if (power > 0.0)
+        {
+            double scale = 1.0 / std::sqrt(power);
+            for (auto& h : *band_cfr)
             {
-                // Return cache entry as the value is still fresh
-                return c_entry;
+                h *= scale;
             }
         }
+        band_cfr->emplace_back(1.0, 0.0);
+        band.m_cfr = band_cfr;
+        band.m_cfr_power = CfrPower(*band_cfr);
+    }
+    entry.m_cfr_time = now;
+    m_cfr_synthesized += 1;
+}
+
+void
+SionnaPropagationCache::UpdateTrajectory(uint32_t id, Time start, Time end, const Vector& position,
+                                         const Vector& velocity) const
+{
+    if (id >= m_mobility.size())
+    {
+        m_mobility.resize(id + 1);
+    }
+    if (!m_mobility[id])
+    {
+        Ptr<Node> node = NodeList::GetNode(id);
+        m_mobility[id] = node->GetObject<SionnaMobilityModel>();
+        NS_ASSERT_MSG(m_mobility[id], "Node " << id << " is not using SionnaMobilityModel.");
+    }
+    m_mobility[id]->AddSegment(start, end, position, velocity);
+}
+
+void
+SionnaPropagationCache::InsertReplayedEntry(uint64_t key, uint32_t a, uint32_t b, Time now) const
+{
+    SionnaTraceStore::Record record;
+    NS_ABORT_MSG_IF(!m_sionnaHelper->GetTraceStore()->Find(a, b, now, record),
+                    "Link " << a << " to " << b << " is not contained in the CSI trace");
+
+    CacheEntry entry = CacheEntry(record.m_delay, record.m_loss, record.m_start_time, record.m_end_time,
+        record.m_cfr->empty() ? 0 : static_cast<int>(record.m_cfr->size() - 1), record.m_a, record.m_b,
+        record.m_a_position, record.m_b_position);
+    entry.m_static = record.m_static;
+    entry.m_freq = record.m_freq;
+    entry.m_cfr = record.m_cfr;
+    entry.m_cfr_power = CfrPower(*record.m_cfr);
+
+    // velocities are not recorded; the nodes are placed at the recorded positions
+    UpdateTrajectory(record.m_a, record.m_start_time, record.m_end_time, record.m_a_position, Vector(0.0, 0.0, 0.0));
+    UpdateTrajectory(record.m_b, record.m_start_time, record.m_end_time, record.m_b_position, Vector(0.0, 0.0, 0.0));
+
+    CollectGarbage(now);
+    InsertLinkEntry(key, entry, now);
+    EnforceMemoryBudget(now);
+}
+
+void
+SionnaPropagationCache::GetCulledEntry(uint32_t id_a, uint32_t id_b, Ptr<MobilityModel> a, Ptr<MobilityModel> b,
+                                       Time now, CacheEntry& entry) const
+{
+    std::lock_guard<std::mutex> lock(m_culler_mutex);
+    size_t num_bins = m_sionnaHelper->GetFFTSize() + 1; // incl. trailing PSD bin
+    if (!m_flat_cfr || m_flat_cfr->size() != num_bins)
+    {
+        // no small-scale fading
+        m_flat_cfr = std::make_shared<const CfrVector>(num_bins, std::complex<double>(1.0, 0.0));
+        m_flat_cfr_power = CfrPower(*m_flat_cfr);
+    }
+
+    entry = CacheEntry(m_linkCuller->GetDelay(a, b), m_linkCuller->GetLoss(a, b), now, now,
+                       num_bins - 1, id_a, id_b, a->GetPosition(), b->GetPosition());
+    entry.m_freq = m_sionnaHelper->GetFrequencies() ? m_sionnaHelper->GetFrequencies() : std::atomic_load(&m_freq);
+    entry.m_cfr = m_flat_cfr;
+    entry.m_cfr_power = m_flat_cfr_power;
+
+    if (m_flat_bands.size() + 1 != m_sionnaHelper->GetNumBands())
+    {
+        m_flat_bands.clear();
+        for (uint32_t band = 1; band < m_sionnaHelper->GetNumBands(); band++)
+        {
+            auto band_cfr = std::make_shared<const CfrVector>(m_sionnaHelper->GetBandFFTSize(band) + 1,
+                                                              std::complex<double>(1.0, 0.0));
+            m_flat_bands.push_back(CacheEntry::BandCfr{m_sionnaHelper->GetBandFrequencies(band), band_cfr,
+                                                       CfrPower(*band_cfr)});
+        }
+    }
+    entry.m_bands = m_flat_bands;
+}
+
+bool
+SionnaPropagationCache::IsLinkCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    std::lock_guard<std::mutex> lock(m_culler_mutex);
+    if (!m_linkCullerConfigured)
+    {
+        m_linkCuller->Configure(m_sionnaHelper->GetFrequency() * 1e6, m_sionnaHelper->GetNoiseFloor());
+        m_linkCullerConfigured = true;
+    }
+    return m_linkCuller->IsCulled(a, b);
+}
+
+bool
+SionnaPropagationCache::LookupEntry(uint64_t key, uint32_t id_a, Ptr<const MobilityModel> a,
+                                    Ptr<const MobilityModel> b, Time now, bool fresh_only, LookupMemo& memo) const
+{
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+    LinkEntries* entries = shard.m_table.Find(key);
+    if (!entries)
+    {
+        return false;
+    }
+
+    const EntryHandle* c_entry = FindEntry(*entries, now);
+    if (fresh_only && c_entry && (*c_entry)->m_static && !IsAtEntryPosition(**c_entry, id_a, a, b))
+    {
+        // a node has been moved; the static entries of this link are outdated
+        NS_LOG_DEBUG("\t: Static entry outdated for lnk: " << id_a << " to " << GetNodeId(b));
+        shard.m_generation++;
+        m_evicted_expired += std::count_if(entries->begin(), entries->end(),
+            [](const EntryHandle& e) { return e->m_static; });
+        entries->erase(std::remove_if(entries->begin(), entries->end(),
+            [this](const EntryHandle& e) {
+                if (e->m_static)
+                {
+                    MarkEvicted(*e);
+                }
+                return e->m_static;
+            }), entries->end());
+        c_entry = FindEntry(*entries, now);
+    }
+    if (!c_entry || (fresh_only && !(*c_entry)->m_static && m_max_entry_age.IsStrictlyPositive() &&
+                     (*c_entry)->m_start_time + m_max_entry_age < now))
+    {
+        return false;
+    }
+
+    const CacheEntry& entry = **c_entry;
+    MarkUsed(entry);
+    entry.m_last_used = now;
+    memo.m_entry = *c_entry;
+    PinEntry(*c_entry);
+    if (entry.m_paths && entry.m_cfr_time != now)
+    {
+        // the stored entry stays untouched; the CFR for now is synthesized in the memo
+        memo.m_local = entry;
+        EvolveEntry(memo.m_local, now);
+        memo.m_result = &memo.m_local;
+    }
+    else
+    {
+        memo.m_result = &entry;
+    }
+    memo.m_key = key;
+    memo.m_time = now;
+    memo.m_shard = &shard;
+    // read under the shard lock: any later modification of this shard increments it
+    memo.m_generation = shard.m_generation;
+    memo.m_valid = true;
+    return true;
+}
+
+const SionnaPropagationCache::CacheEntry&
+SionnaPropagationCache::GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+{
+    NS_ASSERT_MSG(m_sionnaHelper, "SionnaPropagationCache must have reference to SionnaHelper.");
+
+    Time current_time = Simulator::Now();
+
+    uint32_t id_a = GetNodeId(a);
+    uint32_t id_b = GetNodeId(b);
+    uint64_t key = CacheKey(id_a, id_b).m_key;
+    LookupMemo& memo = GetMemo();
+
+    // already resolved for this link within the current event (e.g. by the delay or loss model)
+    if (m_caching && memo.m_valid && memo.m_key == key && memo.m_time == current_time &&
+        (!memo.m_shard || memo.m_shard->m_generation == memo.m_generation))
+    {
+        // a culled link is no cache hit
+        if (!memo.m_shard)
+        {
+            m_culled += 1;
+            return *memo.m_result;
+        }
+        // another thread may have evicted the entry after the generation was read
+        if (PinEntry(memo.m_entry.lock()))
+        {
+            m_cache_hits += 1;
+            m_hitTrace(id_a, id_b);
+            return *memo.m_result;
+        }
+    }
+
+    NS_LOG_DEBUG("ns3sionna::GetPropagationData for lnk: " << id_a << " to " << id_b);
+
+    // Check if distance is too far so that a simpler model can be used
+    if (m_optimize && m_linkCuller)
+    {
+        if (IsLinkCulled(a, b))
+        {
+            NS_LOG_DEBUG("\t: Skipped raytracing for lnk: " << id_a << " to " << id_b << " due to large distance");
+            m_culled += 1;
+            GetCulledEntry(id_a, id_b, a, b, current_time, memo.m_local);
+            memo.m_entry.reset();
+            memo.m_result = &memo.m_local;
+            memo.m_key = key;
+            memo.m_time = current_time;
+            memo.m_shard = nullptr;
+            memo.m_valid = true;
+            return memo.m_local;
+        }
+        // signal is too strong and need to be computed with ray tracing
+    }
+
+    // take over prefetched CSI which has arrived in the meantime; left to the thread talking to
+    // the server if there is one
+    if (m_num_pending > 0)
+    {
+        std::unique_lock<std::mutex> lock(m_server_mutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            ReceiveChannelStateResponses(current_time, false);
+        }
+    }
+
+    // Look in the cache and check if delay and loss have already been calculated for the two nodes
+    if (m_caching && LookupEntry(key, id_a, a, b, current_time, true, memo))
+    {
+        NS_LOG_DEBUG("\t: Cache hit for lnk: " << id_a << " to " << id_b);
+        m_cache_hits += 1;
+        m_hitTrace(id_a, id_b);
+        Prefetch(key, id_a, id_b, *memo.m_result, current_time);
+        // Return cache entry as the value is still fresh
+        return *memo.m_result;
+    }
+
+    std::lock_guard<std::mutex> lock(m_server_mutex);
+
+    // another thread may have requested the link while this one was waiting for the server
+    if (m_caching && LookupEntry(key, id_a, a, b, current_time, true, memo))
+    {
+        NS_LOG_DEBUG("\t: Cache hit for lnk: " << id_a << " to " << id_b << " after waiting");
+        m_cache_hits += 1;
+        m_hitTrace(id_a, id_b);
+        return *memo.m_result;
+    }
+
+    NS_LOG_INFO("\t: Cache miss for lnk: " << id_a << " to " << id_b);
+    m_cache_miss += 1;
+    m_missTrace(id_a, id_b);
+
+    if (m_sionnaHelper->IsReplay())
+    {
+        InsertReplayedEntry(key, id_a, id_b, current_time);
+    }
+    // blocking request; replies to earlier prefetches are taken over first
+    else if (m_max_batch_links > 1)
+    {
+        // a batch has no lookahead and would silently be computed like MODE_P2MP
+        NS_ABORT_MSG_IF(m_sionnaHelper->GetMode() == SionnaHelper::MODE_P2MP_LAH,
+                        "ns3sionna: MaxBatchLinks > 1 is not supported in MODE_P2MP_LAH");
+        SendBatchChannelStateRequest(id_a, id_b, current_time);
+    }
+    else
+    {
+        SendChannelStateRequest(id_a, id_b, current_time, false);
+    }
+    ReceiveChannelStateResponses(current_time, true);
+
+    // get result from cache
+    if (LookupEntry(key, id_a, a, b, current_time, false, memo))
+    {
+        return *memo.m_result;
     }
     // cannot be reached
-    CacheEntry dummy_entry = CacheEntry();
+    static const CacheEntry dummy_entry = CacheEntry();
     return dummy_entry;
 }
 
@@ -24,10 +24,22 @@
 #include "ns3/nstime.h"
 #include "ns3/object.h"
 #include "ns3/ptr.h"
+#include "ns3/traced-callback.h"
 #include <complex>
 #include "../helper/sionna-helper.h"
+#include "sionna-cfr.h"
+#include "sionna-link-culler.h"
+#include "sionna-mobility-model.h"
 
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <ns3/propagation-delay-model.h>
 #include "ns3/propagation-loss-model.h"
@@ -38,13 +50,158 @@ namespace ns3
 /**
  * All CSI values are cached within ns3sionna framework for faster simulation time.
  *
- * TODO: garbage collection - purge too old values from cache
+ * Lookups may be issued concurrently; connected trace sinks must be thread-safe and must not
+ * look up the cache.
  */
 class SionnaPropagationCache : public ns3::Object
 {
     public:
+        /**
+         * Cached channel state of a single link, valid within [m_start_time, m_end_time].
+         */
+        struct CacheEntry
+        {
+            /**
+            * @brief Constructs a new CacheEntry
+            * @param delay the estimated propagation delay between TX and RX node.
+            * @param loss the estimated wideband pathloss
+            * @param start_time the point in time when the CSI was estimated
+            * @param end_time valid until (=start_time + computed channel coherence time)
+            * @param num_ofdm_subcarrier the number of OFDM subcarriers in CFR
+            */
+            CacheEntry(Time delay, double loss, Time start_time, Time end_time, int num_ofdm_subcarrier,
+                uint32_t a, uint32_t b, Vector a_position, Vector b_position)
+                : m_delay(delay),
+                  m_loss(loss),
+                  m_start_time(start_time),
+                  m_end_time(end_time),
+                  m_num_ofdm_subcarrier(num_ofdm_subcarrier),
+                  m_a(a),
+                  m_b(b),
+                  m_a_position(a_position),
+                  m_b_position(b_position),
+                  m_static(false),
+                  m_lookahead(false),
+                  m_used(false),
+                  m_size(0)
+            {
+            }
+
+            CacheEntry(): m_start_time(-1), m_end_time(-1), m_static(false), m_lookahead(false), m_used(false),
+                m_size(0)
+            {
+            }
+
+            // CFR of a band of the SionnaHelper; 0 is the band of Configure(). Shared with the
+            // cache unless stored in single precision, which is converted on every call
+            CfrHandle GetCfr(uint32_t band) const
+            {
+                const CfrHandle& cfr = band == 0 ? m_cfr : m_bands[band - 1].m_cfr;
+                if (cfr)
+                {
+                    return cfr;
+                }
+                const CfrFloatHandle& cfr_float = band == 0 ? m_cfr_float : m_bands[band - 1].m_cfr_float;
+                return cfr_float ? CfrFromFloat(*cfr_float) : nullptr;
+            }
+
+            // number of PSD bins of |H|^2 of a band incl. the trailing one; zero if there is none
+            size_t GetCfrPowerSize(uint32_t band) const
+            {
+                const CfrPowerHandle& power = band == 0 ? m_cfr_power : m_bands[band - 1].m_cfr_power;
+                const CfrPowerFloatHandle& power_float =
+                    band == 0 ? m_cfr_power_float : m_bands[band - 1].m_cfr_power_float;
+                return power ? power->size() : (power_float ? power_float->size() : 0);
+            }
+
+            // multiply the PSD of a band in place with |H|^2 in the precision it is stored in
+            void ApplyCfrPower(uint32_t band, double* psd) const
+            {
+                const CfrPowerHandle& power = band == 0 ? m_cfr_power : m_bands[band - 1].m_cfr_power;
+                if (power)
+                {
+                    CfrApplyPower(psd, power->data(), power->size());
+                    return;
+                }
+                const CfrPowerFloatHandle& power_float =
+                    band == 0 ? m_cfr_power_float : m_bands[band - 1].m_cfr_power_float;
+                if (power_float)
+                {
+                    CfrApplyPower(psd, power_float->data(), power_float->size());
+                }
+            }
+
+            struct BandCfr
+            {
+                FreqHandle m_freq;
+                CfrHandle m_cfr;
+                CfrPowerHandle m_cfr_power;
+                // CfrPrecision Float: replace m_cfr and m_cfr_power
+                CfrFloatHandle m_cfr_float;
+                CfrPowerFloatHandle m_cfr_power_float;
+            };
+
+            Time m_delay;
+            double m_loss;
+            Time m_start_time;
+            Time m_end_time;
+            int m_num_ofdm_subcarrier;
+            uint32_t m_a;
+            uint32_t m_b;
+            Vector m_a_position;
+            Vector m_b_position;
+            bool m_static; // valid until either node moves; m_end_time is Time::Max()
+            bool m_lookahead; // started in the future when received
+            mutable bool m_used; // looked up at least once
+            uint32_t m_size; // bytes accounted for in the memory usage; set on insertion
+            mutable Time m_last_used; // inserted resp. last looked up; memory budget
+            // optional; immutable and shared, therefore copying an entry is cheap
+            FreqHandle m_freq; // identical for all links
+            // channel frequency response incl. trailing PSD bin
+            CfrHandle m_cfr;
+            CfrPowerHandle m_cfr_power; // |H|^2 of m_cfr
+            // time evolution 'doppler': propagation paths at m_start_time; m_cfr is synthesized
+            // from them for m_cfr_time into the lookup memo, i.e. a stored entry keeps the CFR
+            // at m_start_time. Valid for much longer than the coherence time.
+            CfrPathsHandle m_paths;
+            Time m_cfr_time;
+            // the additional bands (index band - 1); normalized to their own mean power. They share
+            // validity, delay and wideband loss with the primary band (same propagation paths)
+            std::vector<BandCfr> m_bands;
+            // antenna arrays: CFR of the primary band between all antenna pairs normalized like
+            // m_cfr; [subcarrier][antenna of m_b][antenna of m_a] without trailing PSD bin
+            CfrHandle m_mimo_cfr;
+            // CfrPrecision Float: single precision m_cfr, m_cfr_power resp. m_mimo_cfr of a
+            // stored entry
+            CfrFloatHandle m_cfr_float;
+            CfrPowerFloatHandle m_cfr_power_float;
+            CfrFloatHandle m_mimo_cfr_float;
+        };
+
+        // precision in which the CFRs of the entries are stored
+        enum CfrPrecision
+        {
+            CFR_PRECISION_DOUBLE,
+            CFR_PRECISION_FLOAT
+        };
+
         static TypeId GetTypeId();
 
+        /**
+         * TracedCallback signature of a link related event.
+         * @param a first node
+         * @param b second node
+         */
+        typedef void (*LinkTracedCallback)(uint32_t a, uint32_t b);
+
+        /**
+         * TracedCallback signature of a round trip to the Sionna server.
+         * @param latency from sending the request until its reply was received
+         * @param bytes size of the reply
+         * @param links number of links contained in the reply
+         */
+        typedef void (*RoundTripTracedCallback)(Time latency, uint32_t bytes, uint32_t links);
+
         SionnaPropagationCache();
         ~SionnaPropagationCache();
 
@@ -53,103 +210,289 @@ class SionnaPropagationCache : public ns3::Object
         // average propagation loss
         double GetPropagationLoss(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const;
         double GetPropagationLoss(Ptr<MobilityModel> a, Ptr<MobilityModel> b, double txPowerDbm) const;
-        // small-scale fading
-        std::vector<std::complex<double>> GetPropagationCSI(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const;
+        // small-scale fading (copy of the CFR of the band without the trailing PSD bin)
+        std::vector<std::complex<double>> GetPropagationCSI(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b,
+                                                            uint32_t band = 0) const;
+        // small-scale fading without copy: shared handle to the cached CFR incl. trailing PSD bin
+        CfrHandle GetPropagationCSIHandle(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b,
+                                          uint32_t band = 0) const;
         // frequency of subcarriers
-        std::vector<int> GetPropagationFreq(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const;
+        const std::vector<int>& GetPropagationFreq(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const;
+        // delay, loss and CFR in a single lookup; the reference is valid until the next lookup of the
+        // calling thread
+        const CacheEntry& GetPropagationEntry(Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const;
 
         void SetSionnaHelper(SionnaHelper &sionnaHelper);
         SionnaHelper* GetSionnaHelper();
         void SetCaching(bool caching);
+        // enables link culling
         void SetOptimize(bool optimize);
+        // replace the default SionnaLinkCuller
+        void SetLinkCuller(Ptr<SionnaLinkCuller> linkCuller);
+        Ptr<SionnaLinkCuller> GetLinkCuller() const;
+        // hit ratio; zero if there were no lookups
         double GetStats();
         void PrintStats();
+        uint64_t GetHits() const;
+        uint64_t GetMisses() const;
+        // number of entries evicted by the garbage collection (expired, too old, over capacity)
+        uint64_t GetEvictions() const;
+        // number of non-blocking prefetch requests sent
+        uint64_t GetPrefetches() const;
+        // number of lookups answered without ray tracing due to link culling
+        uint64_t GetCulled() const;
+        // number of lookahead entries looked up at least once / evicted without lookup
+        uint64_t GetLookaheadUsed() const;
+        uint64_t GetLookaheadUnused() const;
+        // bytes currently held by the cached entries
+        uint64_t GetMemoryUsage() const;
+
+        /**
+         * Trace all links between the nodes using the SionnaMobilityModel in large batches and
+         * fill the cache with them before the simulation runs; see SionnaHelper::Precompute().
+         * @param duration length of the trajectory sweep; zero for the current positions only
+         * @param step time between two points of the sweep; an entry is valid at least until
+         *        the next point
+         * @param max_links maximum number of links per request
+         */
+        void Precompute(Time duration, Time step, uint32_t max_links);
+        // attribute which evicts entries of a trajectory sweep before its end or prefetches at the
+        // current time, i.e. would request the server back in time; empty if none
+        std::string GetSweepConflict() const;
 
     private:
         struct CacheKey
         {
         /**
-         * @brief Constructs a new CacheKey
+         * @brief Constructs a new CacheKey; the node pair is packed as (min,max) as
+         * the cache assumes channel reciprocity
          * @param a TX node ID
          * @param b RX node ID
          */
         CacheKey(uint32_t a, uint32_t b)
-                : m_first(a < b ? a : b),
-                  m_second(a < b ? b : a)
+                : m_key(a < b ? (static_cast<uint64_t>(a) << 32) | b
+                              : (static_cast<uint64_t>(b) << 32) | a)
             {
             }
 
-            uint32_t m_first;
-            uint32_t m_second;
+            uint64_t m_key;
+        };
 
-            bool operator<(const CacheKey& other) const
-            {
-                if (m_first != other.m_first)
-                {
-                    return m_first < other.m_first;
-                }
-                else
-                {
-                    return m_second < other.m_second;
-                }
-            }
+        // stored entries are immutable (except their bookkeeping) and shared with the lookup memos
+        typedef std::shared_ptr<const CacheEntry> EntryHandle;
+        typedef std::vector<EntryHandle> LinkEntries; // sorted by m_start_time
+
+        // number of independently locked parts of the link table
+        static const unsigned SHARD_BITS = 4;
+        static const size_t NUM_SHARDS = size_t(1) << SHARD_BITS;
+
+        /**
+         * Hash index (open addressing with linear probing) from packed node pair to the
+         * entries of that link. Links are never removed, only their entries.
+         */
+        class LinkTable
+        {
+            public:
+                LinkTable();
+
+                // (min,max) packing of two distinct node IDs can never produce this key
+                static const uint64_t EMPTY_KEY = UINT64_MAX;
+
+                // returns nullptr if the link is unknown
+                LinkEntries* Find(uint64_t key);
+                LinkEntries& FindOrInsert(uint64_t key);
+                void Clear();
+
+                std::vector<LinkEntries>& GetLinks();
+                // slot-wise keys of GetLinks(); EMPTY_KEY for unused slots
+                const std::vector<uint64_t>& GetKeys() const;
+
+            private:
+                size_t Slot(uint64_t key) const;
+                void Grow();
+
+                std::vector<uint64_t> m_keys;
+                std::vector<LinkEntries> m_links;
+                size_t m_size;
         };
 
-        struct CacheEntry
+        struct Shard
         {
-            /**
-            * @brief Constructs a new CacheEntry
-            * @param delay the estimated propagation delay between TX and RX node.
-            * @param loss the estimated wideband pathloss
-            * @param start_time the point in time when the CSI was estimated
-            * @param end_time valid until (=start_time + computed channel coherence time)
-            * @param num_ofdm_subcarrier the number of OFDM subcarriers in CFR
-            */
-            CacheEntry(Time delay, double loss, Time start_time, Time end_time, int num_ofdm_subcarrier,
-                uint32_t a, uint32_t b, Vector a_position, Vector b_position)
-                : m_delay(delay),
-                  m_loss(loss),
-                  m_start_time(start_time),
-                  m_end_time(end_time),
-                  m_num_ofdm_subcarrier(num_ofdm_subcarrier),
-                  m_a(a),
-                  m_b(b),
-                  m_a_position(a_position),
-                  m_b_position(b_position)
+            Shard(): m_generation(0)
             {
-                m_cfr.reserve(num_ofdm_subcarrier);
             }
 
-            CacheEntry(): m_start_time(-1), m_end_time(-1)
+            // the table and all its entries incl. their mutable members; lock order: server,
+            // shard, feedback resp. culler. Hits on links of different shards do not contend
+            std::mutex m_mutex;
+            LinkTable m_table;
+            std::atomic<uint64_t> m_generation; // incremented on every modification of the table
+        };
+
+        /**
+         * Memo of the last resolved lookup of a thread. The delay, loss and spectrum models query
+         * the same link at the same simulation time for each frame; they share the resolved entry.
+         * Holds a weak handle to the stored entry, i.e. the memo of a thread does not keep evicted
+         * entries alive; invalidated whenever the shard of the link is modified (generation).
+         */
+        struct LookupMemo
+        {
+            LookupMemo(): m_key(0), m_time(-1), m_shard(nullptr), m_generation(0), m_valid(false), m_result(nullptr)
             {
             }
 
-            Time m_delay;
-            double m_loss;
-            Time m_start_time;
-            Time m_end_time;
-            int m_num_ofdm_subcarrier;
-            uint32_t m_a;
-            uint32_t m_b;
-            Vector m_a_position;
-            Vector m_b_position;
-            // optional
-            std::vector<int> m_freq;
-            std::vector<std::complex<double>> m_cfr; // channel frequency response
+            uint64_t m_key;
+            Time m_time;
+            const Shard* m_shard; // nullptr for culled links, which do not depend on the table
+            uint64_t m_generation;
+            bool m_valid;
+            std::weak_ptr<const CacheEntry> m_entry; // the stored entry
+            CacheEntry m_local; // culled link resp. CFR synthesized for m_time
+            const CacheEntry* m_result; // m_entry or m_local
+        };
+
+        // the returned reference is valid until the next lookup of the calling thread
+        const CacheEntry& GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+        Shard& GetShard(uint64_t key) const;
+        // memo of the calling thread for this cache
+        LookupMemo& GetMemo() const;
+        // memos of the calling thread by cache instance
+        static std::unordered_map<uint64_t, LookupMemo>& GetThreadMemos();
+        // keep the stored entry last resolved by the calling thread, of any cache, alive until the
+        // thread's next lookup; false if the entry has been evicted meanwhile
+        static bool PinEntry(EntryHandle entry);
+        // copy the entry valid at now into the memo; static entries of moved nodes are dropped
+        // and, if fresh_only, entries older than MaxEntryAge are ignored
+        bool LookupEntry(uint64_t key, uint32_t id_a, Ptr<const MobilityModel> a, Ptr<const MobilityModel> b,
+                         Time now, bool fresh_only, LookupMemo& memo) const;
+        // insert into the link of the given key, stored in the configured precision; server lock held
+        void InsertLinkEntry(uint64_t key, const CacheEntry& entry, Time now) const;
+        // find the entry valid at the given time; nullptr if none
+        const EntryHandle* FindEntry(LinkEntries& entries, Time now) const;
+        // insert keeping the time order and enforce the per-link capacity
+        void InsertEntry(LinkEntries& entries, const CacheEntry& entry) const;
+        // purge expired and too old entries from all links; on every server response
+        void CollectGarbage(Time now) const;
+        // evict the least recently used entries, unused future entries last, down to 90% of
+        // MaxMemory if it is exceeded, so that the scan is amortized over many insertions;
+        // entries inserted or looked up at the current time are kept; server lock held
+        void EnforceMemoryBudget(Time now) const;
+        // bytes of the entry and the buffers it holds
+        static size_t GetEntrySize(const CacheEntry& entry);
+        // convert the CFRs of an entry and their power to single precision
+        static void CompactEntry(CacheEntry& entry);
+        // count the outcome of a looked up or evicted entry for the lookahead feedback: a step
+        // counts as used once any of its entries is looked up and as unused if all of them are
+        // evicted before; the counts per TX node are sent with the next request
+        void MarkUsed(const CacheEntry& entry) const;
+        void MarkEvicted(const CacheEntry& entry) const;
+        // node ID cached on the SionnaMobilityModel
+        static uint32_t GetNodeId(Ptr<const MobilityModel> m);
+        // whether both nodes are still at the positions the entry was computed for
+        static bool IsAtEntryPosition(const CacheEntry& entry, uint32_t id_a, Ptr<const MobilityModel> a,
+                                      Ptr<const MobilityModel> b);
+        // abort if a request for the given time would move the mobility of the server back in
+        // time; server lock held
+        void CheckRequestTime(Time t) const;
+        // send a channel state request; prefetch requests do not wait for the reply
+        void SendChannelStateRequest(uint32_t a, uint32_t b, Time now, bool prefetch) const;
+        // whether the link is culled; configures the link culler on first use
+        bool IsLinkCulled(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+        // request the missed link together with all other known links lacking a valid entry
+        void SendBatchChannelStateRequest(uint32_t a, uint32_t b, Time now) const;
+        // take over replies into the cache; if blocking, until the reply of the pending miss
+        void ReceiveChannelStateResponses(Time now, bool blocking) const;
+        // fill the cache with all CSI contained in a server response; appended to the CSI trace
+        // if the SionnaHelper records one
+        void InsertChannelStateResponse(const ns3sionna::ChannelStateResponse& csi_response, Time now) const;
+        // push a trajectory segment received from the server into the mobility model of the node
+        void UpdateTrajectory(uint32_t id, Time start, Time end, const Vector& position,
+                              const Vector& velocity) const;
+        // fill the cache with the entry of a replayed CSI trace valid at now
+        void InsertReplayedEntry(uint64_t key, uint32_t a, uint32_t b, Time now) const;
+        // synthesize the CFR of an entry with propagation paths for the given time
+        void EvolveEntry(CacheEntry& entry, Time now) const;
+        // size of a single I or Q component of the configured packed CSI encoding
+        size_t PackedComponentSize() const;
+        // append the packed CSI of a link to the CFR
+        void DecodePackedCsi(const char* packed, double scale, size_t n, CfrVector& cfr) const;
+        // request the link ahead of time if its entry expires within the prefetch horizon
+        void Prefetch(uint64_t key, uint32_t a, uint32_t b, const CacheEntry& entry, Time now) const;
+        // entry of a culled link from simple models
+        void GetCulledEntry(uint32_t id_a, uint32_t id_b, Ptr<MobilityModel> a, Ptr<MobilityModel> b, Time now,
+                            CacheEntry& entry) const;
+
+        struct LookaheadFeedback
+        {
+            uint32_t m_used;
+            uint32_t m_unused;
+        };
+
+        // lookahead step: the entries of a TX node starting at the same time
+        struct LookaheadStep
+        {
+            uint32_t m_entries; // not yet evicted
+            bool m_used; // any of them looked up
         };
 
-        CacheEntry GetPropagationData(Ptr<MobilityModel> a, Ptr<MobilityModel> b) const;
+        struct PendingRequest
+        {
+            uint64_t m_key;
+            bool m_prefetch;
+        };
 
         SionnaHelper *m_sionnaHelper;
         bool m_caching;
-        typedef std::map<CacheKey, std::vector<CacheEntry>> Cache;
-        mutable Cache m_cache;
-        mutable double m_cache_hits;
-        mutable double m_cache_miss;
+        mutable std::array<Shard, NUM_SHARDS> m_shards;
+        const uint64_t m_instance; // key of the per-thread memo
+        mutable std::atomic<uint64_t> m_cache_hits;
+        mutable std::atomic<uint64_t> m_cache_miss;
+        mutable std::atomic<uint64_t> m_evicted_expired;
+        mutable std::atomic<uint64_t> m_evicted_age;
+        mutable std::atomic<uint64_t> m_evicted_capacity;
+        mutable std::atomic<uint64_t> m_evicted_memory;
+        mutable std::atomic<uint64_t> m_bytes; // held by all entries
+        uint64_t m_max_memory; // zero means unlimited
+        CfrPrecision m_cfr_precision;
+        // last received subcarrier frequencies, shared by all entries; accessed atomically
+        mutable FreqHandle m_freq;
+        // socket, pending requests, trace store, mobility models. All communication with the
+        // server is serialized on the single socket of the SionnaHelper as m_pending matches the
+        // replies in send order; the server's ROUTER socket would accept a DEALER per thread,
+        // but each would need its own pending queue
+        mutable std::mutex m_server_mutex;
+        mutable std::deque<PendingRequest> m_pending; // requests in flight, in send order
+        mutable std::atomic<size_t> m_num_pending; // size of m_pending, readable without lock
+        mutable std::atomic<uint64_t> m_prefetches;
+        mutable std::mutex m_feedback_mutex;
+        mutable std::map<uint32_t, LookaheadFeedback> m_lah_feedback; // per TX node, since the last request
+        mutable std::map<std::pair<uint32_t, int64_t>, LookaheadStep> m_lah_steps; // by TX node and start [ns]
+        mutable std::atomic<uint64_t> m_lah_used;
+        mutable std::atomic<uint64_t> m_lah_unused;
+        Time m_prefetch_horizon; // zero disables prefetching
+        uint32_t m_max_pending_prefetches;
+        uint32_t m_max_batch_links; // one disables batching
+        Time m_max_entry_age; // zero disables age-based eviction
+        uint32_t m_max_entries_per_link; // zero means unlimited
+        bool m_static_links; // keep static links until the nodes move
         bool m_optimize; // too far distance are not computed with raytracing
-        const double m_optimize_margin = 0;
-        Ptr<FriisPropagationLossModel> m_friisLossModel;
-        Ptr<ConstantSpeedPropagationDelayModel> m_constSpeedDelayModel;
+        Ptr<SionnaLinkCuller> m_linkCuller;
+        mutable std::mutex m_culler_mutex; // the link culler and the flat CFR
+        mutable bool m_linkCullerConfigured;
+        mutable std::atomic<uint64_t> m_culled;
+        mutable std::atomic<uint64_t> m_cfr_synthesized; // CFRs synthesized from propagation paths
+        mutable std::vector<Ptr<SionnaMobilityModel>> m_mobility; // by node ID; resolved on first update
+        mutable CfrHandle m_flat_cfr; // CFR of culled links
+        mutable CfrPowerHandle m_flat_cfr_power;
+        mutable std::vector<CacheEntry::BandCfr> m_flat_bands; // of the additional bands
+        bool m_precomputing; // within Precompute(); server lock held
+        Time m_precompute_step; // grid of the sweep; zero if none
+        mutable Time m_server_time; // latest time requested from the server; server lock held
+
+        TracedCallback<uint32_t, uint32_t> m_hitTrace;
+        TracedCallback<uint32_t, uint32_t> m_missTrace;
+        TracedCallback<uint32_t, uint32_t> m_evictTrace;
+        TracedCallback<Time, uint32_t, uint32_t> m_roundTripTrace;
 };
 
 } // namespace ns3
@@ -18,10 +18,12 @@
  */
 
 #include "sionna-spectrum-propagation-loss-model.h"
+#include "sionna-mobility-model.h"
 //#include "sionna-utils.h"
 
 #include "ns3/socket.h"
 #include <ns3/double.h>
+#include <ns3/enum.h>
 #include <ns3/log.h>
 #include <ns3/node.h>
 #include <ns3/object-factory.h>
@@ -45,6 +47,7 @@ NS_LOG_COMPONENT_DEFINE("SionnaSpectrumPropagationLossModel");
 NS_OBJECT_ENSURE_REGISTERED(SionnaSpectrumPropagationLossModel);
 
 SionnaSpectrumPropagationLossModel::SionnaSpectrumPropagationLossModel()
+    : m_cfrTagMode(CFR_TAG_COPY)
 {
     NS_LOG_FUNCTION(this);
 }
@@ -61,7 +64,18 @@ SionnaSpectrumPropagationLossModel::GetTypeId()
         TypeId("ns3::SionnaSpectrumPropagationLossModel")
             .SetParent<SpectrumPropagationLossModel>()
             .SetGroupName("Sionna")
-            .AddConstructor<SionnaSpectrumPropagationLossModel>();
+            .AddConstructor<SionnaSpectrumPropagationLossModel>()
+            .AddAttribute("CfrTagMode",
+                          "How received frames are annotated with the CFR: not at all, with a "
+                          "serialized copy or with a reference to the shared CFR.",
+                          EnumValue(SionnaSpectrumPropagationLossModel::CFR_TAG_COPY),
+                          MakeEnumAccessor(&SionnaSpectrumPropagationLossModel::m_cfrTagMode),
+                          MakeEnumChecker(SionnaSpectrumPropagationLossModel::CFR_TAG_NONE,
+                                          "None",
+                                          SionnaSpectrumPropagationLossModel::CFR_TAG_COPY,
+                                          "Copy",
+                                          SionnaSpectrumPropagationLossModel::CFR_TAG_REFERENCE,
+                                          "Reference"));
     return tid;
 }
 
@@ -71,14 +85,21 @@ SionnaSpectrumPropagationLossModel::SetPropagationCache(Ptr<SionnaPropagationCac
     m_propagationCache = propagationCache;
 }
 
+void
+SionnaSpectrumPropagationLossModel::SetCfrTagFilter(Callback<bool, uint32_t, uint32_t> filter)
+{
+    m_cfrTagFilter = filter;
+}
+
 
 Ptr<SpectrumValue>
 SionnaSpectrumPropagationLossModel::DoCalcRxPowerSpectralDensity(Ptr<const SpectrumSignalParameters> params,
                                                 Ptr<const MobilityModel> a, Ptr<const MobilityModel> b) const
 {
     NS_LOG_FUNCTION(this);
-    uint32_t aId = a->GetObject<Node>()->GetId(); // Id of the node a
-    uint32_t bId = b->GetObject<Node>()->GetId(); // Id of the node b
+    // node IDs are cached by the Sionna mobility model
+    uint32_t aId = DynamicCast<const SionnaMobilityModel>(a)->GetNodeId(); // Id of the node a
+    uint32_t bId = DynamicCast<const SionnaMobilityModel>(b)->GetNodeId(); // Id of the node b
 
     NS_LOG_DEBUG(std::fixed << std::setprecision(9) << Simulator::Now().GetSeconds() <<"s: DoCalcRxPowerSpectralDensity for link " << aId << " - " << bId);
 
@@ -97,47 +118,60 @@ SionnaSpectrumPropagationLossModel::DoCalcRxPowerSpectralDensity(Ptr<const Spect
 
     Ptr<SpectrumValue> rxPsd = Copy<SpectrumValue>(params->psd);
 
+    // single lookup for wideband pathloss and small-scale fading of this link
+    const SionnaPropagationCache::CacheEntry& entry = m_propagationCache->GetPropagationEntry(a, b);
+
     // wideband pathloloss
-    double wb_loss = m_propagationCache->GetPropagationLoss(a, b);
+    double wb_loss = entry.m_loss;
+
+    // band of the signal: the one of the SionnaHelper closest to the center of the PSD
+    uint32_t band = 0;
+    const SionnaHelper* sionnaHelper = m_propagationCache->GetSionnaHelper();
+    if (sionnaHelper->GetNumBands() > 1)
+    {
+        band = sionnaHelper->GetBand(
+            (params->psd->GetSpectrumModel()->Begin()->fc + (params->psd->GetSpectrumModel()->End()-1)->fc) / 2);
+    }
 
-    // get small-scale fading matrix
-    std::vector<std::complex<double>> H_norm = m_propagationCache->GetPropagationCSI(a, b);
-    // add trailing 1 to have same size
-    H_norm.emplace_back(1.0, 0.0);
+    NS_ASSERT_MSG(entry.GetCfrPowerSize(band) == rxPsd->GetValuesN(), "PSD and CFR must have the same size");
 
-    NS_ASSERT_MSG(H_norm.size() == params->psd->GetValuesN(), "PSD and CFR must have the same size");
+    // apply small-scale fading: multiply PSD with the precomputed |H|^2
+    entry.ApplyCfrPower(band, &(*rxPsd->ValuesBegin()));
 
-    // apply small-scale fading
-    auto vit = rxPsd->ValuesBegin(); // psd value iterator
-    size_t idx = 0;
-    while (vit != rxPsd->ValuesEnd())
+    if (m_cfrTagMode == CFR_TAG_NONE || (!m_cfrTagFilter.IsNull() && !m_cfrTagFilter(aId, bId)))
     {
-        // multiply PSD with |H|^2
-        *vit = *vit * std::norm(H_norm[idx]);
-        vit++; idx++;
+        // nobody inspects the CFR of this frame
+        return rxPsd;
     }
 
+    // get small-scale fading matrix (shared with the cache, includes the trailing PSD bin)
+    CfrHandle H_norm = entry.GetCfr(band);
+
     // tag the packet payload with CFR for later processing in application layer
     if (auto wifiTxParams = DynamicCast<const WifiSpectrumSignalParameters>(params))
-    {   // WiFi packet found
-        Ptr<WifiPpdu> ppdu = wifiTxParams->ppdu->Copy();
-        Ptr<const WifiPsdu> psdu = ppdu->GetPsdu();
+    {   // WiFi packet found; the payloads are shared with the PPDU, i.e. no copy is needed
+        Ptr<const WifiPsdu> psdu = wifiTxParams->ppdu->GetPsdu();
+
+        // a single tag for all payloads; in reference mode the CFR is registered only once
+        CFRTag tag;
+        if (m_cfrTagMode == CFR_TAG_REFERENCE)
+        {
+            tag.SetComplexesReference(H_norm);
+        }
+        else
+        {
+            tag.SetComplexes(H_norm);
+        }
+        tag.SetPathloss(wb_loss);
 
         // for each payload
         for (size_t payload_idx = 0; payload_idx < psdu->GetNMpdus(); payload_idx++) {
             Ptr<const Packet> p = psdu->GetPayload(payload_idx);
 
-            CFRTag tag;
-            if (p->PeekPacketTag(tag))
-            {
-                //std::cout << "tag already exists; replace H" << std::endl;
-                tag.SetComplexes(H_norm);
-                tag.SetPathloss(wb_loss);
-            } else
+            CFRTag existing_tag;
+            if (!p->PeekPacketTag(existing_tag))
             {
                 //std::cout << "add new tag with H" << std::endl;
-                tag.SetComplexes(H_norm);
-                tag.SetPathloss(wb_loss);
                 p->AddPacketTag(tag);
             }
         }
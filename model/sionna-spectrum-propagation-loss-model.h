@@ -22,6 +22,7 @@
 
 #include "ns3/spectrum-propagation-loss-model.h"
 #include "sionna-propagation-cache.h"
+#include "ns3/callback.h"
 #include "ns3/random-variable-stream.h"
 #include <ns3/nstime.h>
 #include <ns3/object.h>
@@ -47,8 +48,25 @@ class SionnaSpectrumPropagationLossModel : public SpectrumPropagationLossModel
      */
     static TypeId GetTypeId();
 
+    /**
+     * How the received frames are annotated with the CFR (see CFRTag)
+     */
+    enum CfrTagMode
+    {
+        CFR_TAG_NONE,      // frames are not tagged
+        CFR_TAG_COPY,      // the CFR is serialized into the tag
+        CFR_TAG_REFERENCE  // the tag references the shared CFR
+    };
+
     void SetPropagationCache(Ptr<SionnaPropagationCache> propagationCache);
 
+    /**
+     * Only frames for which the filter returns true are tagged, e.g. only frames received
+     * by nodes whose application inspects the CFR.
+     * \param filter called with the IDs of the TX and RX node
+     */
+    void SetCfrTagFilter(Callback<bool, uint32_t, uint32_t> filter);
+
   private:
     /**
      * @param params the spectrum signal parameters.
@@ -62,6 +80,8 @@ class SionnaSpectrumPropagationLossModel : public SpectrumPropagationLossModel
                                                     Ptr<const MobilityModel> b) const override;
 
     Ptr<SionnaPropagationCache> m_propagationCache;
+    CfrTagMode m_cfrTagMode;
+    Callback<bool, uint32_t, uint32_t> m_cfrTagFilter; // null: every frame is tagged
 };
 
 } // namespace ns3
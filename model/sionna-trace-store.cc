@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2025
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: A. Zubow <zubow@tkn.tu-berlin.de>
+ */
+
+#include "sionna-trace-store.h"
+
+#include "ns3/abort.h"
+#include "ns3/log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ns3
+{
+
+NS_LOG_COMPONENT_DEFINE("SionnaTraceStore");
+
+namespace
+{
+
+const char TRACE_MAGIC[8] = {'N', 'S', '3', 'S', 'C', 'S', 'I', '1'};
+const size_t HEADER_SIZE = sizeof(TRACE_MAGIC) + sizeof(uint64_t);
+const char FREQ_RECORD = 'F';
+const char CSI_RECORD = 'C';
+
+template <typename T>
+void
+Write(std::FILE* file, const T& value)
+{
+    NS_ABORT_MSG_IF(std::fwrite(&value, sizeof(T), 1, file) != 1, "Cannot write CSI trace");
+}
+
+// bounds-checked sequential read from the mapped file
+class Reader
+{
+  public:
+    Reader(const char* data, size_t size, size_t offset)
+        : m_data(data), m_size(size), m_offset(offset)
+    {
+    }
+
+    template <typename T>
+    T Read()
+    {
+        NS_ABORT_MSG_IF(m_offset + sizeof(T) > m_size, "Truncated CSI trace");
+        T value;
+        std::memcpy(&value, m_data + m_offset, sizeof(T));
+        m_offset += sizeof(T);
+        return value;
+    }
+
+    const char* Skip(size_t n)
+    {
+        NS_ABORT_MSG_IF(m_offset + n > m_size, "Truncated CSI trace");
+        const char* p = m_data + m_offset;
+        m_offset += n;
+        return p;
+    }
+
+    size_t GetOffset() const
+    {
+        return m_offset;
+    }
+
+  private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset;
+};
+
+} // namespace
+
+SionnaTraceStore::SionnaTraceStore()
+    : m_file(nullptr), m_map(nullptr), m_map_size(0), m_replayed(0), m_stale(0)
+{
+}
+
+SionnaTraceStore::~SionnaTraceStore()
+{
+    Close();
+}
+
+uint64_t
+SionnaTraceStore::Hash(const std::string& data)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool
+SionnaTraceStore::IsRecordedFor(const std::string& path, uint64_t config_hash)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    uint64_t hash = 0;
+    bool valid = std::fread(magic, sizeof(magic), 1, file) == 1 && std::fread(&hash, sizeof(hash), 1, file) == 1;
+    std::fclose(file);
+    return valid && std::memcmp(magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 && hash == config_hash;
+}
+
+uint64_t
+SionnaTraceStore::LinkKey(uint32_t a, uint32_t b)
+{
+    // channel reciprocity
+    return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+}
+
+void
+SionnaTraceStore::OpenRecord(const std::string& path, uint64_t config_hash)
+{
+    Close();
+    m_file = std::fopen(path.c_str(), "wb");
+    NS_ABORT_MSG_IF(!m_file, "Cannot create CSI trace " << path);
+    NS_ABORT_MSG_IF(std::fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, m_file) != 1, "Cannot write CSI trace");
+    Write(m_file, config_hash);
+    m_last_freq = nullptr;
+    NS_LOG_INFO("Recording CSI trace " << path);
+}
+
+void
+SionnaTraceStore::OpenReplay(const std::string& path, uint64_t config_hash)
+{
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    NS_ABORT_MSG_IF(fd < 0, "Cannot open CSI trace " << path);
+    struct stat st;
+    NS_ABORT_MSG_IF(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < HEADER_SIZE,
+                    "Invalid CSI trace " << path);
+    m_map_size = st.st_size;
+    void* addr = mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    NS_ABORT_MSG_IF(addr == MAP_FAILED, "Cannot map CSI trace " << path);
+    m_map = static_cast<char*>(addr);
+
+    Reader reader(m_map, m_map_size, 0);
+    NS_ABORT_MSG_IF(std::memcmp(reader.Skip(sizeof(TRACE_MAGIC)), TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0,
+                    "Invalid CSI trace " << path);
+    reader.Skip(sizeof(uint64_t));
+    NS_ABORT_MSG_IF(!IsRecordedFor(path, config_hash),
+                    "CSI trace " << path << " was recorded for another simulation configuration");
+
+    // index; the CFRs are decoded on lookup
+    size_t num_records = 0;
+    while (reader.GetOffset() < m_map_size)
+    {
+        size_t offset = reader.GetOffset();
+        char type = reader.Read<char>();
+        if (type == FREQ_RECORD)
+        {
+            uint32_t n = reader.Read<uint32_t>();
+            const int32_t* freq = reinterpret_cast<const int32_t*>(reader.Skip(n * sizeof(int32_t)));
+            auto freq_vec = std::make_shared<std::vector<int>>(n);
+            std::memcpy(freq_vec->data(), freq, n * sizeof(int32_t));
+            m_freqs.push_back(freq_vec);
+            continue;
+        }
+        NS_ABORT_MSG_IF(type != CSI_RECORD, "Invalid record in CSI trace " << path);
+
+        uint32_t a = reader.Read<uint32_t>();
+        uint32_t b = reader.Read<uint32_t>();
+        int64_t start = reader.Read<int64_t>();
+        // end, positions, delay, loss and static flag
+        reader.Skip(sizeof(int64_t) + 6 * sizeof(double) + sizeof(int64_t) + sizeof(double) + sizeof(uint8_t));
+        uint32_t n = reader.Read<uint32_t>();
+        reader.Skip(n * 2 * sizeof(double));
+
+        uint32_t freq_idx = m_freqs.empty() ? UINT32_MAX : static_cast<uint32_t>(m_freqs.size() - 1);
+        m_index[LinkKey(a, b)].push_back(IndexEntry{start, offset, freq_idx});
+        num_records++;
+    }
+
+    for (auto& link : m_index)
+    {
+        std::stable_sort(link.second.begin(), link.second.end(),
+                         [](const IndexEntry& x, const IndexEntry& y) { return x.m_start < y.m_start; });
+    }
+
+    std::cout << "ns3sionna: replaying CSI trace " << path << " with #records: " << num_records
+              << ", #links: " << m_index.size() << std::endl;
+}
+
+void
+SionnaTraceStore::Close()
+{
+    if (m_file)
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+    if (m_map)
+    {
+        munmap(m_map, m_map_size);
+        m_map = nullptr;
+        m_map_size = 0;
+    }
+    m_index.clear();
+    m_freqs.clear();
+}
+
+bool
+SionnaTraceStore::IsRecording() const
+{
+    return m_file != nullptr;
+}
+
+bool
+SionnaTraceStore::IsReplaying() const
+{
+    return m_map != nullptr;
+}
+
+void
+SionnaTraceStore::Append(const Record& record)
+{
+    NS_ASSERT(m_file);
+
+    if (record.m_freq && record.m_freq != m_last_freq)
+    {
+        Write(m_file, FREQ_RECORD);
+        Write(m_file, static_cast<uint32_t>(record.m_freq->size()));
+        for (int freq : *record.m_freq)
+        {
+            Write(m_file, static_cast<int32_t>(freq));
+        }
+        m_last_freq = record.m_freq;
+    }
+
+    Write(m_file, CSI_RECORD);
+    Write(m_file, record.m_a);
+    Write(m_file, record.m_b);
+    Write(m_file, record.m_start_time.GetNanoSeconds());
+    Write(m_file, record.m_end_time.GetNanoSeconds());
+    for (const Vector& pos : {record.m_a_position, record.m_b_position})
+    {
+        Write(m_file, pos.x);
+        Write(m_file, pos.y);
+        Write(m_file, pos.z);
+    }
+    Write(m_file, record.m_delay.GetNanoSeconds());
+    Write(m_file, record.m_loss);
+    Write(m_file, static_cast<uint8_t>(record.m_static));
+    uint32_t n = record.m_cfr ? static_cast<uint32_t>(record.m_cfr->size()) : 0;
+    Write(m_file, n);
+    if (n > 0)
+    {
+        NS_ABORT_MSG_IF(std::fwrite(record.m_cfr->data(), sizeof(std::complex<double>), n, m_file) != n,
+                        "Cannot write CSI trace");
+    }
+}
+
+bool
+SionnaTraceStore::Find(uint32_t a, uint32_t b, Time now, Record& record) const
+{
+    auto link = m_index.find(LinkKey(a, b));
+    if (link == m_index.end())
+    {
+        return false;
+    }
+    const std::vector<IndexEntry>& entries = link->second;
+
+    // record started last at or before now; the first one if none
+    auto next = std::upper_bound(entries.begin(), entries.end(), now.GetNanoSeconds(),
+        [](int64_t t, const IndexEntry& e) { return t < e.m_start; });
+    auto it = next == entries.begin() ? next : std::prev(next);
+
+    Reader reader(m_map, m_map_size, it->m_offset + sizeof(char));
+    record.m_a = reader.Read<uint32_t>();
+    record.m_b = reader.Read<uint32_t>();
+    record.m_start_time = NanoSeconds(reader.Read<int64_t>());
+    record.m_end_time = NanoSeconds(reader.Read<int64_t>());
+    for (Vector* pos : {&record.m_a_position, &record.m_b_position})
+    {
+        pos->x = reader.Read<double>();
+        pos->y = reader.Read<double>();
+        pos->z = reader.Read<double>();
+    }
+    record.m_delay = NanoSeconds(reader.Read<int64_t>());
+    record.m_loss = reader.Read<double>();
+    record.m_static = reader.Read<uint8_t>() != 0;
+    uint32_t n = reader.Read<uint32_t>();
+    auto cfr = std::make_shared<CfrVector>(n);
+    std::memcpy(cfr->data(), reader.Skip(n * sizeof(std::complex<double>)), n * sizeof(std::complex<double>));
+    record.m_cfr = cfr;
+    record.m_freq = it->m_freq == UINT32_MAX ? nullptr : m_freqs[it->m_freq];
+
+    if (record.m_start_time > now || record.m_end_time < now)
+    {
+        // not covered by the recording; valid until the next record of the link
+        m_stale++;
+        record.m_start_time = std::min(record.m_start_time, now);
+        auto after = std::next(it);
+        record.m_end_time = after == entries.end() ? Time::Max() : NanoSeconds(after->m_start - 1);
+        record.m_end_time = std::max(record.m_end_time, now);
+    }
+    m_replayed++;
+    return true;
+}
+
+FreqHandle
+SionnaTraceStore::GetFrequencies() const
+{
+    return m_freqs.empty() ? nullptr : m_freqs.front();
+}
+
+uint64_t
+SionnaTraceStore::GetReplayed() const
+{
+    return m_replayed;
+}
+
+uint64_t
+SionnaTraceStore::GetStale() const
+{
+    return m_stale;
+}
+
+} // namespace ns3
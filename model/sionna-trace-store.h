@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2025
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: A. Zubow <zubow@tkn.tu-berlin.de>
+ */
+
+#ifndef SIONNA_TRACE_STORE_H
+#define SIONNA_TRACE_STORE_H
+
+#include "sionna-cfr.h"
+
+#include "ns3/nstime.h"
+#include "ns3/vector.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ns3
+{
+
+/**
+ * On-disk store of all CSI received from the Sionna server for record/replay runs.
+ *
+ * Record: every cache entry built from a server response is appended to the file. Replay: the
+ * file is memory-mapped and indexed by link and start time; the cache is filled from it
+ * instead of the server, i.e. no server (and no GPU) is needed.
+ *
+ * The file starts with a header containing the hash of the SimInitMessage (scene, radio
+ * parameters, seed, nodes and their mobility); replay refuses a trace of another configuration.
+ * A lookup at a time not covered by the trace (e.g. as the MAC layer sends at other times than
+ * during the recording) is served by the record of the link started last before it.
+ *
+ * File layout (host byte order): header "NS3SCSI1" + uint64 config hash, followed by records.
+ * 'F': uint32 n + n int32 subcarrier frequencies; applies to all following CSI records.
+ * 'C': uint32 a, b; int64 start, end [ns]; double a_position[3], b_position[3]; int64 delay [ns];
+ *      double loss; uint8 static; uint32 n; n complex<double> CFR incl. trailing PSD bin.
+ */
+class SionnaTraceStore
+{
+  public:
+    struct Record
+    {
+        uint32_t m_a;
+        uint32_t m_b;
+        Time m_start_time;
+        Time m_end_time;
+        Vector m_a_position;
+        Vector m_b_position;
+        Time m_delay;
+        double m_loss;
+        bool m_static;
+        FreqHandle m_freq;
+        CfrHandle m_cfr;
+    };
+
+    SionnaTraceStore();
+    ~SionnaTraceStore();
+
+    // create the trace file; an existing file is overwritten
+    void OpenRecord(const std::string& path, uint64_t config_hash);
+    // map and index the trace file; aborts if it was recorded for another configuration
+    void OpenReplay(const std::string& path, uint64_t config_hash);
+    void Close();
+
+    bool IsRecording() const;
+    bool IsReplaying() const;
+
+    void Append(const Record& record);
+
+    /**
+     * @param a first node
+     * @param b second node
+     * @param now the lookup time
+     * @param record the record valid at now or the one of the link started last before now
+     *        with its validity extended to the start of the next record
+     * @return false if the link is not contained in the trace
+     */
+    bool Find(uint32_t a, uint32_t b, Time now, Record& record) const;
+
+    // frequencies of the first frequency record; empty handle if none
+    FreqHandle GetFrequencies() const;
+
+    // number of replayed records and those served outside of their recorded validity
+    uint64_t GetReplayed() const;
+    uint64_t GetStale() const;
+
+    // FNV-1a; stable across runs and platforms
+    static uint64_t Hash(const std::string& data);
+
+    // whether the file is a CSI trace recorded for the configuration of the given hash
+    static bool IsRecordedFor(const std::string& path, uint64_t config_hash);
+
+  private:
+    struct IndexEntry
+    {
+        int64_t m_start;
+        size_t m_offset; // of the record
+        uint32_t m_freq; // index into m_freqs
+    };
+
+    static uint64_t LinkKey(uint32_t a, uint32_t b);
+
+    std::FILE* m_file; // record
+    FreqHandle m_last_freq; // last written frequency record
+    char* m_map; // replay
+    size_t m_map_size;
+    std::unordered_map<uint64_t, std::vector<IndexEntry>> m_index; // sorted by start time
+    std::vector<FreqHandle> m_freqs;
+    mutable uint64_t m_replayed;
+    mutable uint64_t m_stale;
+};
+
+} // namespace ns3
+
+#endif // SIONNA_TRACE_STORE_H
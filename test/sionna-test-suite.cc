@@ -1,6 +1,15 @@
-
 // Include a header file from your module to test.
-#include "ns3/sionna.h"
+#include "ns3/sionna-cfr.h"
+#include "ns3/sionna-helper.h"
+#include "ns3/sionna-mobility-model.h"
+#include "ns3/sionna-propagation-cache.h"
+#include "ns3/sionna-trace-store.h"
+
+#include "ns3/mobility-helper.h"
+#include "ns3/node-container.h"
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
 
 // An essential include is test.h
 #include "ns3/test.h"
@@ -17,44 +26,346 @@ using namespace ns3;
  * \ingroup tests
  */
 
-// This is an example TestCase.
+namespace
+{
+
+// record of a link valid within [start, end] with a CFR on the subcarriers of freq
+SionnaTraceStore::Record
+MakeRecord(uint32_t a, uint32_t b, Time start, Time end, double loss, FreqHandle freq)
+{
+    SionnaTraceStore::Record record;
+    record.m_a = a;
+    record.m_b = b;
+    record.m_start_time = start;
+    record.m_end_time = end;
+    record.m_a_position = Vector(1.0, 2.0, 1.0);
+    record.m_b_position = Vector(4.0, 2.0, 1.0);
+    record.m_delay = NanoSeconds(10);
+    record.m_loss = loss;
+    record.m_static = false;
+    record.m_freq = freq;
+    auto cfr = std::make_shared<CfrVector>();
+    for (size_t k = 0; k < freq->size(); k++)
+    {
+        cfr->emplace_back(loss, static_cast<double>(k));
+    }
+    cfr->emplace_back(1.0, 0.0);
+    record.m_cfr = cfr;
+    return record;
+}
+
+} // namespace
+
 /**
  * \ingroup sionna-tests
- * Test case for feature 1
+ * Record a CSI trace and replay it: covered and uncovered lookup times and the config hash
  */
-class SionnaTestCase1 : public TestCase
+class SionnaTraceStoreTestCase : public TestCase
 {
   public:
-    SionnaTestCase1();
-    virtual ~SionnaTestCase1();
+    SionnaTraceStoreTestCase();
 
   private:
     void DoRun() override;
 };
 
-// Add some help text to this case to describe what it is intended to test
-SionnaTestCase1::SionnaTestCase1()
-    : TestCase("Sionna test case (does nothing)")
+SionnaTraceStoreTestCase::SionnaTraceStoreTestCase()
+    : TestCase("Sionna CSI trace record and replay")
 {
 }
 
-// This destructor does nothing but we include it as a reminder that
-// the test case should clean up after itself
-SionnaTestCase1::~SionnaTestCase1()
+void
+SionnaTraceStoreTestCase::DoRun()
+{
+    std::string path = CreateTempDirFilename("sionna-trace-store.trace");
+    uint64_t config_hash = SionnaTraceStore::Hash("config");
+    FreqHandle freq = std::make_shared<const std::vector<int>>(std::vector<int>{-1, 0, 1});
+
+    SionnaTraceStore store;
+    store.OpenRecord(path, config_hash);
+    store.Append(MakeRecord(1, 2, Seconds(0), MilliSeconds(10), 50.0, freq));
+    store.Append(MakeRecord(1, 2, MilliSeconds(20), MilliSeconds(30), 60.0, freq));
+    store.Close();
+
+    NS_TEST_ASSERT_MSG_EQ(SionnaTraceStore::IsRecordedFor(path, config_hash), true, "Trace of the config");
+    NS_TEST_ASSERT_MSG_EQ(SionnaTraceStore::IsRecordedFor(path, SionnaTraceStore::Hash("other config")), false,
+                          "Hash mismatch not detected");
+
+    store.OpenReplay(path, config_hash);
+    NS_TEST_ASSERT_MSG_EQ(store.GetFrequencies()->size(), 3, "Frequencies not replayed");
+
+    // covered by the first record; reciprocal link
+    SionnaTraceStore::Record record;
+    NS_TEST_ASSERT_MSG_EQ(store.Find(2, 1, MilliSeconds(5), record), true, "Recorded link not found");
+    NS_TEST_ASSERT_MSG_EQ(record.m_start_time, Seconds(0), "Wrong record");
+    NS_TEST_ASSERT_MSG_EQ(record.m_end_time, MilliSeconds(10), "Validity changed");
+    NS_TEST_ASSERT_MSG_EQ_TOL(record.m_loss, 50.0, 1e-12, "Wrong loss");
+    NS_TEST_ASSERT_MSG_EQ(record.m_cfr->size(), 4, "CFR incl. trailing PSD bin expected");
+    NS_TEST_ASSERT_MSG_EQ_TOL((*record.m_cfr)[2].imag(), 2.0, 1e-12, "Wrong CFR");
+    NS_TEST_ASSERT_MSG_EQ(store.GetStale(), 0, "Covered lookup counted as stale");
+
+    // between both records: the first one until the start of the second one
+    NS_TEST_ASSERT_MSG_EQ(store.Find(1, 2, MilliSeconds(15), record), true, "Uncovered time not served");
+    NS_TEST_ASSERT_MSG_EQ_TOL(record.m_loss, 50.0, 1e-12, "Not the record started last");
+    NS_TEST_ASSERT_MSG_EQ(record.m_end_time, MilliSeconds(20) - NanoSeconds(1), "Not extended to the next record");
+    NS_TEST_ASSERT_MSG_EQ(store.GetStale(), 1, "Uncovered lookup not counted");
+
+    // after the last record: valid forever
+    NS_TEST_ASSERT_MSG_EQ(store.Find(1, 2, Seconds(1), record), true, "Uncovered time not served");
+    NS_TEST_ASSERT_MSG_EQ_TOL(record.m_loss, 60.0, 1e-12, "Not the record started last");
+    NS_TEST_ASSERT_MSG_EQ(record.m_end_time, Time::Max(), "Last record not extended");
+
+    NS_TEST_ASSERT_MSG_EQ(store.Find(1, 3, MilliSeconds(5), record), false, "Unknown link found");
+    NS_TEST_ASSERT_MSG_EQ(store.GetReplayed(), 3, "Wrong number of replayed records");
+    store.Close();
+}
+
+/**
+ * \ingroup sionna-tests
+ * Trajectory segments of the SionnaMobilityModel: interpolation and replacement
+ */
+class SionnaMobilityModelTestCase : public TestCase
+{
+  public:
+    SionnaMobilityModelTestCase();
+
+  private:
+    void DoRun() override;
+    void CheckPosition(Ptr<MobilityModel> model, Vector position, Vector velocity);
+};
+
+SionnaMobilityModelTestCase::SionnaMobilityModelTestCase()
+    : TestCase("Sionna mobility model segments")
 {
 }
 
-//
-// This method is the pure virtual method from class TestCase that every
-// TestCase must implement
-//
 void
-SionnaTestCase1::DoRun()
+SionnaMobilityModelTestCase::CheckPosition(Ptr<MobilityModel> model, Vector position, Vector velocity)
+{
+    NS_TEST_EXPECT_MSG_LT(CalculateDistance(model->GetPosition(), position), 1e-9,
+                          "Wrong position at " << Simulator::Now().As(Time::S));
+    NS_TEST_EXPECT_MSG_LT(CalculateDistance(model->GetVelocity(), velocity), 1e-9,
+                          "Wrong velocity at " << Simulator::Now().As(Time::S));
+}
+
+void
+SionnaMobilityModelTestCase::DoRun()
+{
+    Ptr<SionnaMobilityModel> model = CreateObject<SionnaMobilityModel>();
+    model->SetPosition(Vector(0.0, 0.0, 0.0));
+    model->AddSegment(Seconds(1), Seconds(3), Vector(1.0, 0.0, 0.0), Vector(1.0, 0.0, 0.0));
+
+    // before the segment, within it and held after its end
+    Simulator::Schedule(MilliSeconds(500), &SionnaMobilityModelTestCase::CheckPosition, this, model,
+                        Vector(0.0, 0.0, 0.0), Vector(0.0, 0.0, 0.0));
+    Simulator::Schedule(Seconds(2), &SionnaMobilityModelTestCase::CheckPosition, this, model,
+                        Vector(2.0, 0.0, 0.0), Vector(1.0, 0.0, 0.0));
+    Simulator::Schedule(Seconds(4), &SionnaMobilityModelTestCase::CheckPosition, this, model,
+                        Vector(3.0, 0.0, 0.0), Vector(0.0, 0.0, 0.0));
+
+    // a segment with the same start replaces the known one
+    Ptr<SionnaMobilityModel> replaced = CreateObject<SionnaMobilityModel>();
+    replaced->SetPosition(Vector(0.0, 0.0, 0.0));
+    replaced->AddSegment(Seconds(1), Seconds(3), Vector(0.0, 0.0, 0.0), Vector(1.0, 0.0, 0.0));
+    replaced->AddSegment(Seconds(1), Seconds(3), Vector(0.0, 0.0, 0.0), Vector(0.0, 2.0, 0.0));
+    Simulator::Schedule(Seconds(2), &SionnaMobilityModelTestCase::CheckPosition, this, replaced,
+                        Vector(0.0, 2.0, 0.0), Vector(0.0, 2.0, 0.0));
+
+    Simulator::Run();
+    Simulator::Destroy();
+}
+
+/**
+ * \ingroup sionna-tests
+ * Interpolation of a CFR computed for a subset of the subcarriers
+ */
+class SionnaCfrInterpolateTestCase : public TestCase
 {
-    // A wide variety of test macros are available in src/core/test.h
-    NS_TEST_ASSERT_MSG_EQ(true, true, "true doesn't equal true for some reason");
-    // Use this one for floating point comparisons
-    NS_TEST_ASSERT_MSG_EQ_TOL(0.01, 0.01, 0.001, "Numbers are not equal within tolerance");
+  public:
+    SionnaCfrInterpolateTestCase();
+
+  private:
+    void DoRun() override;
+};
+
+SionnaCfrInterpolateTestCase::SionnaCfrInterpolateTestCase()
+    : TestCase("Sionna CFR interpolation")
+{
+}
+
+void
+SionnaCfrInterpolateTestCase::DoRun()
+{
+    // held constant below the first and above the last subcarrier of the subset; appended
+    CfrVector cfr(1, std::complex<double>(7.0, 0.0));
+    CfrInterpolate(CfrVector{{1.0, 0.0}, {3.0, 2.0}}, std::vector<uint32_t>{2, 4}, 6, cfr);
+    CfrVector expected{{7.0, 0.0}, {1.0, 0.0}, {1.0, 0.0}, {1.0, 0.0}, {2.0, 1.0}, {3.0, 2.0}, {3.0, 2.0}};
+    NS_TEST_ASSERT_MSG_EQ(cfr.size(), expected.size(), "Wrong number of subcarriers");
+    for (size_t k = 0; k < expected.size(); k++)
+    {
+        NS_TEST_ASSERT_MSG_EQ_TOL(std::abs(cfr[k] - expected[k]), 0.0, 1e-12, "Wrong value at " << k);
+    }
+
+    // a single subcarrier at the upper edge
+    cfr.clear();
+    CfrInterpolate(CfrVector{{2.0, 0.0}}, std::vector<uint32_t>{3}, 4, cfr);
+    for (size_t k = 0; k < 4; k++)
+    {
+        NS_TEST_ASSERT_MSG_EQ_TOL(std::abs(cfr[k] - std::complex<double>(2.0, 0.0)), 0.0, 1e-12,
+                                  "Not held constant at " << k);
+    }
+
+    // no subset: flat CFR
+    cfr.clear();
+    CfrInterpolate(CfrVector(), std::vector<uint32_t>(), 3, cfr);
+    NS_TEST_ASSERT_MSG_EQ(cfr.size(), 3, "Wrong number of subcarriers");
+    NS_TEST_ASSERT_MSG_EQ_TOL(std::abs(cfr[1] - std::complex<double>(1.0, 0.0)), 0.0, 1e-12, "Not flat");
+}
+
+/**
+ * \ingroup sionna-tests
+ * Memory budget of the SionnaPropagationCache, filled from a replayed CSI trace
+ */
+class SionnaCacheMemoryBudgetTestCase : public TestCase
+{
+  public:
+    SionnaCacheMemoryBudgetTestCase();
+
+  private:
+    void DoRun() override;
+    void Lookup(uint32_t a, uint32_t b);
+    void SetBudget();
+    void CheckUsage(uint64_t evictions, uint64_t entries);
+
+    NodeContainer m_nodes;
+    Ptr<SionnaPropagationCache> m_cache;
+    uint64_t m_entry_size;
+};
+
+SionnaCacheMemoryBudgetTestCase::SionnaCacheMemoryBudgetTestCase()
+    : TestCase("Sionna propagation cache memory budget"),
+      m_entry_size(0)
+{
+}
+
+void
+SionnaCacheMemoryBudgetTestCase::Lookup(uint32_t a, uint32_t b)
+{
+    m_cache->GetPropagationLoss(m_nodes.Get(a)->GetObject<MobilityModel>(),
+                                m_nodes.Get(b)->GetObject<MobilityModel>());
+}
+
+void
+SionnaCacheMemoryBudgetTestCase::SetBudget()
+{
+    // all entries are alike; room for three and a half of them
+    m_entry_size = m_cache->GetMemoryUsage();
+    NS_TEST_ASSERT_MSG_GT(m_entry_size, 0, "Entry not accounted");
+    m_cache->SetAttribute("MaxMemory", UintegerValue(3 * m_entry_size + m_entry_size / 2));
+}
+
+void
+SionnaCacheMemoryBudgetTestCase::CheckUsage(uint64_t evictions, uint64_t entries)
+{
+    UintegerValue evicted;
+    m_cache->GetAttribute("Evictions", evicted);
+    NS_TEST_EXPECT_MSG_EQ(evicted.Get(), evictions, "Wrong number of evictions at " << Simulator::Now().As(Time::S));
+    NS_TEST_EXPECT_MSG_EQ(m_cache->GetMemoryUsage(), entries * m_entry_size,
+                          "Wrong memory usage at " << Simulator::Now().As(Time::S));
+}
+
+void
+SionnaCacheMemoryBudgetTestCase::DoRun()
+{
+    m_nodes.Create(5);
+    MobilityHelper mobility;
+    mobility.SetMobilityModel("ns3::SionnaMobilityModel");
+    mobility.Install(m_nodes);
+    for (uint32_t i = 0; i < m_nodes.GetN(); i++)
+    {
+        m_nodes.Get(i)->GetObject<MobilityModel>()->SetPosition(Vector(1.0 + i, 2.0, 1.0));
+    }
+
+    SionnaHelper sionnaHelper("simple_room/simple_room.xml", "tcp://localhost:5555");
+    sionnaHelper.Configure(5180, 20, 64, 312500);
+    std::string path = CreateTempDirFilename("sionna-cache-budget.trace");
+    sionnaHelper.SetTraceReplay(path);
+
+    // the links looked up below; valid for the whole test
+    FreqHandle freq = std::make_shared<const std::vector<int>>(std::vector<int>{-1, 0, 1});
+    SionnaTraceStore store;
+    store.OpenRecord(path, sionnaHelper.GetConfigHash());
+    for (auto link : std::vector<std::pair<uint32_t, uint32_t>>{{0, 1}, {0, 2}, {0, 3}, {0, 4}, {1, 2}})
+    {
+        store.Append(MakeRecord(m_nodes.Get(link.first)->GetId(), m_nodes.Get(link.second)->GetId(), Seconds(0),
+                                Seconds(100), 50.0, freq));
+    }
+    store.Close();
+    sionnaHelper.Start();
+
+    m_cache = CreateObject<SionnaPropagationCache>();
+    m_cache->SetSionnaHelper(sionnaHelper);
+    m_cache->SetOptimize(false);
+
+    Simulator::Schedule(Seconds(1), &SionnaCacheMemoryBudgetTestCase::Lookup, this, 0, 1);
+    Simulator::Schedule(Seconds(1), &SionnaCacheMemoryBudgetTestCase::SetBudget, this);
+    Simulator::Schedule(Seconds(2), &SionnaCacheMemoryBudgetTestCase::Lookup, this, 0, 2);
+    Simulator::Schedule(Seconds(2), &SionnaCacheMemoryBudgetTestCase::Lookup, this, 0, 3);
+    // the least recently used entry goes, down to 90% of the budget
+    Simulator::Schedule(Seconds(3), &SionnaCacheMemoryBudgetTestCase::Lookup, this, 0, 4);
+    Simulator::Schedule(Seconds(3), &SionnaCacheMemoryBudgetTestCase::CheckUsage, this, 1, 3);
+    // of both entries last used at 2 s only one is needed to get below it
+    Simulator::Schedule(Seconds(4), &SionnaCacheMemoryBudgetTestCase::Lookup, this, 1, 2);
+    Simulator::Schedule(Seconds(4), &SionnaCacheMemoryBudgetTestCase::CheckUsage, this, 2, 3);
+
+    Simulator::Run();
+    m_cache = nullptr;
+    sionnaHelper.Destroy();
+    Simulator::Destroy();
+}
+
+/**
+ * \ingroup sionna-tests
+ * Cache configurations a trajectory sweep of SionnaPropagationCache::Precompute() is rejected with
+ */
+class SionnaPrecomputeSweepTestCase : public TestCase
+{
+  public:
+    SionnaPrecomputeSweepTestCase();
+
+  private:
+    void DoRun() override;
+};
+
+SionnaPrecomputeSweepTestCase::SionnaPrecomputeSweepTestCase()
+    : TestCase("Sionna precomputed trajectory sweep conflicts")
+{
+}
+
+void
+SionnaPrecomputeSweepTestCase::DoRun()
+{
+    SionnaHelper sionnaHelper("simple_room/simple_room.xml", "tcp://localhost:5555");
+    Ptr<SionnaPropagationCache> cache = CreateObject<SionnaPropagationCache>();
+    cache->SetSionnaHelper(sionnaHelper);
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "", "Default configuration rejected");
+
+    // a prefetch is requested at the current time, i.e. before the sweep end
+    cache->SetAttribute("PrefetchHorizon", TimeValue(MilliSeconds(1)));
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "", "Prefetch horizon without prefetching rejected");
+    sionnaHelper.SetPrefetch(true);
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "prefetching", "Prefetching not rejected");
+    sionnaHelper.SetPrefetch(false);
+
+    // evictions before the sweep end
+    cache->SetAttribute("MaxEntriesPerLink", UintegerValue(4));
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "MaxEntriesPerLink", "Per-link capacity not rejected");
+    cache->SetAttribute("MaxEntriesPerLink", UintegerValue(0));
+    cache->SetAttribute("MaxMemory", UintegerValue(1 << 20));
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "MaxMemory", "Memory budget not rejected");
+    cache->SetAttribute("MaxMemory", UintegerValue(0));
+    cache->SetAttribute("MaxEntryAge", TimeValue(MilliSeconds(10)));
+    NS_TEST_ASSERT_MSG_EQ(cache->GetSweepConflict(), "MaxEntryAge", "Entry age limit not rejected");
 }
 
 // The TestSuite class names the TestSuite, identifies what type of TestSuite,
@@ -75,7 +386,11 @@ SionnaTestSuite::SionnaTestSuite()
     : TestSuite("sionna", UNIT)
 {
     // TestDuration for TestCase can be QUICK, EXTENSIVE or TAKES_FOREVER
-    AddTestCase(new SionnaTestCase1, TestCase::QUICK);
+    AddTestCase(new SionnaTraceStoreTestCase, TestCase::QUICK);
+    AddTestCase(new SionnaMobilityModelTestCase, TestCase::QUICK);
+    AddTestCase(new SionnaCfrInterpolateTestCase, TestCase::QUICK);
+    AddTestCase(new SionnaCacheMemoryBudgetTestCase, TestCase::QUICK);
+    AddTestCase(new SionnaPrecomputeSweepTestCase, TestCase::QUICK);
 }
 
 // Do not forget to allocate an instance of this TestSuite